@@ -6,6 +6,13 @@
 #define MINISQL_BPTREE_H
 
 #include "Node.h"
+#include "NodeProfile.h"
+#include "IndexStats.h"
+#include "OffsetBitmap.h"
+#include "TreeFile.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <type_traits>
 
 // Template B+ tree node.
 // For coding convenience, we define an unified node class both represent
@@ -20,13 +27,25 @@ private:
         int value;
         bool is_found;
     };
-    static const int PAGESIZE = 4096;
+    // One node on the way from root to a leaf.
+    struct path_step {
+        Tree pNode;
+        // Index of the child taken, or of the key in a leaf.
+        int index;
+    };
+    typedef std::vector<path_step> tree_path;
     // name of index
     std::string m_name;
+    // Size of the nodes.
+    node_profile m_profile;
     // Pointer to root
     Tree root;
     // Pointer to the head of leaf node
     Tree p_leaf_head;
+    // Pointer to the rightmost leaf node, where appended keys go.
+    Tree p_leaf_tail;
+    // Number of appends in a row, i.e. inserts greater than every key.
+    unsigned int append_run;
     // Number of keys
     unsigned int key_num;
     // Number of levels
@@ -34,13 +53,87 @@ private:
     // Number of nodes.
     unsigned int node_num;
     int key_size;
+    // Bytes of included columns stored with each value, 0 if none.
+    int payload_size;
     // Degree of this B+ tree
     int degree;
     // min number of keys.
     int min_key_num;
+    // Appends in a row after which the tree splits for sequential keys.
+    static const unsigned int sequential_run = 16;
+    // Offsets gathered from leaves before they are added to a bitmap.
+    static const size_t bitmap_batch = 1 << 16;
+    // Subranges per worker of a parallel scan, so that uneven ones even out.
+    static const unsigned int parts_per_worker = 4;
+    // Deletes leave nodes underfull, merging is deferred to compact().
+    bool relaxed;
+    // Key of the leaf the next compaction step starts from.
+    T compact_key;
+    bool compact_started;
+    // Key of the leaf the next defragmentation step starts from.
+    T defrag_key;
+    bool defrag_started;
+    // Keys rewritten by the running defragmentation pass.
+    uint64_t defrag_keys;
+    // Leaves are kept packed between operations.
+    bool compressed;
+    // Internal nodes keep the number of entries under each child.
+    bool counted;
+    // Leaves unpacked by the running operation, packed again when it ends.
+    std::vector<Tree> unpacked;
+    // Way down of the running write, which splits and merges walk back up.
+    // Nodes have no pointer to their father.
+    tree_path path;
+    // Operation counters, updated with relaxed atomics.
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> inserts;
+    std::atomic<uint64_t> deletes;
+    std::atomic<uint64_t> splits;
+    std::atomic<uint64_t> merges;
+    std::atomic<uint64_t> borrows;
+    std::atomic<uint64_t> scans;
+    std::atomic<uint64_t> scanned_keys;
 public:
+    // Position of one entry in the leaf chain, to walk keys in order either
+    // way. Any write to the tree invalidates it.
+    class cursor {
+    public:
+        cursor();
+
+        // @return: false once moved past either end.
+        bool valid() const;
+
+        T key() const;
+
+        offset value() const;
+
+        // @return: included columns of the key, nullptr if the tree has none.
+        const char *payload() const;
+
+        // Move to the next greater key.
+        void next();
 
-    explicit BPTree(std::string &name);
+        // Move to the next smaller key.
+        void prev();
+
+    private:
+        friend class BPTree;
+
+        cursor(Tree pNode, int index);
+
+        // Move over the ends of leaves until index is in pNode.
+        void settle_forward();
+
+        void settle_backward();
+
+        Tree pNode;
+        int index;
+    };
+
+    // @profile: size of the nodes.
+    // @payload_size: bytes of included columns stored with each value in the
+    //  leaves, so that searches return them without fetching the record.
+    explicit BPTree(std::string &name, node_profile profile = profile_page, int payload_size = 0);
 
     ~BPTree();
 
@@ -50,14 +143,27 @@ public:
     //  -1 if not find
     offset search_by_key(const T &key);
 
+    // Search by key, also copying the included columns of key.
+    // @payload: payload_bytes() bytes to store the included columns.
+    offset search_by_key(const T &key, char *payload);
+
     // Insert key:value into B+ tree
+    // @payload: included columns to store with value, nullptr for zeros.
     // @return true if success inserted.
-    bool insert(const T &key, int value);
+    bool insert(const T &key, int value, const char *payload = nullptr);
 
     // Delete key:value in B+ tree
     // @return true if delte success
     bool delete_by_key(const T &key);
 
+    // Delete every key in [begin_key, end_key]. Leaves inside the range are
+    // freed whole and the two at its ends trimmed, then the internal levels
+    // are built again once. Ranges of fewer keys than the tree has nodes
+    // are deleted key by key instead, so the cost stays in proportion to the
+    // range.
+    // @return: number of keys deleted.
+    unsigned int delete_range(const T &begin_key, const T &end_key);
+
     // Destroy this tree.
     // @tree: root of this tree
     // Can also be a node.
@@ -69,16 +175,163 @@ public:
     // @return: vector to store all value found
     std::vector<offset> search_between(const T &begin_key, const T &end_key);
 
+    // Same as search_between, adding values to a bitmap as leaves are walked
+    // instead of collecting and sorting them.
+    // @results: bitmap to add values to.
+    void search_between(const T &begin_key, const T &end_key, offset_bitmap &results);
+
+    // Same range as search_between, split at separator keys of the internal
+    // nodes into about equal subranges that are scanned on pool.
+    // @parts: about how many subranges, 0 for a few per worker.
+    // @return: values in key order.
+    std::vector<offset> search_between_parallel(const T &begin_key, const T &end_key, ThreadPool &pool,
+                                                unsigned int parts = 0);
+
     std::vector<offset> search_smaller(const T &end_key);
 
     std::vector<offset> search_greater(const T &begin_key);
 
-    // Load from disk
+    // Search keys less than end_key walking leaves backward, greatest first.
+    // @limit: max number of values.
+    // @inclusive: also take end_key itself.
+    // @return: values in descending order of key.
+    std::vector<offset> search_smaller_desc(const T &end_key, size_t limit, bool inclusive = false);
+
+    // @limit: max number of values.
+    // @return: values of the greatest keys in descending order of key.
+    std::vector<offset> search_last(size_t limit);
+
+    // Take values of keys in [begin_key, end_key] in key order, stopping as
+    // soon as limit values are taken.
+    // @bounded_begin: if false, start from the smallest key.
+    // @after: start after begin_key instead of at it, to resume a page.
+    // @bounded_end: if false, go on to the greatest key.
+    // @skip: keys to pass over before taking values, less the keys passed
+    //  over on return. Counted trees pass over them in one descent.
+    // @limit: max number of values to take.
+    // @values: container to store the values.
+    // @last_key: key of the last value taken.
+    // @return: true if keys in range are left after the last value taken.
+    bool search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end, const T &end_key,
+                     size_t &skip, size_t limit, std::vector<offset> &values, T &last_key);
+
+    // @return: cursor at the first key not less than key.
+    cursor seek(const T &key);
+
+    // @return: cursor at the last key less than key, or not greater than
+    //  key if inclusive.
+    cursor seek_back(const T &key, bool inclusive);
+
+    // @return: cursor at the smallest key.
+    cursor first();
+
+    // @return: cursor at the greatest key.
+    cursor last();
+
+    // Build the tree bottom-up from sorted keys.
+    // Only allowed on an empty tree.
+    // @keys: keys in strictly ascending order.
+    // @values: value associated with each key.
+    // @payloads: included columns of each key one after another, nullptr for
+    //  zeros.
+    void bulk_load(const std::vector<T> &keys, const std::vector<offset> &values, const char *payloads = nullptr);
+
+    // Insert keys not in the tree yet, in one descent per leaf they fall
+    // in, each leaf taking its keys in one pass.
+    // @keys: keys in strictly ascending order.
+    // @values: value associated with each key.
+    void insert_sorted(const std::vector<T> &keys, const std::vector<offset> &values);
+
+    // Copy all key:value pairs in key order.
+    // @keys: container to store the keys.
+    // @values: container to store the values.
+    void dump_entries(std::vector<T> &keys, std::vector<offset> &values);
+
+    // @return: number of keys in this tree.
+    unsigned int size() const;
+
+    // Walk the tree to collect its shape, and read the operation counters.
+    index_stats stats();
+
+    // Walk the tree to add up the bytes it holds: nodes with their key,
+    // value and child storage, packed leaves and working buffers.
+    size_t memory_bytes() const;
+
+    // @return: number of levels.
+    unsigned int height() const;
+
+    // @return: number of splits, merges and borrows so far.
+    uint64_t restructures() const;
+
+    node_profile profile() const;
+
+    // @return: bytes of included columns stored with each value.
+    int payload_bytes() const;
+
+    // In relaxed mode deletes never borrow or merge: nodes may stay
+    // underfull, and only nodes left empty are freed.
+    void set_relaxed_delete(bool relaxed);
+
+    bool relaxed_delete() const;
+
+    // Merge sparse neighbor leaves, going on from where the last call stopped
+    // and wrapping around at the last leaf.
+    // @budget: max number of leaves to visit.
+    // @return: number of leaves merged away.
+    unsigned int compact(unsigned int budget);
+
+    // Rewrite leaves into new, densely filled leaves allocated one after
+    // another in key order, one father at a time, going on from where the
+    // last call stopped. Scans over rewritten leaves run as over a tree just
+    // bulk loaded, and the tree stays usable between calls.
+    // @budget: max number of leaves to rewrite.
+    // @return: progress of the running pass.
+    defrag_progress defragment(unsigned int budget);
+
+    // Keep leaves packed with frame of reference encoding, see PackedLeaf.
+    // Searches decode packed leaves in place, writes unpack the leaves they
+    // change and pack them again before returning.
+    // Only allowed for int keys.
+    void set_compressed(bool compressed);
+
+    bool compressed_leaves() const;
+
+    // Keep in internal nodes the number of entries under each child, so that
+    // ranks and counts take one descent instead of a leaf walk.
+    // Inserts and deletes update the counts along their path.
+    void set_counted(bool counted);
+
+    bool counted_tree() const;
+
+    // @return: number of keys in [begin_key, end_key].
+    unsigned int count_between(const T &begin_key, const T &end_key);
+
+    // @return: number of keys less than key.
+    unsigned int rank(const T &key);
+
+    // @rank: 0 for the smallest key.
+    // @return: cursor at the key of rank, invalid if rank is out of range.
+    cursor at_rank(unsigned int rank);
+
+    // @key: key of rank.
+    // @value: value of key.
+    // @return: false if rank is out of range.
+    bool key_at_rank(unsigned int rank, T &key, offset &value);
+
+    // Load from disk, the TreeFile image in file_name().
+    // Only allowed on an empty tree. Trees start empty, and are only loaded
+    // when asked, so that creating one never waits on the disk.
     void load_all_node();
 
-    // Dump to disk
+    // Dump to disk, as a TreeFile image in file_name().
     void dump_to_disk();
 
+    // @return: file the tree is dumped to.
+    std::string file_name() const;
+
+    // @return: file the tree of an index is dumped to.
+    static std::string file_name_of(const std::string &index_name);
+
     // load a page
     void load_from_disk(char *p, char *end);
 
@@ -89,38 +342,132 @@ private:
     void initialize();
 
     // Adjust to avoid overflow
-    bool adjust_after_insert(Tree pNode);
+    // @depth: depth in path of the node that may be full.
+    bool adjust_after_insert(int depth);
+
+    // @return: number of keys pNode keeps when it splits.
+    int split_point(Tree pNode);
 
     // Adjust to avoid underflow
-    bool adjust_after_delete(Tree pNode);
+    // @depth: depth in path of the node that may be underfull.
+    bool adjust_after_delete(int depth);
+
+    // Remove a root without keys.
+    bool adjust_root();
+
+    // Build internal levels over level_nodes until one node, the root, is left.
+    // @level_nodes: nodes of one level in key order.
+    // @level_min: smallest key under each node of level_nodes.
+    void build_levels(std::vector<Tree> &level_nodes, std::vector<T> &level_min);
+
+    // Free the internal nodes under pNode, leaving the leaves.
+    void destroy_internal(Tree pNode);
+
+    // Spread the entries of neighbor leaves evenly over as few of them as
+    // hold the entries, and free the others.
+    // @leaves: neighbor leaves in key order.
+    void redistribute_leaves(const std::vector<Tree> &leaves);
+
+    // Move the last entry of left brother into pNode.
+    // @index: index of the separator between them in father.
+    void borrow_from_left(Tree pNode, Tree brother, Tree father, int index);
+
+    // Move the first entry of right brother into pNode.
+    // @index: index of the separator between them in father.
+    void borrow_from_right(Tree pNode, Tree brother, Tree father, int index);
+
+    // Move all entries of right into left, and delete right.
+    // @index: index of the separator between them in father.
+    void merge_nodes(Tree left, Tree right, Tree father, int index);
+
+    // Unlink the node at depth in path, a leaf without keys or an internal
+    // node without children, and free it. Fathers left without children go
+    // as well.
+    void remove_empty(int depth);
+
+    // @return: number of entries under pNode, from the counts of its father
+    //  kept in pNode itself.
+    unsigned int entries(Tree pNode) const;
+
+    // Fill the counts of pNode and the nodes under it.
+    // @return: number of entries under pNode.
+    unsigned int build_counts(Tree pNode);
+
+    // Add delta to the counts of the children on path.
+    void add_count(int delta);
+
+    // @return: number of keys less than key, or not greater than key if
+    //  inclusive.
+    unsigned int rank_of(const T &key, bool inclusive);
+
+    // Unpack a leaf about to change, if leaves are compressed.
+    void touch(Tree pNode);
+
+    // Stop tracking a leaf about to be freed.
+    void forget(Tree pNode);
+
+    // Pack again the leaves touched by this operation.
+    void seal();
 
     // Search where the leaf stored
-    void find_by_key(Tree pNode, const T &key, search_info &info);
+    // @path: if not nullptr, filled with the way down from pNode.
+    void find_by_key(Tree pNode, const T &key, search_info &info, tree_path *path = nullptr);
+
+    // @return: up to parts - 1 separator keys in (low, high], ascending,
+    //  taken from the highest level of internal nodes having enough of them.
+    std::vector<T> split_keys(const T &low, const T &high, unsigned int parts);
+
+    // Append values from position from up to position to, exclusive.
+    static void copy_values(search_info from, const search_info &to, std::vector<offset> &values);
+
+    // Fill path with the way down to the first or the last leaf.
+    void find_edge(bool last, tree_path &path);
 
     // Create or open file.
     void get_file(const std::string &file_name);
 
     int count_block_num(const std::string &index_name);
+
+    // Add n to an operation counter.
+    static void count(std::atomic<uint64_t> &counter, uint64_t n = 1);
 };
 
 
 template<class T>
-BPTree<T>::BPTree(std::string &name):
+BPTree<T>::BPTree(std::string &name, node_profile profile, int payload_size):
         m_name(name),
+        m_profile(profile),
         key_num(0),
         level(0),
         node_num(0),
         root(nullptr),
-        p_leaf_head(nullptr) {
+        p_leaf_head(nullptr),
+        p_leaf_tail(nullptr),
+        append_run(0),
+        relaxed(false),
+        compact_started(false),
+        defrag_started(false),
+        defrag_keys(0),
+        compressed(false),
+        counted(false),
+        lookups(0),
+        inserts(0),
+        deletes(0),
+        splits(0),
+        merges(0),
+        borrows(0),
+        scans(0),
+        scanned_keys(0) {
 
     key_size = sizeof(T);
-    degree = (PAGESIZE - sizeof(int)) / (sizeof(T) + sizeof(int));
+    this->payload_size = std::max(0, payload_size);
+    // Keys larger than a small node still get a few per node. Leaves with
+    // included columns hold fewer entries.
+    degree = std::max(4, static_cast<int>((node_bytes(profile) - sizeof(int)) /
+                                          (sizeof(T) + sizeof(int) + this->payload_size)));
     min_key_num = (degree - 1) / 2;
     // Initialize the keys.
     initialize();
-
-    load_all_node();
-
 }
 
 
@@ -135,108 +482,147 @@ BPTree<T>::~BPTree() {
 
 template<class T>
 void BPTree<T>::initialize() {
-    root = new Node<T>(degree, true);
+    root = new Node<T>(degree, true, payload_size);
     key_num = 0;
     level = 1;
     node_num = 1;
     p_leaf_head = root;
+    p_leaf_tail = root;
+    append_run = 0;
+    compact_started = false;
 }
 
 
 template<class T>
-void BPTree<T>::find_by_key(Tree pNode, const T &key, search_info &info) {
-    int key_index = 0; // The index storing the key in this node.
-    // Search if key exist in this node
-    if (pNode->find_by_key(key, key_index)) {
-        // This is leaf node and key in this node.
+void BPTree<T>::find_by_key(Tree pNode, const T &key, search_info &info, tree_path *path) {
+    if (path)
+        path->clear();
+    while (true) {
+        int key_index = 0; // The index storing the key in this node.
+        bool found = pNode->find_by_key(key, key_index);
         if (pNode->is_leaf) {
             info.pNode = pNode;
             info.value = key_index;
-            info.is_found = true;
-        } else {
-            // Not leaf node, search recursively.
-            pNode = pNode->child[key_index + 1];
-            while (!pNode->is_leaf) {
-                pNode = pNode->child[0];
-            }
-            // Since key appears in non leaf node.
-            // Key must be the first value in this node.
-            info.pNode = pNode;
-            info.value = 0;
-            info.is_found = true;
+            info.is_found = found;
+            if (path)
+                path->push_back({pNode, key_index});
+            return;
         }
+        // Key equals a separator, so it can only be in the right subtree.
+        // Separators may be left over from deleted keys, so search on.
+        if (found)
+            key_index++;
+        if (path)
+            path->push_back({pNode, key_index});
+        pNode = pNode->child[key_index];
+    }
+}
 
-    } else {
-        // Key not appears in this node.
-        if (pNode->is_leaf) {
-            // Still not find
-            info.pNode = pNode;
-            info.value = key_index;
-            info.is_found = false;
-        } else {
-            // Search recursively
-            find_by_key(pNode->child[key_index], key, info);
-        }
+template<class T>
+void BPTree<T>::find_edge(bool last, tree_path &path) {
+    path.clear();
+    Tree pNode = root;
+    while (!pNode->is_leaf) {
+        int index = last ? pNode->key_num : 0;
+        path.push_back({pNode, index});
+        pNode = pNode->child[index];
     }
+    path.push_back({pNode, last ? pNode->key_num : 0});
 }
 
 template<class T>
-bool BPTree<T>::insert(const T &key, const int value) {
+bool BPTree<T>::insert(const T &key, const int value, const char *payload) {
     search_info info;
     // Init in the first insert;
     if (!root)
         initialize();
-    // Check if exist
-    find_by_key(root, key, info);
-    if (info.is_found) {
-        throw DuplicateKey();
-        return false;
+    bool append = p_leaf_tail->key_num > 0 && p_leaf_tail->key_at(p_leaf_tail->key_num - 1) < key;
+    if (append) {
+        // Key is greater than every key, append to the rightmost leaf
+        // without descending from root.
+        append_run++;
+        info.pNode = p_leaf_tail;
     } else {
-        info.pNode->insert_key(key, value);
-        // Adjust after insertion
-        if (info.pNode->key_num == degree) {
-            adjust_after_insert(info.pNode);
+        append_run = 0;
+        // Check if exist
+        find_by_key(root, key, info, &path);
+        if (info.is_found) {
+            throw DuplicateKey();
+            return false;
         }
-        key_num++;
-        return true;
     }
+    touch(info.pNode);
+    info.pNode->insert_key(key, value, payload);
+    // Appends only find their way down when the tail has to split, or
+    // when counts are kept.
+    if (append && (counted || info.pNode->key_num == degree))
+        find_edge(true, path);
+    if (counted)
+        add_count(1);
+    // Adjust after insertion
+    if (info.pNode->key_num == degree) {
+        adjust_after_insert(static_cast<int>(path.size()) - 1);
+    }
+    seal();
+    key_num++;
+    count(inserts);
+    return true;
 }
 
 template<class T>
-bool BPTree<T>::adjust_after_insert(Tree pNode) {
-    T key;
-    Tree newNode = pNode->split_node(key);
-    node_num++;
+int BPTree<T>::split_point(Tree pNode) {
+    if (append_run < sequential_run)
+        return pNode->is_leaf ? min_key_num + 1 : min_key_num;
+    // Keys keep coming at the right end, which only ever splits the
+    // rightmost nodes: leave the left node nearly full.
+    int right_num = std::max(1, degree / 10);
+    return pNode->is_leaf ? degree - right_num : degree - right_num - 1;
+}
 
-    if (pNode->is_root()) {
-        // If just have root node.
-        auto root = new Node<T>(degree, false);
-        level++;
+template<class T>
+bool BPTree<T>::adjust_after_insert(int depth) {
+    Tree pNode = path[depth].pNode;
+    while (pNode->key_num == degree) {
+        T key;
+        Tree newNode = pNode->split_node(key, split_point(pNode));
+        touch(newNode);
         node_num++;
-        this->root = root;
-        pNode->father = root;
-        newNode->father = root;
-        root->insert_key(key);
-        root->child[0] = pNode;
-        root->child[1] = newNode;
-        return true;
-    } else {
-        // Not root
-        Tree father = pNode->father;
-        int index = father->insert_key(key);
-
-        father->child[index + 1] = newNode;
-        newNode->father = father;
-        // Adjust recursively
-        if (father->key_num == degree)
-            return adjust_after_insert(father);
-
-        return true;
+        count(splits);
+        if (pNode == p_leaf_tail)
+            p_leaf_tail = newNode;
+
+        if (depth == 0) {
+            // If just have root node.
+            auto root = new Node<T>(degree, false);
+            level++;
+            node_num++;
+            this->root = root;
+            root->insert_key(key);
+            root->child[0] = pNode;
+            root->child[1] = newNode;
+            if (counted) {
+                root->counts.assign(degree + 2, 0);
+                root->counts[0] = entries(pNode);
+                root->counts[1] = entries(newNode);
+            }
+            return true;
+        }
+        // Not root: newNode goes right after pNode in its father, which
+        // is adjusted in turn.
+        depth--;
+        pNode = path[depth].pNode;
+        pNode->insert_child(path[depth].index, key, newNode);
+        if (counted) {
+            pNode->counts[path[depth].index] = entries(path[depth + 1].pNode);
+            pNode->counts[path[depth].index + 1] = entries(newNode);
+        }
     }
+    return true;
 }
 
 template<class T>
 offset BPTree<T>::search_by_key(const T &key) {
+    count(lookups);
     if (!root)
         return -1;
     search_info info;
@@ -245,7 +631,22 @@ offset BPTree<T>::search_by_key(const T &key) {
     if (!info.is_found)
         return -1;
     else
-        return info.pNode->values[info.value];
+        return info.pNode->value_at(info.value);
+}
+
+template<class T>
+offset BPTree<T>::search_by_key(const T &key, char *payload) {
+    count(lookups);
+    if (!root)
+        return -1;
+    search_info info;
+    find_by_key(root, key, info);
+
+    if (!info.is_found)
+        return -1;
+    if (payload_size > 0)
+        std::copy(info.pNode->payload_at(info.value), info.pNode->payload_at(info.value + 1), payload);
+    return info.pNode->value_at(info.value);
 }
 
 template<class T>
@@ -256,250 +657,735 @@ bool BPTree<T>::delete_by_key(const T &key) {
         throw BPTreeInnerException("Tree to delete with a null root");
         return false;
     } else {
-        find_by_key(root, key, info);
+        find_by_key(root, key, info, &path);
         if (!info.is_found) {
             throw KeyNotExist();
             return false;
         } else {
-            if (info.pNode->is_root()) {
-                // This tree just contain an root node.
-                info.pNode->delete_key_start_by(info.value);
-                key_num--;
-                return adjust_after_delete(info.pNode);
+            // Separators equal to the deleted key are left as is: they still
+            // split the keys of their children correctly.
+            touch(info.pNode);
+            info.pNode->delete_key_start_by(info.value);
+            if (counted)
+                add_count(-1);
+            key_num--;
+            count(deletes);
+            bool result = true;
+            int depth = static_cast<int>(path.size()) - 1;
+            if (!relaxed)
+                result = adjust_after_delete(depth);
+            else if (info.pNode->key_num == 0)
+                remove_empty(depth);
+            seal();
+            return result;
+        }
+    }
+}
+
+template<class T>
+unsigned int BPTree<T>::delete_range(const T &begin_key, const T &end_key) {
+    if (!root || end_key < begin_key)
+        return 0;
+    cursor c = seek(begin_key);
+    // Building the internal levels again visits every node, rebalancing
+    // along the paths of fewer keys visits less.
+    size_t most = std::max(static_cast<size_t>(degree), static_cast<size_t>(node_num));
+    std::vector<T> few;
+    for (cursor it = c; it.valid() && !(end_key < it.key()) && few.size() <= most; it.next())
+        few.push_back(it.key());
+    if (few.size() <= most) {
+        for (auto &key : few)
+            delete_by_key(key);
+        return static_cast<unsigned int>(few.size());
+    }
+
+    // The range spans more than a leaf: trim its first and last leaf, and
+    // unlink the leaves between them.
+    Tree before = c.index > 0 ? c.pNode : c.pNode->prev;
+    Tree after = nullptr;
+    std::vector<Tree> freed;
+    unsigned int removed = 0;
+    for (Tree p = c.pNode; p != nullptr; p = p->sibling) {
+        int start = p == c.pNode ? c.index : 0;
+        if (!(end_key < p->key_at(p->key_num - 1))) {
+            removed += p->key_num - start;
+            if (start == 0) {
+                freed.push_back(p);
             } else {
-                if (info.value == 0 && p_leaf_head != info.pNode) {
-                    // Update internal node
-                    int index = 0;
-
-                    Tree cur_father = info.pNode->father;
-                    bool if_found_inBranch = cur_father->find_by_key(key, index);
-                    while (!if_found_inBranch) {
-                        if (cur_father->father)
-                            cur_father = cur_father->father;
-                        else
-                            break;
-                        if_found_inBranch = cur_father->find_by_key(key, index);
-                    }
-
-                    cur_father->keys[index] = info.pNode->keys[1];
-
-                    info.pNode->delete_key_start_by(info.value);
-                    key_num--;
-                    return adjust_after_delete(info.pNode);
+                touch(p);
+                p->delete_keys(start, p->key_num - start);
+            }
+            continue;
+        }
+        int stop = start;
+        while (!(end_key < p->key_at(stop)))
+            stop++;
+        if (stop > start) {
+            touch(p);
+            p->delete_keys(start, stop - start);
+            removed += stop - start;
+        }
+        after = p;
+        break;
+    }
+    if (before)
+        before->sibling = after;
+    else
+        p_leaf_head = after;
+    if (after)
+        after->prev = before;
+    else
+        p_leaf_tail = before;
+    // Internal nodes still point to the freed leaves.
+    destroy_internal(root);
+    for (auto p : freed) {
+        delete p;
+        node_num--;
+    }
+    key_num -= removed;
+    count(deletes, removed);
 
-                } else {
-                    // Update lead node.
-                    info.pNode->delete_key_start_by(info.value);
-                    key_num--;
-                    return adjust_after_delete(info.pNode);
-                }
+    if (!p_leaf_head) {
+        seal();
+        initialize();
+        return removed;
+    }
+    // Only the leaves at the ends of the range may be underfull.
+    if (!relaxed) {
+        std::vector<Tree> window;
+        bool underfull = false;
+        for (Tree p : {before, after}) {
+            if (p) {
+                window.push_back(p);
+                underfull = underfull || p->key_num < min_key_num;
             }
         }
+        if (underfull) {
+            if (window.front()->prev)
+                window.insert(window.begin(), window.front()->prev);
+            if (window.back()->sibling)
+                window.push_back(window.back()->sibling);
+            redistribute_leaves(window);
+        }
+    }
+
+    std::vector<Tree> level_nodes;
+    std::vector<T> level_min;
+    for (Tree p = p_leaf_head; p != nullptr; p = p->sibling) {
+        level_nodes.push_back(p);
+        level_min.push_back(p->key_at(0));
     }
+    node_num = static_cast<unsigned int>(level_nodes.size());
+    level = 1;
+    build_levels(level_nodes, level_min);
+    if (counted)
+        build_counts(root);
+    append_run = 0;
+    seal();
+    return removed;
 }
 
 template<class T>
-bool BPTree<T>::adjust_after_delete(Tree pNode) {
-    // Not necessary to adjust:
-    if (((pNode->is_leaf) && (pNode->key_num >= min_key_num)) ||
-        ((degree != 3) && (!pNode->is_leaf) && (pNode->key_num >= min_key_num - 1)) ||
-        ((degree == 3) && (!pNode->is_leaf) && (pNode->key_num < 0))) {
-        return true;
+void BPTree<T>::redistribute_leaves(const std::vector<Tree> &leaves) {
+    std::vector<T> keys;
+    std::vector<offset> values;
+    std::vector<char> payloads;
+    for (auto p : leaves) {
+        touch(p);
+        keys.insert(keys.end(), p->keys.begin(), p->keys.begin() + p->key_num);
+        values.insert(values.end(), p->values.begin(), p->values.begin() + p->key_num);
+        if (payload_size > 0)
+            payloads.insert(payloads.end(), p->payload_at(0), p->payload_at(p->key_num));
+    }
+    int n = static_cast<int>(keys.size());
+    int leaf_cnt = std::max(1, (n + degree - 2) / (degree - 1));
+    for (int i = 0, pos = 0; i < leaf_cnt; i++) {
+        int cnt = n / leaf_cnt + (i < n % leaf_cnt ? 1 : 0);
+        Tree p = leaves[i];
+        std::copy(keys.begin() + pos, keys.begin() + pos + cnt, p->keys.begin());
+        std::copy(values.begin() + pos, values.begin() + pos + cnt, p->values.begin());
+        if (payload_size > 0)
+            std::copy(payloads.begin() + static_cast<size_t>(pos) * payload_size,
+                      payloads.begin() + static_cast<size_t>(pos + cnt) * payload_size, p->payload_at(0));
+        p->key_num = cnt;
+        pos += cnt;
     }
-    if (pNode->is_root()) {
-        // For root node
-        if (pNode->key_num > 0)
+    Tree last = leaves[leaf_cnt - 1];
+    last->sibling = leaves.back()->sibling;
+    if (last->sibling)
+        last->sibling->prev = last;
+    else
+        p_leaf_tail = last;
+    for (size_t i = leaf_cnt; i < leaves.size(); i++) {
+        forget(leaves[i]);
+        delete leaves[i];
+        node_num--;
+    }
+}
+
+template<class T>
+bool BPTree<T>::adjust_after_delete(int depth) {
+    for (; depth > 0; depth--) {
+        Tree pNode = path[depth].pNode;
+        // Not necessary to adjust:
+        int min_num = pNode->is_leaf ? min_key_num : std::max(1, min_key_num - 1);
+        if (pNode->key_num >= min_num)
             return true;
-        else {
-            // None leaf node
-            if (root->is_leaf) {
-                // If root is also a leaf node, we shall set root = nullptr
-                delete pNode;
-                root = nullptr;
-                p_leaf_head = nullptr;
-                level--;
-                node_num--;
-            } else {
-                // son of root node become leaf
-                root = pNode->child[0];
-                root->father = nullptr;
-                delete pNode;
-                level--;
-                node_num--;
-            }
-        }
-    } else {
+
         // Non root
-        Tree father = pNode->father, brother = nullptr;
-        if (pNode->is_leaf) {
-            // delete in leaf
-            int index = 0;
-            father->find_by_key(pNode->keys[0], index);
-            // Borrow from left siblings
-            if ((father->child[0] != pNode) && (index + 1 == father->key_num)) {
-                brother = father->child[index];
-                if (brother->key_num > min_key_num) {
-                    for (int i = pNode->key_num; i > 0; i--) {
-                        pNode->keys[i] = pNode->keys[i - 1];
-                        pNode->values[i] = pNode->values[i - 1];
-                    }
-                    pNode->keys[0] = brother->keys[brother->key_num - 1];
-                    pNode->values[0] = brother->values[brother->key_num - 1];
-                    brother->delete_key_start_by(brother->key_num - 1);
-
-                    pNode->key_num++;
-                    father->keys[index] = pNode->keys[0];
-                    return true;
+        Tree father = path[depth - 1].pNode;
+        int index = path[depth - 1].index;
+        Tree left = index > 0 ? father->child[index - 1] : nullptr;
+        Tree right = index < father->key_num ? father->child[index + 1] : nullptr;
+        // Only child of a father left by relaxed deletes: rebalance the father.
+        if (!left && !right)
+            continue;
+
+        if (left && left->key_num > min_num) {
+            borrow_from_left(pNode, left, father, index - 1);
+            count(borrows);
+            return true;
+        }
+        if (right && right->key_num > min_num) {
+            borrow_from_right(pNode, right, father, index);
+            count(borrows);
+            return true;
+        }
+        if (left)
+            merge_nodes(left, pNode, father, index - 1);
+        else
+            merge_nodes(pNode, right, father, index);
+        count(merges);
+    }
+    return adjust_root();
+}
 
-                } else {
-                    father->delete_key_start_by(index);
+template<class T>
+bool BPTree<T>::adjust_root() {
+    if (root->key_num > 0)
+        return true;
+    Tree old_root = root;
+    if (root->is_leaf) {
+        // If root is also a leaf node, we shall set root = nullptr
+        forget(root);
+        root = nullptr;
+        p_leaf_head = nullptr;
+        p_leaf_tail = nullptr;
+    } else {
+        // son of root node become root
+        root = root->child[0];
+    }
+    delete old_root;
+    level--;
+    node_num--;
+    return true;
+}
 
-                    for (int i = 0; i < pNode->key_num; i++) {
-                        brother->keys[i + brother->key_num] = pNode->keys[i];
-                        brother->values[i + brother->key_num] = pNode->values[i];
-                    }
-                    brother->key_num += pNode->key_num;
-                    brother->sibling = pNode->sibling;
+template<class T>
+void BPTree<T>::borrow_from_left(Tree pNode, Tree brother, Tree father, int index) {
+    // Number of entries moved to pNode.
+    unsigned int moved = 1;
+    if (pNode->is_leaf) {
+        touch(brother);
+        for (int i = pNode->key_num; i > 0; i--) {
+            pNode->keys[i] = pNode->keys[i - 1];
+            pNode->values[i] = pNode->values[i - 1];
+        }
+        pNode->keys[0] = brother->keys[brother->key_num - 1];
+        pNode->values[0] = brother->values[brother->key_num - 1];
+        if (payload_size > 0) {
+            std::copy_backward(pNode->payload_at(0), pNode->payload_at(pNode->key_num),
+                               pNode->payload_at(pNode->key_num + 1));
+            std::copy(brother->payload_at(brother->key_num - 1), brother->payload_at(brother->key_num),
+                      pNode->payload_at(0));
+        }
+        pNode->key_num++;
+        brother->delete_key_start_by(brother->key_num - 1);
+        father->keys[index] = pNode->keys[0];
+    } else {
+        // Rotate the last child of brother through father.
+        pNode->child[pNode->key_num + 1] = pNode->child[pNode->key_num];
+        for (int i = pNode->key_num; i > 0; i--) {
+            pNode->child[i] = pNode->child[i - 1];
+            pNode->keys[i] = pNode->keys[i - 1];
+        }
+        pNode->child[0] = brother->child[brother->key_num];
+        pNode->keys[0] = father->keys[index];
+        if (counted) {
+            std::copy_backward(pNode->counts.begin(), pNode->counts.begin() + pNode->key_num + 1,
+                               pNode->counts.begin() + pNode->key_num + 2);
+            moved = brother->counts[brother->key_num];
+            pNode->counts[0] = moved;
+            brother->counts[brother->key_num] = 0;
+        }
+        pNode->key_num++;
 
-                    delete pNode;
-                    node_num--;
+        father->keys[index] = brother->keys[brother->key_num - 1];
+        brother->keys[brother->key_num - 1] = T();
+        brother->child[brother->key_num] = nullptr;
+        brother->key_num--;
+    }
+    if (counted) {
+        father->counts[index] -= moved;
+        father->counts[index + 1] += moved;
+    }
+}
 
-                    return adjust_after_delete(father);
-                }
+template<class T>
+void BPTree<T>::borrow_from_right(Tree pNode, Tree brother, Tree father, int index) {
+    // Number of entries moved to pNode.
+    unsigned int moved = 1;
+    if (pNode->is_leaf) {
+        touch(brother);
+        pNode->keys[pNode->key_num] = brother->keys[0];
+        pNode->values[pNode->key_num] = brother->values[0];
+        if (payload_size > 0)
+            std::copy(brother->payload_at(0), brother->payload_at(1), pNode->payload_at(pNode->key_num));
+        pNode->key_num++;
+        brother->delete_key_start_by(0);
+        father->keys[index] = brother->keys[0];
+    } else {
+        // Rotate the first child of brother through father.
+        pNode->keys[pNode->key_num] = father->keys[index];
+        pNode->child[pNode->key_num + 1] = brother->child[0];
+        if (counted) {
+            moved = brother->counts[0];
+            pNode->counts[pNode->key_num + 1] = moved;
+            brother->counts[0] = brother->counts[1];
+        }
+        pNode->key_num++;
 
-            } else {
-                if (father->child[0] == pNode)
-                    brother = father->child[1];
-                else
-                    brother = father->child[index + 2];
-                if (brother->key_num > min_key_num) {
-                    pNode->keys[pNode->key_num] = brother->keys[0];
-                    pNode->values[pNode->key_num] = brother->values[0];
-                    pNode->key_num++;
-                    brother->delete_key_start_by(0);
-                    if (father->child[0] == pNode)
-                        father->keys[0] = brother->keys[0];
-                    else
-                        father->keys[index + 1] = brother->keys[0];
-                    return true;
+        father->keys[index] = brother->keys[0];
+        brother->child[0] = brother->child[1];
+        brother->delete_key_start_by(0);
+    }
+    if (counted) {
+        father->counts[index] += moved;
+        father->counts[index + 1] -= moved;
+    }
+}
 
-                } else {
-                    for (int i = 0; i < brother->key_num; i++) {
-                        pNode->keys[pNode->key_num + i] = brother->keys[i];
-                        pNode->values[pNode->key_num + i] = brother->values[i];
-                    }
-                    if (pNode == father->child[0])
-                        father->delete_key_start_by(0);
-                    else
-                        father->delete_key_start_by(index + 1);
-                    pNode->key_num += brother->key_num;
-                    pNode->sibling = brother->sibling;
-                    delete brother;
-                    node_num--;
-
-                    return adjust_after_delete(father);
-                }
-            }
+template<class T>
+void BPTree<T>::merge_nodes(Tree left, Tree right, Tree father, int index) {
+    if (left->is_leaf) {
+        touch(left);
+        touch(right);
+        for (int i = 0; i < right->key_num; i++) {
+            left->keys[left->key_num + i] = right->keys[i];
+            left->values[left->key_num + i] = right->values[i];
+        }
+        if (payload_size > 0)
+            std::copy(right->payload_at(0), right->payload_at(right->key_num), left->payload_at(left->key_num));
+        left->key_num += right->key_num;
+        left->sibling = right->sibling;
+        if (left->sibling)
+            left->sibling->prev = left;
+        if (right == p_leaf_tail)
+            p_leaf_tail = left;
+    } else {
+        // Separator comes down between the keys of both nodes.
+        left->keys[left->key_num] = father->keys[index];
+        left->key_num++;
+        for (int i = 0; i < right->key_num; i++) {
+            left->keys[left->key_num + i] = right->keys[i];
+            left->child[left->key_num + i] = right->child[i];
+        }
+        left->child[left->key_num + right->key_num] = right->child[right->key_num];
+        if (counted) {
+            for (int i = 0; i <= right->key_num; i++)
+                left->counts[left->key_num + i] = right->counts[i];
+        }
+        left->key_num += right->key_num;
+    }
+    // Drop the separator and the pointer to right.
+    if (counted)
+        father->counts[index] += father->counts[index + 1];
+    father->delete_key_start_by(index);
+    forget(right);
+    delete right;
+    node_num--;
+}
 
-        } else {
-            int index = 0;
-            father->find_by_key(pNode->child[0]->keys[0], index);
-            if ((father->child[0] != pNode) && (index + 1 == father->key_num)) {
-                brother = father->child[index];
-                if (brother->key_num > min_key_num - 1) {
-                    pNode->child[pNode->key_num + 1] = pNode->child[pNode->key_num];
-                    for (int i = pNode->key_num; i > 0; i--) {
-                        pNode->child[i] = pNode->child[i - 1];
-                        pNode->keys[i] = pNode->keys[i - 1];
-                    }
-                    pNode->child[0] = brother->child[brother->key_num];
-                    pNode->keys[0] = father->keys[index];
-                    pNode->key_num++;
-
-                    father->keys[index] = brother->keys[brother->key_num - 1];
-
-                    if (brother->child[brother->key_num])
-                        brother->child[brother->key_num]->father = pNode;
-                    brother->delete_key_start_by(brother->key_num - 1);
-
-                    return true;
+template<class T>
+void BPTree<T>::remove_empty(int depth) {
+    Tree pNode = path[depth].pNode;
+    if (depth == 0) {
+        // Nothing left in the tree.
+        forget(pNode);
+        delete pNode;
+        root = nullptr;
+        p_leaf_head = nullptr;
+        p_leaf_tail = nullptr;
+        level = 0;
+        node_num--;
+        return;
+    }
+    if (pNode->is_leaf) {
+        if (pNode->prev)
+            pNode->prev->sibling = pNode->sibling;
+        else
+            p_leaf_head = pNode->sibling;
+        if (pNode->sibling)
+            pNode->sibling->prev = pNode->prev;
+        else
+            p_leaf_tail = pNode->prev;
+    }
+    Tree father = path[depth - 1].pNode;
+    int index = path[depth - 1].index;
+    forget(pNode);
+    delete pNode;
+    node_num--;
 
-                } else {
-                    brother->keys[brother->key_num] = father->keys[index];
-                    father->delete_key_start_by(index);
-                    brother->key_num++;
+    if (father->key_num == 0) {
+        // pNode was the only child.
+        father->child[0] = nullptr;
+        remove_empty(depth - 1);
+        return;
+    }
+    if (index == 0) {
+        father->child[0] = father->child[1];
+        if (counted)
+            father->counts[0] = father->counts[1];
+        father->delete_key_start_by(0);
+    } else {
+        father->delete_key_start_by(index - 1);
+    }
+    // Root with a single child is collapsed.
+    if (depth == 1 && father->key_num == 0)
+        adjust_root();
+}
 
-                    for (int i = 0; i < pNode->key_num; i++) {
-                        brother->child[brother->key_num + i] = pNode->child[i];
-                        brother->keys[brother->key_num + i] = pNode->keys[i];
-                        brother->child[brother->key_num + i]->father = brother;
-                    }
-                    brother->child[brother->key_num + pNode->key_num] = pNode->child[pNode->key_num];
-                    brother->child[brother->key_num + pNode->key_num]->father = brother;
+template<class T>
+void BPTree<T>::set_relaxed_delete(bool relaxed) {
+    this->relaxed = relaxed;
+}
 
-                    brother->key_num += pNode->key_num;
+template<class T>
+bool BPTree<T>::relaxed_delete() const {
+    return relaxed;
+}
 
-                    delete pNode;
-                    node_num--;
+template<class T>
+unsigned int BPTree<T>::compact(unsigned int budget) {
+    unsigned int merged = 0;
+    // Merged leaves are left with room for some inserts before they split.
+    int fill_limit = (degree - 1) * 3 / 4;
+    while (root && !root->is_leaf && budget > 0) {
+        search_info info;
+        if (compact_started)
+            find_by_key(root, compact_key, info, &path);
+        else
+            find_edge(false, path);
+        budget--;
+        // Leaves under different fathers would need their common ancestor's
+        // separator changed, so only brothers are merged, one father at a
+        // time.
+        int depth = static_cast<int>(path.size()) - 2;
+        Tree father = path[depth].pNode;
+        int index = path[depth].index;
+        bool changed = false;
+        while (budget > 0 && index < father->key_num) {
+            budget--;
+            Tree left = father->child[index];
+            Tree right = father->child[index + 1];
+            if (left->key_num + right->key_num > fill_limit) {
+                index++;
+                continue;
+            }
+            merge_nodes(left, right, father, index);
+            count(merges);
+            merged++;
+            changed = true;
+            // Stay on left, it may take in the next leaf as well.
+        }
+        // Go on from where the budget ran out, or from the next father.
+        Tree next = father->child[index];
+        if (index == father->key_num)
+            next = next->sibling;
+        if (changed && (!relaxed || depth == 0))
+            adjust_after_delete(depth);
+        compact_started = next != nullptr;
+        if (!compact_started)
+            break;
+        compact_key = next->key_at(0);
+    }
+    seal();
+    return merged;
+}
 
-                    return adjust_after_delete(father);
+template<class T>
+defrag_progress BPTree<T>::defragment(unsigned int budget) {
+    defrag_progress progress;
+    while (root && !root->is_leaf && budget > 0) {
+        search_info info;
+        if (defrag_started)
+            find_by_key(root, defrag_key, info, &path);
+        else
+            find_edge(false, path);
+        int depth = static_cast<int>(path.size()) - 2;
+        Tree father = path[depth].pNode;
+        int index = path[depth].index;
+        // Like compact, only brothers are rewritten together, so that no
+        // separator outside father changes.
+        int run = std::min(static_cast<int>(budget), father->key_num + 1 - index);
+        budget -= run;
+        Tree old_first = father->child[index];
+        Tree old_last = father->child[index + run - 1];
+        std::vector<Tree> old_leaves(father->child.begin() + index, father->child.begin() + index + run);
+        int entry_num = 0;
+        for (Tree p : old_leaves)
+            entry_num += p->key_num;
+
+        // Spread entries evenly over as few leaves as bulk_load would use.
+        int leaf_num = std::max(1, (entry_num + degree - 2) / (degree - 1));
+        std::vector<Tree> new_leaves;
+        for (int i = 0; i < leaf_num; i++)
+            new_leaves.push_back(new Node<T>(degree, true, payload_size));
+        int leaf = 0, slot = 0;
+        for (Tree p : old_leaves) {
+            for (int i = 0; i < p->key_num; i++) {
+                int cnt = entry_num / leaf_num + (leaf < entry_num % leaf_num ? 1 : 0);
+                if (slot == cnt) {
+                    leaf++;
+                    slot = 0;
                 }
+                Tree target = new_leaves[leaf];
+                target->keys[slot] = p->key_at(i);
+                target->values[slot] = p->value_at(i);
+                if (payload_size > 0)
+                    std::copy(p->payload_at(i), p->payload_at(i + 1), target->payload_at(slot));
+                target->key_num = ++slot;
+            }
+        }
 
-            } else {
-                if (father->child[0] == pNode)
-                    brother = father->child[1];
-                else
-                    brother = father->child[index + 2];
-                if (brother->key_num > min_key_num - 1) {
-
-                    pNode->child[pNode->key_num + 1] = brother->child[0];
-                    pNode->keys[pNode->key_num] = brother->keys[0];
-                    pNode->child[pNode->key_num + 1]->father = pNode;
-                    pNode->key_num++;
-
-                    if (pNode == father->child[0])
-                        father->keys[0] = brother->keys[0];
-                    else
-                        father->keys[index + 1] = brother->keys[0];
-
-                    brother->child[0] = brother->child[1];
-                    brother->delete_key_start_by(0);
-
-                    return true;
-                } else {
+        // Link the new leaves in place of the old ones.
+        for (int i = 0; i < leaf_num; i++) {
+            new_leaves[i]->prev = i > 0 ? new_leaves[i - 1] : old_first->prev;
+            new_leaves[i]->sibling = i + 1 < leaf_num ? new_leaves[i + 1] : old_last->sibling;
+        }
+        if (old_first->prev)
+            old_first->prev->sibling = new_leaves.front();
+        else
+            p_leaf_head = new_leaves.front();
+        if (old_last->sibling)
+            old_last->sibling->prev = new_leaves.back();
+        else
+            p_leaf_tail = new_leaves.back();
+
+        // Replace the children of father, the separators of the new leaves
+        // are their first keys.
+        int removed = run - leaf_num;
+        if (removed > 0) {
+            std::copy(father->keys.begin() + index + run - 1, father->keys.begin() + father->key_num,
+                      father->keys.begin() + index + leaf_num - 1);
+            std::copy(father->child.begin() + index + run, father->child.begin() + father->key_num + 1,
+                      father->child.begin() + index + leaf_num);
+            if (counted)
+                std::copy(father->counts.begin() + index + run, father->counts.begin() + father->key_num + 1,
+                          father->counts.begin() + index + leaf_num);
+            for (int i = father->key_num - removed; i < father->key_num; i++) {
+                father->keys[i] = T();
+                father->child[i + 1] = nullptr;
+                if (counted)
+                    father->counts[i + 1] = 0;
+            }
+            father->key_num -= removed;
+        }
+        for (int i = 0; i < leaf_num; i++) {
+            father->child[index + i] = new_leaves[i];
+            if (i > 0)
+                father->keys[index + i - 1] = new_leaves[i]->keys[0];
+            if (counted)
+                father->counts[index + i] = static_cast<unsigned int>(new_leaves[i]->key_num);
+            if (compressed)
+                new_leaves[i]->pack();
+        }
+        for (Tree p : old_leaves) {
+            forget(p);
+            delete p;
+        }
+        node_num = node_num - run + leaf_num;
+        progress.rewritten += leaf_num;
+        progress.freed += removed;
+        defrag_keys += entry_num;
+
+        // Go on from the next father.
+        Tree next = new_leaves.back()->sibling;
+        if (removed > 0 && (!relaxed || depth == 0))
+            adjust_after_delete(depth);
+        defrag_started = next != nullptr;
+        if (!defrag_started)
+            break;
+        defrag_key = next->key_at(0);
+    }
+    seal();
+    progress.pass_keys = defrag_keys;
+    progress.key_num = key_num;
+    progress.finished = !defrag_started;
+    if (progress.finished)
+        defrag_keys = 0;
+    return progress;
+}
 
-                    pNode->keys[pNode->key_num] = father->keys[index];
+template<class T>
+void BPTree<T>::set_compressed(bool compressed) {
+    if (compressed && !std::is_same<T, int>::value)
+        throw BPTreeInnerException("Only leaves of int keys can be compressed");
+    this->compressed = compressed;
+    unpacked.clear();
+    for (Tree p = root ? p_leaf_head : nullptr; p != nullptr; p = p->get_sibling_node()) {
+        if (compressed)
+            p->pack();
+        else
+            p->unpack();
+    }
+}
+
+template<class T>
+bool BPTree<T>::compressed_leaves() const {
+    return compressed;
+}
+
+template<class T>
+void BPTree<T>::set_counted(bool counted) {
+    this->counted = counted;
+    if (root)
+        build_counts(root);
+}
+
+template<class T>
+bool BPTree<T>::counted_tree() const {
+    return counted;
+}
 
-                    if (pNode == father->child[0])
-                        father->delete_key_start_by(0);
-                    else
-                        father->delete_key_start_by(index + 1);
+template<class T>
+unsigned int BPTree<T>::entries(Tree pNode) const {
+    if (pNode->is_leaf)
+        return static_cast<unsigned int>(pNode->key_num);
+    unsigned int sum = 0;
+    for (int i = 0; i <= pNode->key_num; i++)
+        sum += pNode->counts[i];
+    return sum;
+}
 
-                    pNode->key_num++;
+template<class T>
+unsigned int BPTree<T>::build_counts(Tree pNode) {
+    if (pNode->is_leaf)
+        return static_cast<unsigned int>(pNode->key_num);
+    if (!counted) {
+        pNode->counts.clear();
+        pNode->counts.shrink_to_fit();
+        for (int i = 0; i <= pNode->key_num; i++)
+            build_counts(pNode->child[i]);
+        return 0;
+    }
+    pNode->counts.assign(degree + 2, 0);
+    unsigned int sum = 0;
+    for (int i = 0; i <= pNode->key_num; i++) {
+        pNode->counts[i] = build_counts(pNode->child[i]);
+        sum += pNode->counts[i];
+    }
+    return sum;
+}
 
-                    for (int i = 0; i < brother->key_num; i++) {
-                        pNode->child[pNode->key_num + i] = brother->child[i];
-                        pNode->keys[pNode->key_num + i] = brother->keys[i];
-                        pNode->child[pNode->key_num + i]->father = pNode;
-                    }
-                    pNode->child[pNode->key_num + brother->key_num] = brother->child[brother->key_num];
-                    pNode->child[pNode->key_num + brother->key_num]->father = pNode;
+template<class T>
+void BPTree<T>::add_count(int delta) {
+    for (size_t i = 0; i + 1 < path.size(); i++)
+        path[i].pNode->counts[path[i].index] += delta;
+}
 
-                    pNode->key_num += brother->key_num;
+template<class T>
+unsigned int BPTree<T>::rank_of(const T &key, bool inclusive) {
+    if (!root)
+        return 0;
+    if (!counted) {
+        // Without counts, walk the leaves up to key.
+        unsigned int result = 0;
+        for (cursor it = first(); it.valid() && (it.key() < key || (inclusive && it.key() == key)); it.next())
+            result++;
+        return result;
+    }
+    unsigned int result = 0;
+    Tree pNode = root;
+    while (!pNode->is_leaf) {
+        int index = 0;
+        // Like find_by_key, a key equal to a separator is in the right subtree.
+        if (pNode->find_by_key(key, index))
+            index++;
+        for (int i = 0; i < index; i++)
+            result += pNode->counts[i];
+        pNode = pNode->child[index];
+    }
+    int index = 0;
+    if (pNode->find_by_key(key, index) && inclusive)
+        index++;
+    return result + static_cast<unsigned int>(index);
+}
 
-                    delete brother;
-                    node_num--;
+template<class T>
+unsigned int BPTree<T>::count_between(const T &begin_key, const T &end_key) {
+    if (end_key < begin_key)
+        return count_between(end_key, begin_key);
+    count(lookups);
+    return rank_of(end_key, true) - rank_of(begin_key, false);
+}
 
-                    return adjust_after_delete(father);
-                }
+template<class T>
+unsigned int BPTree<T>::rank(const T &key) {
+    count(lookups);
+    return rank_of(key, false);
+}
 
-            }
+template<class T>
+typename BPTree<T>::cursor BPTree<T>::at_rank(unsigned int rank) {
+    if (!root || rank >= key_num)
+        return cursor();
+    count(lookups);
+    if (!counted) {
+        cursor it = first();
+        for (; it.valid() && rank > 0; rank--)
+            it.next();
+        return it;
+    }
+    Tree pNode = root;
+    while (!pNode->is_leaf) {
+        int index = 0;
+        while (index < pNode->key_num && rank >= pNode->counts[index])
+            rank -= pNode->counts[index++];
+        pNode = pNode->child[index];
+    }
+    return cursor(pNode, static_cast<int>(rank));
+}
 
-        }
+template<class T>
+bool BPTree<T>::key_at_rank(unsigned int rank, T &key, offset &value) {
+    cursor it = at_rank(rank);
+    if (!it.valid())
+        return false;
+    key = it.key();
+    value = it.value();
+    return true;
+}
 
+template<class T>
+void BPTree<T>::touch(Tree pNode) {
+    if (compressed && pNode->is_leaf) {
+        pNode->unpack();
+        unpacked.push_back(pNode);
     }
+}
 
-    return false;
+template<class T>
+void BPTree<T>::forget(Tree pNode) {
+    if (compressed && pNode->is_leaf)
+        unpacked.erase(std::remove(unpacked.begin(), unpacked.end(), pNode), unpacked.end());
+}
+
+template<class T>
+void BPTree<T>::seal() {
+    for (auto pNode : unpacked)
+        pNode->pack();
+    unpacked.clear();
 }
 
 template<class T>
@@ -518,6 +1404,16 @@ void BPTree<T>::destroy_tree(Tree tree) {
     node_num--;
 }
 
+template<class T>
+void BPTree<T>::destroy_internal(Tree pNode) {
+    if (!pNode || pNode->is_leaf)
+        return;
+    for (int i = 0; i <= pNode->key_num; i++)
+        destroy_internal(pNode->child[i]);
+    delete pNode;
+    node_num--;
+}
+
 template<class T>
 std::vector<offset> BPTree<T>::search_between(const T &begin_key, const T &end_key) {
     std::vector<offset> results;
@@ -552,31 +1448,143 @@ std::vector<offset> BPTree<T>::search_between(const T &begin_key, const T &end_k
                 pNode = pNode->get_sibling_node();
         } while (!finished);
     }
+    count(scans);
+    count(scanned_keys, results.size());
     std::sort(results.begin(), results.end());
     results.erase(unique(results.begin(), results.end()), results.end());
     return results;
 }
 
 template<class T>
-std::vector<offset> BPTree<T>::search_smaller(const T &end_key) {
-    std::vector<offset> results;
+void BPTree<T>::search_between(const T &begin_key, const T &end_key, offset_bitmap &results) {
     if (!root)
-        return results;
-    search_info info2;
-    find_by_key(root, end_key, info2);
-
+        return;
+    const T &low = begin_key > end_key ? end_key : begin_key;
+    const T &high = begin_key > end_key ? begin_key : end_key;
+    search_info info;
+    find_by_key(root, low, info);
+    Tree pNode = info.pNode;
+    int index = info.value;
+    std::vector<offset> batch;
+    uint64_t scanned = 0;
     bool finished;
-    Tree pNode = info2.pNode;
-    int index = info2.value;
-
     do {
-        finished = pNode->find_greater_than(index, results);
+        finished = pNode->find_in_range(index, high, batch);
         index = 0;
+        if (batch.size() >= bitmap_batch || finished || pNode->sibling == nullptr) {
+            results.add_many(batch.data(), batch.size());
+            scanned += batch.size();
+            batch.clear();
+        }
         if (pNode->sibling == nullptr)
             break;
-        else
-            pNode = pNode->get_sibling_node();
+        pNode = pNode->get_sibling_node();
     } while (!finished);
+    count(scans);
+    count(scanned_keys, scanned);
+}
+
+template<class T>
+std::vector<offset> BPTree<T>::search_between_parallel(const T &begin_key, const T &end_key, ThreadPool &pool,
+                                                       unsigned int parts) {
+    std::vector<offset> results;
+    if (!root)
+        return results;
+    const T &low = begin_key > end_key ? end_key : begin_key;
+    const T &high = begin_key > end_key ? begin_key : end_key;
+    if (parts == 0)
+        parts = pool.size() * parts_per_worker;
+    std::vector<T> bounds = split_keys(low, high, parts);
+
+    // Subrange i runs from starts[i] up to starts[i + 1], the last one up to
+    // the key after high.
+    std::vector<search_info> starts(bounds.size() + 2);
+    find_by_key(root, low, starts[0]);
+    for (size_t i = 0; i < bounds.size(); i++)
+        find_by_key(root, bounds[i], starts[i + 1]);
+    search_info &stop = starts.back();
+    find_by_key(root, high, stop);
+    if (stop.is_found)
+        stop.value++;
+
+    std::vector<std::vector<offset>> parts_found(bounds.size() + 1);
+    std::vector<std::future<void>> jobs;
+    // A range inside one node is not worth handing to the pool.
+    if (parts_found.size() == 1)
+        copy_values(starts[0], starts[1], parts_found[0]);
+    for (size_t i = 0; parts_found.size() > 1 && i < parts_found.size(); i++) {
+        jobs.push_back(pool.submit([&starts, &parts_found, i]() {
+            copy_values(starts[i], starts[i + 1], parts_found[i]);
+        }));
+    }
+    for (auto &job : jobs)
+        job.get();
+
+    size_t total = 0;
+    for (auto &part : parts_found)
+        total += part.size();
+    results.reserve(total);
+    for (auto &part : parts_found)
+        results.insert(results.end(), part.begin(), part.end());
+    count(scans);
+    count(scanned_keys, total);
+    return results;
+}
+
+template<class T>
+std::vector<T> BPTree<T>::split_keys(const T &low, const T &high, unsigned int parts) {
+    std::vector<T> keys;
+    if (root->is_leaf || parts < 2)
+        return keys;
+    std::vector<Tree> nodes(1, root);
+    while (true) {
+        keys.clear();
+        std::vector<Tree> children;
+        for (auto pNode : nodes) {
+            for (int i = 0; i <= pNode->key_num; i++) {
+                // Child i holds keys from separator i - 1 up to separator i.
+                bool after_low = i == pNode->key_num || low < pNode->keys[i];
+                bool before_high = i == 0 || !(high < pNode->keys[i - 1]);
+                if (after_low && before_high)
+                    children.push_back(pNode->child[i]);
+                if (i < pNode->key_num && after_low && !(high < pNode->keys[i]))
+                    keys.push_back(pNode->keys[i]);
+            }
+        }
+        if (keys.size() + 1 >= parts || children.empty() || children.front()->is_leaf)
+            break;
+        nodes.swap(children);
+    }
+    if (keys.size() + 1 <= parts)
+        return keys;
+    // Keep parts - 1 keys spread evenly over the ones found.
+    std::vector<T> picked;
+    for (size_t i = 1; i < parts; i++)
+        picked.push_back(keys[i * (keys.size() + 1) / parts - 1]);
+    return picked;
+}
+
+template<class T>
+void BPTree<T>::copy_values(search_info from, const search_info &to, std::vector<offset> &values) {
+    Tree pNode = from.pNode;
+    int index = from.value;
+    while (pNode != to.pNode && pNode != nullptr) {
+        pNode->copy_values(index, pNode->key_num, values);
+        index = 0;
+        pNode = pNode->get_sibling_node();
+    }
+    if (pNode != nullptr)
+        pNode->copy_values(index, to.value, values);
+}
+
+template<class T>
+std::vector<offset> BPTree<T>::search_smaller(const T &end_key) {
+    std::vector<offset> results;
+    // Walk back from end_key to the first leaf.
+    for (cursor c = seek_back(end_key, true); c.valid(); c.prev())
+        results.push_back(c.value());
+    count(scans);
+    count(scanned_keys, results.size());
     std::sort(results.begin(), results.end());
     results.erase(unique(results.begin(), results.end()), results.end());
     return results;
@@ -602,11 +1610,387 @@ std::vector<offset> BPTree<T>::search_greater(const T &begin_key) {
         else
             pNode = pNode->get_sibling_node();
     } while (!finished);
+    count(scans);
+    count(scanned_keys, results.size());
     std::sort(results.begin(), results.end());
     results.erase(unique(results.begin(), results.end()), results.end());
     return results;
 }
 
+template<class T>
+std::vector<offset> BPTree<T>::search_smaller_desc(const T &end_key, size_t limit, bool inclusive) {
+    std::vector<offset> results;
+    for (cursor c = seek_back(end_key, inclusive); c.valid() && results.size() < limit; c.prev())
+        results.push_back(c.value());
+    count(scans);
+    count(scanned_keys, results.size());
+    return results;
+}
+
+template<class T>
+std::vector<offset> BPTree<T>::search_last(size_t limit) {
+    std::vector<offset> results;
+    for (cursor c = last(); c.valid() && results.size() < limit; c.prev())
+        results.push_back(c.value());
+    count(scans);
+    count(scanned_keys, results.size());
+    return results;
+}
+
+template<class T>
+bool BPTree<T>::search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end,
+                            const T &end_key, size_t &skip, size_t limit, std::vector<offset> &values,
+                            T &last_key) {
+    if (!root || (bounded_begin && bounded_end && end_key < begin_key))
+        return false;
+    cursor c;
+    if (counted && skip > 0) {
+        unsigned int start = bounded_begin ? rank_of(begin_key, after) : 0;
+        unsigned int stop = bounded_end ? rank_of(end_key, true) : key_num;
+        size_t passed = std::min(skip, static_cast<size_t>(stop > start ? stop - start : 0));
+        skip -= passed;
+        c = at_rank(start + static_cast<unsigned int>(passed));
+    } else {
+        c = bounded_begin ? seek(begin_key) : first();
+        if (after && c.valid() && c.key() == begin_key)
+            c.next();
+        for (; skip > 0 && c.valid() && (!bounded_end || !(end_key < c.key())); skip--)
+            c.next();
+    }
+    size_t taken = 0;
+    for (; taken < limit && c.valid() && (!bounded_end || !(end_key < c.key())); taken++, c.next()) {
+        values.push_back(c.value());
+        last_key = c.key();
+    }
+    count(scans);
+    count(scanned_keys, taken);
+    return c.valid() && (!bounded_end || !(end_key < c.key()));
+}
+
+template<class T>
+typename BPTree<T>::cursor BPTree<T>::seek(const T &key) {
+    if (!root)
+        return cursor();
+    search_info info;
+    find_by_key(root, key, info);
+    cursor c(info.pNode, info.value);
+    c.settle_forward();
+    return c;
+}
+
+template<class T>
+typename BPTree<T>::cursor BPTree<T>::seek_back(const T &key, bool inclusive) {
+    if (!root)
+        return cursor();
+    search_info info;
+    find_by_key(root, key, info);
+    cursor c(info.pNode, info.is_found && inclusive ? info.value : info.value - 1);
+    c.settle_backward();
+    return c;
+}
+
+template<class T>
+typename BPTree<T>::cursor BPTree<T>::first() {
+    if (!root)
+        return cursor();
+    cursor c(p_leaf_head, 0);
+    c.settle_forward();
+    return c;
+}
+
+template<class T>
+typename BPTree<T>::cursor BPTree<T>::last() {
+    if (!root)
+        return cursor();
+    cursor c(p_leaf_tail, p_leaf_tail->key_num - 1);
+    c.settle_backward();
+    return c;
+}
+
+template<class T>
+BPTree<T>::cursor::cursor() : pNode(nullptr), index(0) {}
+
+template<class T>
+BPTree<T>::cursor::cursor(Tree pNode, int index) : pNode(pNode), index(index) {}
+
+template<class T>
+bool BPTree<T>::cursor::valid() const {
+    return pNode != nullptr;
+}
+
+template<class T>
+T BPTree<T>::cursor::key() const {
+    return pNode->key_at(index);
+}
+
+template<class T>
+offset BPTree<T>::cursor::value() const {
+    return pNode->value_at(index);
+}
+
+template<class T>
+const char *BPTree<T>::cursor::payload() const {
+    return pNode->payload_at(index);
+}
+
+template<class T>
+void BPTree<T>::cursor::next() {
+    index++;
+    settle_forward();
+}
+
+template<class T>
+void BPTree<T>::cursor::prev() {
+    index--;
+    settle_backward();
+}
+
+template<class T>
+void BPTree<T>::cursor::settle_forward() {
+    while (pNode && index >= pNode->key_num) {
+        pNode = pNode->sibling;
+        index = 0;
+    }
+}
+
+template<class T>
+void BPTree<T>::cursor::settle_backward() {
+    while (pNode && index < 0) {
+        pNode = pNode->prev;
+        index = pNode ? pNode->key_num - 1 : 0;
+    }
+}
+
+template<class T>
+void BPTree<T>::insert_sorted(const std::vector<T> &keys, const std::vector<offset> &values) {
+    if (keys.size() != values.size())
+        throw BatchSizeNotEqual();
+    if (keys.empty())
+        return;
+    if (!root)
+        initialize();
+    append_run = 0;
+    size_t next = 0;
+    while (next < keys.size()) {
+        search_info info;
+        find_by_key(root, keys[next], info, &path);
+        if (info.is_found)
+            throw DuplicateKey();
+        // Keys before the nearest separator right of the path stay in this
+        // leaf.
+        const T *bound = nullptr;
+        for (size_t depth = path.size() - 1; depth-- > 0 && !bound;) {
+            if (path[depth].index < path[depth].pNode->key_num)
+                bound = &path[depth].pNode->keys[path[depth].index];
+        }
+        Tree pNode = info.pNode;
+        // Fill the leaf up to degree at most, then let it split as one
+        // insert would, and go on from the top.
+        size_t end = next;
+        size_t room = static_cast<size_t>(degree - pNode->key_num);
+        while (end < keys.size() && end - next < room && (!bound || keys[end] < *bound))
+            end++;
+        int num = static_cast<int>(end - next);
+        touch(pNode);
+        pNode->merge_keys(&keys[next], &values[next], num);
+        if (counted)
+            add_count(num);
+        if (pNode->key_num == degree)
+            adjust_after_insert(static_cast<int>(path.size()) - 1);
+        seal();
+        key_num += num;
+        count(inserts, static_cast<uint64_t>(num));
+        next = end;
+    }
+}
+
+template<class T>
+void BPTree<T>::bulk_load(const std::vector<T> &keys, const std::vector<offset> &values, const char *payloads) {
+    if (keys.size() != values.size())
+        throw BatchSizeNotEqual();
+    if (key_num != 0)
+        throw BPTreeInnerException("Bulk load is only allowed on an empty B+ tree");
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keys[i] == keys[i - 1])
+            throw DuplicateKey();
+        if (keys[i] < keys[i - 1])
+            throw BPTreeInnerException("Keys to bulk load are not sorted");
+    }
+    if (keys.empty())
+        return;
+
+    destroy_tree(root);
+    root = nullptr;
+    node_num = 0;
+
+    // Fill leaves as full as a node may stay, spreading the remainder evenly
+    // so that no leaf falls under min_key_num.
+    int n = static_cast<int>(keys.size());
+    int node_cnt = (n + degree - 2) / (degree - 1);
+    std::vector<Tree> level_nodes;
+    // Smallest key of the subtree of each node in level_nodes.
+    std::vector<T> level_min;
+    Tree prev = nullptr;
+    for (int i = 0, pos = 0; i < node_cnt; i++) {
+        int cnt = n / node_cnt + (i < n % node_cnt ? 1 : 0);
+        Tree leaf = new Node<T>(degree, true, payload_size);
+        for (int j = 0; j < cnt; j++) {
+            leaf->keys[j] = keys[pos + j];
+            leaf->values[j] = values[pos + j];
+        }
+        if (payload_size > 0 && payloads)
+            std::copy(payloads + static_cast<size_t>(pos) * payload_size,
+                      payloads + static_cast<size_t>(pos + cnt) * payload_size, leaf->payload_at(0));
+        leaf->key_num = cnt;
+        leaf->prev = prev;
+        if (prev)
+            prev->sibling = leaf;
+        else
+            p_leaf_head = leaf;
+        prev = leaf;
+        p_leaf_tail = leaf;
+        level_nodes.push_back(leaf);
+        level_min.push_back(keys[pos]);
+        pos += cnt;
+    }
+    node_num = static_cast<unsigned int>(node_cnt);
+    level = 1;
+    build_levels(level_nodes, level_min);
+    key_num = static_cast<unsigned int>(n);
+    if (counted)
+        build_counts(root);
+    if (compressed)
+        set_compressed(true);
+}
+
+template<class T>
+void BPTree<T>::build_levels(std::vector<Tree> &level_nodes, std::vector<T> &level_min) {
+    while (level_nodes.size() > 1) {
+        int child_cnt = static_cast<int>(level_nodes.size());
+        int node_cnt = (child_cnt + degree - 1) / degree;
+        std::vector<Tree> upper_nodes;
+        std::vector<T> upper_min;
+        for (int i = 0, pos = 0; i < node_cnt; i++) {
+            int cnt = child_cnt / node_cnt + (i < child_cnt % node_cnt ? 1 : 0);
+            Tree pNode = new Node<T>(degree, false);
+            for (int j = 0; j < cnt; j++) {
+                pNode->child[j] = level_nodes[pos + j];
+                if (j > 0)
+                    pNode->keys[j - 1] = level_min[pos + j];
+            }
+            pNode->key_num = cnt - 1;
+            upper_nodes.push_back(pNode);
+            upper_min.push_back(level_min[pos]);
+            pos += cnt;
+        }
+        node_num += node_cnt;
+        level++;
+        level_nodes.swap(upper_nodes);
+        level_min.swap(upper_min);
+    }
+    root = level_nodes[0];
+}
+
+template<class T>
+void BPTree<T>::dump_entries(std::vector<T> &keys, std::vector<offset> &values) {
+    keys.reserve(keys.size() + key_num);
+    values.reserve(values.size() + key_num);
+    for (Tree p = root ? p_leaf_head : nullptr; p != nullptr; p = p->get_sibling_node()) {
+        for (int i = 0; i < p->key_num; i++) {
+            keys.push_back(p->key_at(i));
+            values.push_back(p->value_at(i));
+        }
+    }
+}
+
+template<class T>
+unsigned int BPTree<T>::size() const {
+    return key_num;
+}
+
+template<class T>
+index_stats BPTree<T>::stats() {
+    index_stats result;
+    result.key_num = key_num;
+    if (root) {
+        // Walk level by level from the root.
+        std::vector<Tree> level_nodes(1, root);
+        while (!level_nodes.empty()) {
+            std::vector<Tree> lower_nodes;
+            result.level_nodes.push_back(static_cast<unsigned int>(level_nodes.size()));
+            for (auto pNode : level_nodes) {
+                result.node_num++;
+                result.bytes_used += pNode->memory_size();
+                if (pNode->is_leaf) {
+                    result.leaf_num++;
+                    result.leaf_capacity += degree - 1;
+                } else {
+                    for (int i = 0; i <= pNode->key_num; i++)
+                        lower_nodes.push_back(pNode->child[i]);
+                }
+            }
+            level_nodes.swap(lower_nodes);
+        }
+    }
+    result.height = static_cast<unsigned int>(result.level_nodes.size());
+    result.leaf_fill = result.leaf_capacity == 0 ? 0 : static_cast<double>(key_num) / result.leaf_capacity;
+    result.lookups = lookups.load(std::memory_order_relaxed);
+    result.inserts = inserts.load(std::memory_order_relaxed);
+    result.deletes = deletes.load(std::memory_order_relaxed);
+    result.splits = splits.load(std::memory_order_relaxed);
+    result.merges = merges.load(std::memory_order_relaxed);
+    result.borrows = borrows.load(std::memory_order_relaxed);
+    result.scans = scans.load(std::memory_order_relaxed);
+    result.scanned_keys = scanned_keys.load(std::memory_order_relaxed);
+    return result;
+}
+
+template<class T>
+size_t BPTree<T>::memory_bytes() const {
+    size_t result = sizeof(*this) + unpacked.capacity() * sizeof(Tree);
+    std::vector<Tree> level_nodes;
+    if (root)
+        level_nodes.push_back(root);
+    while (!level_nodes.empty()) {
+        std::vector<Tree> lower_nodes;
+        for (auto pNode : level_nodes) {
+            result += pNode->memory_size();
+            if (!pNode->is_leaf) {
+                for (int i = 0; i <= pNode->key_num; i++)
+                    lower_nodes.push_back(pNode->child[i]);
+            }
+        }
+        level_nodes.swap(lower_nodes);
+    }
+    return result;
+}
+
+template<class T>
+unsigned int BPTree<T>::height() const {
+    return level;
+}
+
+template<class T>
+uint64_t BPTree<T>::restructures() const {
+    return splits.load(std::memory_order_relaxed) + merges.load(std::memory_order_relaxed) +
+           borrows.load(std::memory_order_relaxed);
+}
+
+template<class T>
+node_profile BPTree<T>::profile() const {
+    return m_profile;
+}
+
+template<class T>
+int BPTree<T>::payload_bytes() const {
+    return payload_size;
+}
+
+template<class T>
+void BPTree<T>::count(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
 template<class T>
 void BPTree<T>::print_leaf() {
     Tree p = p_leaf_head;
@@ -634,7 +2018,19 @@ void BPTree<T>::load_from_disk(char *p, char *end) {
 
 template<class T>
 void BPTree<T>::dump_to_disk() {
-    // TODO: dump B+ tree to disk
+    if (!root)
+        initialize();
+    TreeFile<T>::write(file_name(), root, p_leaf_head, key_num, level, degree, payload_size);
+}
+
+template<class T>
+std::string BPTree<T>::file_name() const {
+    return file_name_of(m_name);
+}
+
+template<class T>
+std::string BPTree<T>::file_name_of(const std::string &index_name) {
+    return index_name + ".idx";
 }
 
 template<class T>
@@ -645,7 +2041,14 @@ int BPTree<T>::count_block_num(const std::string &index_name) {
 
 template<class T>
 void BPTree<T>::load_all_node() {
-    //TODO: load from disk
+    TreeFile<T> file(file_name());
+    if (file.payload_bytes() != payload_size)
+        throw IndexFileError("Index file holds other included columns");
+    std::vector<T> keys;
+    std::vector<offset> values;
+    std::vector<char> payloads;
+    file.dump_entries(keys, values, payloads);
+    bulk_load(keys, values, payloads.empty() ? nullptr : payloads.data());
 }
 
 
@@ -0,0 +1,203 @@
+#ifndef MINISQL_FROZENTREE_H
+#define MINISQL_FROZENTREE_H
+
+#include "BPTree.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Read only copy of a BPTree for data that no longer changes.
+// Keys and values lie in two sorted arrays without any pointer. Lookups
+// descend a static search tree over the last key of each block of
+// block_keys keys, laid out in Eytzinger order (the children of slot k are
+// 2k and 2k + 1) so that its top levels share cache lines, then search one
+// block. Searches have the same semantic as in BPTree.
+template<class T>
+class FrozenTree {
+public:
+    // Keys per block, an int block fills a cache line.
+    static const size_t block_keys = 16;
+
+    // Copy keys and values of tree.
+    explicit FrozenTree(BPTree<T> &tree);
+
+    offset search_by_key(const T &key) const;
+
+    std::vector<offset> search_between(const T &begin_key, const T &end_key) const;
+
+    std::vector<offset> search_smaller(const T &end_key) const;
+
+    std::vector<offset> search_greater(const T &begin_key) const;
+
+    bool search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end, const T &end_key,
+                     size_t &skip, size_t limit, std::vector<offset> &values, T &last_key) const;
+
+    // Ranks are positions in the arrays, so they always take one search.
+    bool counted_tree() const { return true; }
+
+    unsigned int count_between(const T &begin_key, const T &end_key) const;
+
+    unsigned int rank(const T &key) const;
+
+    bool key_at_rank(unsigned int rank, T &key, offset &value) const;
+
+    unsigned int size() const;
+
+    // @return: bytes held by the arrays.
+    size_t memory_bytes() const;
+
+private:
+    // @return: position of the first key not less than key.
+    size_t lower_bound(const T &key) const;
+
+    // @return: position of the first key greater than key.
+    size_t upper_bound(const T &key) const;
+
+    // Fill the search tree from slot k on in order.
+    // @block: next block to place.
+    void build(size_t k, size_t &block);
+
+    // Values of [first, last) sorted as the searches of BPTree return them.
+    std::vector<offset> sorted_values(size_t first, size_t last) const;
+
+    std::vector<T> keys;
+    std::vector<offset> values;
+    // Slot 0 is unused.
+    std::vector<T> block_last;
+    std::vector<uint32_t> block_of_slot;
+};
+
+template<class T>
+FrozenTree<T>::FrozenTree(BPTree<T> &tree) {
+    keys.reserve(tree.size());
+    values.reserve(tree.size());
+    for (auto it = tree.first(); it.valid(); it.next()) {
+        keys.push_back(it.key());
+        values.push_back(it.value());
+    }
+    size_t block_num = (keys.size() + block_keys - 1) / block_keys;
+    block_last.resize(block_num + 1);
+    block_of_slot.resize(block_num + 1);
+    size_t block = 0;
+    build(1, block);
+}
+
+template<class T>
+void FrozenTree<T>::build(size_t k, size_t &block) {
+    if (k >= block_last.size())
+        return;
+    build(2 * k, block);
+    block_last[k] = keys[std::min(keys.size(), (block + 1) * block_keys) - 1];
+    block_of_slot[k] = static_cast<uint32_t>(block++);
+    build(2 * k + 1, block);
+}
+
+template<class T>
+size_t FrozenTree<T>::lower_bound(const T &key) const {
+    // Go right past blocks ending before key. The first block not ending
+    // before key is where the walk last went left.
+    size_t k = 1;
+    while (k < block_last.size())
+        k = 2 * k + (block_last[k] < key);
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+    if (k == 0)
+        return keys.size();
+    size_t first = block_of_slot[k] * block_keys;
+    size_t last = std::min(keys.size(), first + block_keys);
+    return static_cast<size_t>(std::lower_bound(keys.begin() + first, keys.begin() + last, key) - keys.begin());
+}
+
+template<class T>
+size_t FrozenTree<T>::upper_bound(const T &key) const {
+    // Keys are unique.
+    size_t index = lower_bound(key);
+    return index < keys.size() && keys[index] == key ? index + 1 : index;
+}
+
+template<class T>
+std::vector<offset> FrozenTree<T>::sorted_values(size_t first, size_t last) const {
+    std::vector<offset> results;
+    if (first >= last)
+        return results;
+    results.assign(values.begin() + first, values.begin() + last);
+    std::sort(results.begin(), results.end());
+    results.erase(std::unique(results.begin(), results.end()), results.end());
+    return results;
+}
+
+template<class T>
+offset FrozenTree<T>::search_by_key(const T &key) const {
+    size_t index = lower_bound(key);
+    return index < keys.size() && keys[index] == key ? values[index] : -1;
+}
+
+template<class T>
+std::vector<offset> FrozenTree<T>::search_between(const T &begin_key, const T &end_key) const {
+    if (end_key < begin_key)
+        return search_between(end_key, begin_key);
+    return sorted_values(lower_bound(begin_key), upper_bound(end_key));
+}
+
+template<class T>
+std::vector<offset> FrozenTree<T>::search_smaller(const T &end_key) const {
+    return sorted_values(0, upper_bound(end_key));
+}
+
+template<class T>
+std::vector<offset> FrozenTree<T>::search_greater(const T &begin_key) const {
+    return sorted_values(lower_bound(begin_key), keys.size());
+}
+
+template<class T>
+bool FrozenTree<T>::search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end,
+                                const T &end_key, size_t &skip, size_t limit, std::vector<offset> &values,
+                                T &last_key) const {
+    if (bounded_begin && bounded_end && end_key < begin_key)
+        return false;
+    size_t first = !bounded_begin ? 0 : after ? upper_bound(begin_key) : lower_bound(begin_key);
+    size_t last = bounded_end ? upper_bound(end_key) : keys.size();
+    if (first >= last)
+        return false;
+    size_t passed = std::min(skip, last - first);
+    skip -= passed;
+    first += passed;
+    size_t stop = last - first > limit ? first + limit : last;
+    values.insert(values.end(), this->values.begin() + first, this->values.begin() + stop);
+    if (stop > first)
+        last_key = keys[stop - 1];
+    return stop < last;
+}
+
+template<class T>
+unsigned int FrozenTree<T>::count_between(const T &begin_key, const T &end_key) const {
+    if (end_key < begin_key)
+        return count_between(end_key, begin_key);
+    return static_cast<unsigned int>(upper_bound(end_key) - lower_bound(begin_key));
+}
+
+template<class T>
+unsigned int FrozenTree<T>::rank(const T &key) const {
+    return static_cast<unsigned int>(lower_bound(key));
+}
+
+template<class T>
+bool FrozenTree<T>::key_at_rank(unsigned int rank, T &key, offset &value) const {
+    if (rank >= keys.size())
+        return false;
+    key = keys[rank];
+    value = values[rank];
+    return true;
+}
+
+template<class T>
+unsigned int FrozenTree<T>::size() const {
+    return static_cast<unsigned int>(keys.size());
+}
+
+template<class T>
+size_t FrozenTree<T>::memory_bytes() const {
+    return keys.capacity() * sizeof(T) + values.capacity() * sizeof(offset) + block_last.capacity() * sizeof(T) +
+           block_of_slot.capacity() * sizeof(uint32_t);
+}
+
+#endif //MINISQL_FROZENTREE_H
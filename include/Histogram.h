@@ -0,0 +1,158 @@
+#ifndef MINISQL_HISTOGRAM_H
+#define MINISQL_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+// Log-linear histogram of latencies in nanoseconds.
+// Each power of two is split into sub_bucket_num linear buckets, so every
+// value is kept with a relative error below 1 / sub_bucket_num.
+// One thread records, any thread may read or merge at the same time.
+class Histogram {
+public:
+    static const int sub_bucket_bits = 4;
+    static const int sub_bucket_num = 1 << sub_bucket_bits;
+    static const int bucket_num = (64 - sub_bucket_bits + 1) * sub_bucket_num;
+
+    Histogram();
+
+    Histogram(const Histogram &other);
+
+    Histogram &operator=(const Histogram &other);
+
+    // Add one value. Must only be called by the owner thread.
+    // @value: latency in nanoseconds.
+    void record(uint64_t value);
+
+    // Add all values recorded by other.
+    void merge(const Histogram &other);
+
+    void reset();
+
+    // @return: number of recorded values.
+    uint64_t count() const;
+
+    // @return: largest recorded value.
+    uint64_t max() const;
+
+    double mean() const;
+
+    // @ratio: in [0, 1], 0.99 for p99.
+    // @return: value below which ratio of the recorded values fall.
+    uint64_t percentile(double ratio) const;
+
+    // @return: bucket holding value.
+    static int bucket_of(uint64_t value);
+
+    // @return: smallest value of bucket.
+    static uint64_t bucket_low(int bucket);
+
+private:
+    // Single writer, so relaxed load and store are enough and avoid
+    // locked read-modify-write instructions on the record path.
+    static void add(std::atomic<uint64_t> &counter, uint64_t delta);
+
+    std::atomic<uint64_t> counts[bucket_num];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> largest;
+};
+
+inline Histogram::Histogram() {
+    reset();
+}
+
+inline Histogram::Histogram(const Histogram &other) {
+    reset();
+    merge(other);
+}
+
+inline Histogram &Histogram::operator=(const Histogram &other) {
+    if (this != &other) {
+        reset();
+        merge(other);
+    }
+    return *this;
+}
+
+inline int Histogram::bucket_of(uint64_t value) {
+    if (value < 2 * sub_bucket_num)
+        return static_cast<int>(value);
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - sub_bucket_bits;
+    return (shift + 1) * sub_bucket_num + static_cast<int>(value >> shift) - sub_bucket_num;
+}
+
+inline uint64_t Histogram::bucket_low(int bucket) {
+    if (bucket < 2 * sub_bucket_num)
+        return static_cast<uint64_t>(bucket);
+    int shift = bucket / sub_bucket_num - 1;
+    return static_cast<uint64_t>(bucket % sub_bucket_num + sub_bucket_num) << shift;
+}
+
+inline void Histogram::add(std::atomic<uint64_t> &counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+inline void Histogram::record(uint64_t value) {
+    add(counts[bucket_of(value)], 1);
+    add(total, 1);
+    add(sum, value);
+    if (value > largest.load(std::memory_order_relaxed))
+        largest.store(value, std::memory_order_relaxed);
+}
+
+inline void Histogram::merge(const Histogram &other) {
+    for (int i = 0; i < bucket_num; i++)
+        counts[i].fetch_add(other.counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    total.fetch_add(other.total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    uint64_t other_max = other.largest.load(std::memory_order_relaxed);
+    if (other_max > largest.load(std::memory_order_relaxed))
+        largest.store(other_max, std::memory_order_relaxed);
+}
+
+inline void Histogram::reset() {
+    for (int i = 0; i < bucket_num; i++)
+        counts[i].store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    largest.store(0, std::memory_order_relaxed);
+}
+
+inline uint64_t Histogram::count() const {
+    return total.load(std::memory_order_relaxed);
+}
+
+inline uint64_t Histogram::max() const {
+    return largest.load(std::memory_order_relaxed);
+}
+
+inline double Histogram::mean() const {
+    uint64_t n = count();
+    return n == 0 ? 0.0 : static_cast<double>(sum.load(std::memory_order_relaxed)) / n;
+}
+
+inline uint64_t Histogram::percentile(double ratio) const {
+    uint64_t n = count();
+    if (n == 0)
+        return 0;
+    // Rank of the wanted value, counting from 1.
+    uint64_t rank = static_cast<uint64_t>(ratio * n + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < bucket_num; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // Report the middle of the bucket, but never more than the max.
+            uint64_t low = bucket_low(i);
+            uint64_t high = i + 1 < bucket_num ? bucket_low(i + 1) : low;
+            uint64_t value = low + (high - low) / 2;
+            return value < max() ? value : max();
+        }
+    }
+    return max();
+}
+
+#endif //MINISQL_HISTOGRAM_H
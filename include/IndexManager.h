@@ -2,15 +2,49 @@
 #define INDEX_MANAGER_H
 
 #include "BPTree.h"
+#include "FrozenTree.h"
+#include "OffsetSet.h"
+#include "OrderedKey.h"
+#include "PartitionedTree.h"
+#include "ThreadPool.h"
+#include "Tracer.h"
+#include "WriteBuffer.h"
 #include <string>
 #include <cstring>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <sstream>
 
 
+// Time IndexManager operations into the Tracer when INDEX_TRACE is defined.
+#ifdef INDEX_TRACE
+#define INDEX_TRACE_SCOPE(...) trace_scope trace_guard(*this, __VA_ARGS__)
+#define INDEX_TRACE_ROWS(result) trace_guard.rows(result)
+#else
+#define INDEX_TRACE_SCOPE(...)
+#define INDEX_TRACE_ROWS(result) (result)
+#endif
+
 struct m_string {
 private:
     const static int str_size = 256;
+    // First 8 chars, see ordered_prefix. Most compares end on the prefix
+    // without calling strcmp.
+    uint64_t prefix = 0;
     char str[str_size]{};
+
+    // @return: like strcmp.
+    int compare(const m_string &obj) const {
+        if (prefix != obj.prefix)
+            return prefix < obj.prefix ? -1 : 1;
+        // Equal prefixes shorter than 8 chars are equal strings.
+        if ((prefix & 0xff) == 0)
+            return 0;
+        return strcmp(str + 8, obj.str + 8);
+    }
+
 public:
     m_string() = default;
 
@@ -18,46 +52,58 @@ public:
 
     explicit m_string(const char c_ptr[]) {
         memcpy(str, c_ptr, (size_t) std::min((int) strlen(c_ptr), str_size));
+        prefix = ordered_prefix(str);
     }
 
     explicit m_string(const std::string &std_str) {
         memcpy(str, std_str.c_str(), (size_t) std::min((int) std_str.size(), str_size));
+        prefix = ordered_prefix(str);
     }
 
     m_string &operator=(const m_string &) = default;
 
     m_string &operator=(const std::string &std_str) {
         memcpy(str, std_str.c_str(), (size_t) std::min((int) std_str.size(), str_size));
+        prefix = ordered_prefix(str);
         return *this;
     }
 
     m_string &operator=(const char *c_str) {
         memcpy(str, c_str, strlen(c_str));
+        prefix = ordered_prefix(str);
         return *this;
     }
 
     bool operator!=(const m_string &obj) const {
-        return strcmp(this->str, obj.str) != 0;
+        return compare(obj) != 0;
     }
 
     bool operator==(const m_string &obj) const {
-        return strcmp(this->str, obj.str) == 0;
+        return compare(obj) == 0;
     }
 
     bool operator>(const m_string &obj) const {
-        return strcmp(this->str, obj.str) > 0;
+        return compare(obj) > 0;
     }
 
     bool operator<(const m_string &obj) const {
-        return strcmp(this->str, obj.str) < 0;
+        return compare(obj) < 0;
     }
 
     bool operator>=(const m_string &obj) const {
-        return strcmp(this->str, obj.str) >= 0;
+        return compare(obj) >= 0;
     }
 
     bool operator<=(const m_string &obj) const {
-        return strcmp(this->str, obj.str) <= 0;
+        return compare(obj) <= 0;
+    }
+
+    // @return: hash of the chars, for the filter of WriteBuffer.
+    friend uint64_t key_hash(const m_string &obj) {
+        uint64_t h = 14695981039346656037ull;
+        for (const char *c = obj.str; c < obj.str + str_size && *c; c++)
+            h = (h ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+        return h ^ (h >> 29);
     }
 
     friend std::ostream &operator<<(std::ostream &out, const m_string &obj) {
@@ -67,6 +113,7 @@ public:
 
     friend std::istream &operator>>(std::istream &in, m_string &obj) {
         in >> obj.str;
+        obj.prefix = ordered_prefix(obj.str);
         return in;
     }
 
@@ -116,15 +163,49 @@ public:
     static const int type_float = -2;
     static const int max_var_char = 256;
 
+    // Where a paged search stopped. Pass it back unchanged for the next page.
+    struct page_token {
+        // True if keys in range are left after the page, and the next page
+        // starts after last_key. A token with more false starts from the
+        // beginning of the range.
+        bool more = false;
+        dtype last_key = dtype();
+    };
+
+    // Filter over several indexes, see search_where. A leaf selects keys of
+    // one index as the search of the same name does, bounds included. An
+    // inner node takes the offsets in all (op_and) or any (op_or) of its
+    // children.
+    struct predicate {
+        enum op_type {
+            op_and,
+            op_or,
+            op_equal,
+            op_between,
+            op_greater,
+            op_smaller
+        };
+        op_type op;
+        std::string index_name;
+        // Key of op_equal, op_greater, or the lower bound of op_between.
+        dtype key_begin;
+        // Key of op_smaller, or the upper bound of op_between.
+        dtype key_end;
+        std::vector<predicate> children;
+    };
+
     IndexManager();
 
+    // Moving leaves other without indexes.
     IndexManager(IndexManager &&) = default;
 
-    IndexManager(const IndexManager &) = default;
+    // The trees are owned, so a manager can not be copied, nor assigned over
+    // one that would leave its trees behind.
+    IndexManager(const IndexManager &) = delete;
 
-    IndexManager &operator=(IndexManager &&) = default;
+    IndexManager &operator=(IndexManager &&) = delete;
 
-    IndexManager &operator=(const IndexManager &) = default;
+    IndexManager &operator=(const IndexManager &) = delete;
 
     ~IndexManager();
 
@@ -136,32 +217,445 @@ public:
 
     std::vector<offset> search_greater(const std::string &index_name, const dtype &key_begin);
 
+    // Same as search_between, for large ranges. Offsets go into a compressed
+    // bitmap as leaves are walked, and results of several searches combine
+    // with | and &.
+    offset_bitmap search_between_bitmap(const std::string &index_name, const dtype &key_begin,
+                                        const dtype &key_end);
+
+    // Same as search_between, for large ranges, scanned by all cores.
+    // @return: offsets in key order.
+    std::vector<offset> search_between_parallel(const std::string &index_name, const dtype &key_begin,
+                                                const dtype &key_end);
+
+    // Search by key, also copying the included columns of key.
+    // @payload: included columns of key one after another, empty if not
+    //  found.
+    std::vector<offset> search_equal(const std::string &index_name, const dtype &key, std::vector<char> &payload);
+
+    // Index only scan of keys in [key_begin, key_end], offsets in key order.
+    // @payloads: included columns of each key one after another.
+    std::vector<offset> search_between(const std::string &index_name, const dtype &key_begin, const dtype &key_end,
+                                       std::vector<char> &payloads);
+
+    // @return: byte size of each included column of an index.
+    std::vector<int> included_columns(const std::string &index_name);
+
+    // Offsets of keys less than key_end, in descending order of key.
+    // @limit: max number of offsets.
+    // @inclusive: also take key_end itself.
+    std::vector<offset> search_smaller_desc(const std::string &index_name, const dtype &key_end, size_t limit,
+                                            bool inclusive = false);
+
+    // Offsets of the limit greatest keys, in descending order of key.
+    std::vector<offset> search_last(const std::string &index_name, size_t limit);
+
+    // Paged variants of the searches above, offsets in key order. The scan
+    // stops as soon as the page is full.
+    // @limit: max number of offsets in the page.
+    // @skip: keys to pass over first, from the beginning of the range or
+    //  from where token stopped. Indexes with counts pass over them in one
+    //  descent, see set_counted_index.
+    // @token: where the last page stopped, updated to where this one stops.
+    std::vector<offset> search_between(const std::string &index_name, const dtype &key_begin, const dtype &key_end,
+                                       size_t limit, size_t skip, page_token &token);
+
+    std::vector<offset> search_greater(const std::string &index_name, const dtype &key_begin, size_t limit,
+                                       size_t skip, page_token &token);
 
-    void create_index(std::string index_name, int type_indicator);
+    std::vector<offset> search_smaller(const std::string &index_name, const dtype &key_end, size_t limit,
+                                       size_t skip, page_token &token);
+
+    // Combine the offsets of several indexes inside the engine.
+    // Children of op_and run from the fewest estimated offsets up, counted
+    // indexes estimate in one descent. A large range under op_and is scanned
+    // a page at a time and checked against the offsets found so far, instead
+    // of being taken whole.
+    // @return: offsets matching where, ascending.
+    std::vector<offset> search_where(const predicate &where);
+
+
+    // @profile: size of the nodes, see NodeProfile.h.
+    // @included: byte size of each included column. Included columns are
+    //  stored next to each offset in the leaves, so that searches return them
+    //  without fetching the record.
+    void create_index(std::string index_name, int type_indicator, node_profile profile = profile_page,
+                      const std::vector<int> &included = std::vector<int>());
+
+    // Create an index split into range shards searched in parallel.
+    // Inserts, deletes and searches of partitioned indexes may be called from
+    // several threads at once, they only lock the shards they touch. All
+    // other calls, and creating or dropping any index, must not run
+    // concurrently with any call.
+    // @shard_num: number of shards, 0 means one per hardware thread.
+    void create_partitioned_index(std::string index_name, int type_indicator, unsigned int shard_num = 0,
+                                  node_profile profile = profile_page);
 
     void insert_index(const std::string &index_name, const dtype &key, const offset &value);
 
+    // @payload: included columns of the record one after another, as many
+    //  bytes as the included columns of the index.
+    void insert_index(const std::string &index_name, const dtype &key, const offset &value,
+                      const std::vector<char> &payload);
+
     void
     batch_insert(const std::string &index_name, const std::vector<dtype> &keys, const std::vector<offset> &values);
 
+    // Create several indexes from one batch of columns, building them in parallel.
+    // @index_names: name of the index on each column.
+    // @type_indicators: type of each column.
+    // @columns: columns[i][j] is the key of row j in column i.
+    // @values: offset of each row.
+    // @thread_num: number of workers, 0 means one per hardware thread.
+    void batch_create_index(const std::vector<std::string> &index_names, const std::vector<int> &type_indicators,
+                            const std::vector<std::vector<dtype>> &columns, const std::vector<offset> &values,
+                            unsigned int thread_num = 0);
+
 
     void drop_index(const std::string &index_name);
 
     void delete_index(const std::string &index_name, const dtype &key);
 
+    // Delete every key in [key_begin, key_end], freeing whole leaves instead
+    // of deleting key by key. Keys missing in the range are not an error.
+    // @return: number of keys deleted.
+    unsigned int delete_range(const std::string &index_name, const dtype &key_begin, const dtype &key_end);
+
+    // Shape and operation counters of one index.
+    index_stats stats(const std::string &index_name);
+
+    // Stats of every open index, by index name.
+    std::map<std::string, index_stats> all_stats();
+
+    // Let deletes on an index leave nodes underfull instead of borrowing or
+    // merging, which only compact_index then does.
+    void set_relaxed_delete(const std::string &index_name, bool relaxed);
+
+    // Merge sparse leaves of an index, a bounded step to call when idle.
+    // @budget: max number of leaves to visit.
+    // @return: number of leaves merged away.
+    unsigned int compact_index(const std::string &index_name, unsigned int budget);
+
+    // Rewrite the leaves of an index densely and in key order, a bounded step
+    // to call when idle until the pass is finished. Restores the scan speed
+    // of an index just built, after many inserts and deletes.
+    // @budget: max number of leaves to rewrite.
+    // @return: progress of the running pass.
+    defrag_progress defragment_index(const std::string &index_name, unsigned int budget);
+
+    // Keep the leaves of an int index bit packed, see PackedLeaf.
+    // Smaller in memory and faster to scan, slower to write.
+    void set_compressed_index(const std::string &index_name, bool compressed);
+
+    // Write an index to its file, see TreeFile.h.
+    void save_index(const std::string &index_name);
+
+    // Search the file written by save_index instead of the index in memory,
+    // for scans of cold data. Leaf pages are read ahead by worker threads.
+    // @read_ahead: max number of leaf pages read ahead of the one scanned.
+    // @return: offsets in key order.
+    std::vector<offset> search_between_saved(const std::string &index_name, const dtype &key_begin,
+                                             const dtype &key_end, unsigned int read_ahead = 8);
+
+    // Keep entry counts in the internal nodes of an index, so that
+    // count_between, rank and key_at_rank take one descent.
+    // Without counts they still work by walking the leaves.
+    void set_counted_index(const std::string &index_name, bool counted);
+
+    // @return: number of keys in [key_begin, key_end].
+    unsigned int count_between(const std::string &index_name, const dtype &key_begin, const dtype &key_end);
+
+    // @return: number of keys less than key.
+    unsigned int rank(const std::string &index_name, const dtype &key);
+
+    // @rank: 0 for the smallest key.
+    // @key: key of rank.
+    // @value: offset of key.
+    // @return: false if rank is out of range.
+    bool key_at_rank(const std::string &index_name, unsigned int rank, dtype &key, offset &value);
+
+    // Register the indexes listed in a catalog file without loading them.
+    // Each index is opened from its file on first access, frozen again if it
+    // was frozen when the catalog was saved.
+    // The catalog is created by save_catalog if it does not exist.
+    void open_catalog(const std::string &catalog_file);
+
+    // Save changed indexes to their files, and list every index in the catalog
+    // with its type, flags and root page.
+    // Partitioned indexes are not listed, they only live in memory.
+    void save_catalog();
+
+    // Save and close indexes not accessed for longer than idle, they are
+    // opened again on next access. Partitioned indexes never close.
+    // @return: number of indexes closed.
+    unsigned int close_idle(std::chrono::milliseconds idle);
+
+    // @return: false if the index is listed in the catalog but not loaded yet,
+    //  or closed.
+    bool index_open(const std::string &index_name);
+
+    // Bound the bytes held by all open indexes together. Every
+    // budget_check_interval accesses, and whenever an index opens, the least
+    // recently used indexes are saved and closed until the rest fit.
+    // The index being accessed is never closed, nor are partitioned indexes.
+    // @budget: max bytes, 0 for no limit.
+    void set_memory_budget(size_t budget);
+
+    // @return: bytes held by all open indexes, see BPTree::memory_bytes.
+    size_t memory_used();
+
+    // @return: bytes held by one index, 0 if closed.
+    size_t memory_used(const std::string &index_name);
+
+    // Replace a plain index by a FrozenTree, for data that no longer changes.
+    // Searches by key and range, counts and ranks are served from it, faster
+    // and in less memory. Other reads and all writes throw IndexFrozen until
+    // thaw_index. The index is saved to its file first, as when closed.
+    void freeze_index(const std::string &index_name);
+
+    // Drop the frozen copy, the index opens from its file on next access.
+    void thaw_index(const std::string &index_name);
+
+    // An index stays frozen through save_catalog and open_catalog.
+    bool index_frozen(const std::string &index_name);
+
+    // Hold inserts and deletes of a plain index in a WriteBuffer and apply
+    // them in key order once capacity of them are held, for indexes taking
+    // many writes at random keys. Inserts without included columns, deletes,
+    // and searches by key and range are served with the buffered changes,
+    // other accesses apply them first. Turning it off applies them.
+    // @capacity: see WriteBuffer, 0 for its default.
+    void set_buffered_index(const std::string &index_name, bool buffered, size_t capacity = 0);
+
+    // Apply the changes buffered for an index now.
+    void flush_index(const std::string &index_name);
+
 private:
     std::map<std::string, BPTree<int> *> int_tree;
-    std::map<std::string, BPTree<float> *> float_tree;
+    // Float keys are kept as ordered_float bits.
+    std::map<std::string, BPTree<uint32_t> *> float_tree;
     std::map<std::string, BPTree<m_string> *> char_tree;
+    // Only creating and dropping indexes change these, everything else finds
+    // trees in them with part_tree_of, so that threads may share them.
+    std::map<std::string, PartitionedBPTree<int> *> int_part_tree;
+    std::map<std::string, PartitionedBPTree<uint32_t> *> float_part_tree;
+    std::map<std::string, PartitionedBPTree<m_string> *> char_part_tree;
     std::map<std::string, int> type_reminder;
+    // Workers reading index files, created when first needed.
+    std::shared_ptr<ThreadPool> io_pool;
+    // Reads wait on the device, not the CPU, so use more workers than cores.
+    static const unsigned int io_thread_num = 8;
+    // Workers of parallel scans, one per core, created when first needed.
+    // Read and replaced with std::atomic_load / std::atomic_compare_exchange_strong only.
+    std::shared_ptr<ThreadPool> scan_pool;
+    // Byte size of the included columns of covering indexes.
+    std::map<std::string, std::vector<int>> included_sizes;
+
+    // What the catalog knows of an index that is not loaded.
+    struct catalog_entry {
+        int type_indicator;
+        node_profile profile;
+        bool relaxed;
+        bool compressed;
+        bool counted;
+        unsigned int root_page;
+        // Freeze the index once opened.
+        bool frozen;
+    };
+    std::string catalog_file;
+    std::map<std::string, catalog_entry> closed;
+    // Entries of frozen indexes, their files are up to date.
+    std::map<std::string, catalog_entry> frozen;
+    std::map<std::string, FrozenTree<int> *> int_frozen;
+    std::map<std::string, FrozenTree<uint32_t> *> float_frozen;
+    std::map<std::string, FrozenTree<m_string> *> char_frozen;
+    // Changes held back from buffered indexes.
+    std::map<std::string, WriteBuffer<int> *> int_buffer;
+    std::map<std::string, WriteBuffer<uint32_t> *> float_buffer;
+    std::map<std::string, WriteBuffer<m_string> *> char_buffer;
+    // Indexes changed since they were last saved.
+    std::set<std::string> dirty;
+    std::map<std::string, std::chrono::steady_clock::time_point> last_used;
+    size_t memory_budget = 0;
+    // Bytes of open indexes when last measured, dropped when they change.
+    std::map<std::string, size_t> index_bytes;
+    // Accesses since the memory budget was last checked.
+    unsigned int budget_accesses = 0;
+    static const unsigned int budget_check_interval = 256;
+    // Offsets taken per page by filter_scan.
+    static const size_t filter_page_size = 4096;
+
+#ifdef INDEX_TRACE
+
+    // Time an operation from construction to destruction.
+    class trace_scope {
+    public:
+        trace_scope(IndexManager &manager, trace_op op, const std::string &index_name, const dtype *key_begin,
+                    const dtype *key_end, uint64_t rows = 1);
+
+        ~trace_scope();
+
+        // Remember the size of a result and pass it through.
+        std::vector<offset> rows(std::vector<offset> result);
+
+        offset_bitmap rows(offset_bitmap result);
+
+    private:
+        IndexManager &manager;
+        trace_op op;
+        const std::string &index_name;
+        const dtype *key_begin;
+        const dtype *key_end;
+        uint64_t row_num;
+        unsigned int height;
+        uint64_t restructures;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Read height and restructure counter of an index for the slow operation log.
+    // Both are 0 if the index does not exist.
+    void probe(const std::string &index_name, unsigned int &height, uint64_t &restructures);
+
+    static std::string key_text(const dtype &key);
+
+#endif
+
+    // What a caller of find_index serves itself.
+    enum served_by {
+        // Reads of frozen indexes, other accesses throw IndexFrozen on them.
+        serves_frozen = 1,
+        // Changes buffered in a WriteBuffer, other accesses apply them first.
+        serves_buffered = 2
+    };
+
+    // Find an index, opening it if closed, and remember the access.
+    // @write: the access changes the index.
+    // @served: served_by flags of the caller.
+    std::map<std::string, int>::iterator find_index(const std::string &index_name, bool write = false,
+                                                    unsigned int served = 0);
+
+    // Apply the changes buffered for an index, if any.
+    // @invalidate: the tree is about to be written past the buffer.
+    void flush_buffer(const std::string &index_name, bool invalidate = false);
+
+    // Load a closed index from its file.
+    void open_index(const std::string &index_name);
+
+    // Save an open plain index and free its tree.
+    void close_index(const std::string &index_name);
+
+    // Close the least recently used indexes but keep, until the open ones fit
+    // in the memory budget.
+    void enforce_budget(const std::string &keep);
+
+    // Fill entry from an open plain index, saving it first if changed.
+    void describe_index(const std::string &index_name, catalog_entry &entry);
+
+    // Replace an open plain index by its FrozenTree.
+    void freeze_tree(const std::string &index_name, const catalog_entry &entry);
+
+    template<typename T>
+    BPTree<T> *open_tree(const std::string &index_name, const catalog_entry &entry);
+
+    template<typename T>
+    void describe_tree(BPTree<T> *tree, const std::string &index_name, catalog_entry &entry);
+
+    // @return: number of offsets where may match, not less than the real one.
+    size_t estimate(const predicate &where);
+
+    // @return: offsets matching where, ascending.
+    std::vector<offset> evaluate(const predicate &where);
+
+    // @return: offsets of a leaf predicate that pass filter, ascending.
+    std::vector<offset> filter_scan(const predicate &where, const offset_filter &filter);
+
+    // One page of a search, a nullptr bound leaves the range open.
+    std::vector<offset> search_page(const std::string &index_name, const dtype *key_begin, const dtype *key_end,
+                                    size_t limit, size_t skip, page_token &token);
+
+    // One page of a search on a BPTree or a PartitionedBPTree.
+    // @resume: start after resume_key instead of begin_key.
+    // @last_key: key of the last offset taken.
+    // @more: set if keys in range are left.
+    template<typename Tree, typename T>
+    static std::vector<offset> tree_page(Tree *tree, bool bounded_begin, T begin_key, bool bounded_end, T end_key,
+                                         size_t limit, size_t skip, bool resume, const T &resume_key, T &last_key,
+                                         bool &more);
+
+    // Index only scan of one tree, see search_between.
+    template<typename T>
+    static std::vector<offset> scan_covering(BPTree<T> *tree, T begin_key, T end_key, std::vector<char> &payloads);
+
+    // Sort rows by key and bulk load them into a new B+ tree.
+    template<typename T>
+    static BPTree<T> *build_tree(std::string index_name, std::vector<std::pair<T, offset>> &rows);
+
+    // @return: partitioned tree of an index, nullptr if it is not partitioned.
+    //  Only reads trees, so threads sharing partitioned indexes may call it.
+    template<typename T>
+    static PartitionedBPTree<T> *part_tree_of(const std::map<std::string, PartitionedBPTree<T> *> &trees,
+                                              const std::string &index_name);
 
 };
 
 IndexManager::IndexManager() = default;
 
-IndexManager::~IndexManager() = default;
+IndexManager::~IndexManager() {
+    for (auto &tree : int_tree)
+        delete tree.second;
+    for (auto &tree : float_tree)
+        delete tree.second;
+    for (auto &tree : char_tree)
+        delete tree.second;
+    for (auto &tree : int_part_tree)
+        delete tree.second;
+    for (auto &tree : float_part_tree)
+        delete tree.second;
+    for (auto &tree : char_part_tree)
+        delete tree.second;
+    for (auto &tree : int_frozen)
+        delete tree.second;
+    for (auto &tree : float_frozen)
+        delete tree.second;
+    for (auto &tree : char_frozen)
+        delete tree.second;
+    for (auto &buffer : int_buffer)
+        delete buffer.second;
+    for (auto &buffer : float_buffer)
+        delete buffer.second;
+    for (auto &buffer : char_buffer)
+        delete buffer.second;
+}
+
+void IndexManager::create_index(std::string index_name, int type_indicator, node_profile profile,
+                                const std::vector<int> &included) {
+    auto it = type_reminder.find(index_name);
+    if (it != type_reminder.end()) {
+        throw DuplicateIndex();
+        return;
+    }
+    int payload_size = 0;
+    for (auto column_size : included) {
+        if (column_size <= 0)
+            throw PayloadSizeDisaccord("Included column must have a positive size");
+        payload_size += column_size;
+    }
+    type_reminder[index_name] = type_indicator;
+    dirty.insert(index_name);
+    last_used[index_name] = std::chrono::steady_clock::now();
+    if (!included.empty())
+        included_sizes[index_name] = included;
+    if (type_indicator == type_int) {
+        int_tree[index_name] = new BPTree<int>(index_name, profile, payload_size);
+    } else if (type_indicator == type_float) {
+        float_tree[index_name] = new BPTree<uint32_t>(index_name, profile, payload_size);
+    } else {
+        char_tree[index_name] = new BPTree<m_string>(index_name, profile, payload_size);
+    }
+}
 
-void IndexManager::create_index(std::string index_name, int type_indicator) {
+void IndexManager::create_partitioned_index(std::string index_name, int type_indicator, unsigned int shard_num,
+                                            node_profile profile) {
     auto it = type_reminder.find(index_name);
     if (it != type_reminder.end()) {
         throw DuplicateIndex();
@@ -169,11 +663,11 @@ void IndexManager::create_index(std::string index_name, int type_indicator) {
     }
     type_reminder[index_name] = type_indicator;
     if (type_indicator == type_int) {
-        int_tree[index_name] = new BPTree<int>(index_name);
+        int_part_tree[index_name] = new PartitionedBPTree<int>(index_name, shard_num, profile);
     } else if (type_indicator == type_float) {
-        float_tree[index_name] = new BPTree<float>(index_name);;
+        float_part_tree[index_name] = new PartitionedBPTree<uint32_t>(index_name, shard_num, profile);
     } else {
-        char_tree[index_name] = new BPTree<m_string>(index_name);
+        char_part_tree[index_name] = new PartitionedBPTree<m_string>(index_name, shard_num, profile);
     }
 }
 
@@ -183,173 +677,1716 @@ void IndexManager::drop_index(const std::string &index_name) {
         throw IndexNotExist();
         return;
     }
+    if (closed.count(index_name) || frozen.count(index_name) || int_tree.count(index_name) ||
+        float_tree.count(index_name) || char_tree.count(index_name)) {
+        std::remove(BPTree<int>::file_name_of(index_name).c_str());
+    }
     auto data_type = it->second;
-    if (data_type == type_int) {
-        auto p_tree = int_tree[index_name];
-        delete p_tree;
-        int_tree.erase(index_name);
+    if (closed.count(index_name)) {
+        closed.erase(index_name);
+    } else if (frozen.count(index_name)) {
+        delete int_frozen[index_name];
+        delete float_frozen[index_name];
+        delete char_frozen[index_name];
+        int_frozen.erase(index_name);
+        float_frozen.erase(index_name);
+        char_frozen.erase(index_name);
+        frozen.erase(index_name);
+    } else if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            delete p_part;
+            int_part_tree.erase(index_name);
+        } else {
+            auto p_tree = int_tree[index_name];
+            delete p_tree;
+            int_tree.erase(index_name);
+        }
     } else if (data_type == type_float) {
-        auto p_tree = float_tree[index_name];
-        delete p_tree;
-        float_tree.erase(index_name);
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            delete p_part;
+            float_part_tree.erase(index_name);
+        } else {
+            auto p_tree = float_tree[index_name];
+            delete p_tree;
+            float_tree.erase(index_name);
+        }
     } else {
-        auto p_tree = char_tree[index_name];
-        delete p_tree;
-        char_tree.erase(index_name);
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            delete p_part;
+            char_part_tree.erase(index_name);
+        } else {
+            auto p_tree = char_tree[index_name];
+            delete p_tree;
+            char_tree.erase(index_name);
+        }
     }
+    delete int_buffer[index_name];
+    delete float_buffer[index_name];
+    delete char_buffer[index_name];
+    int_buffer.erase(index_name);
+    float_buffer.erase(index_name);
+    char_buffer.erase(index_name);
+    included_sizes.erase(index_name);
+    dirty.erase(index_name);
+    last_used.erase(index_name);
+    index_bytes.erase(index_name);
+    type_reminder.erase(it);
 }
 
 void IndexManager::insert_index(const std::string &index_name, const IndexManager::dtype &key, const offset &value) {
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
-        throw IndexNotExist();
+    INDEX_TRACE_SCOPE(trace_insert_index, index_name, &key, &key);
+    auto it = find_index(index_name, true, serves_buffered);
+    auto data_type = it->second;
+    if (key.type_indicator != data_type) {
+        throw TypeDisaccord();
         return;
     }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            p_part->insert(key.int_value, value);
+        } else if (int_buffer.count(index_name)) {
+            int_buffer[index_name]->insert(*int_tree[index_name], key.int_value, value);
+        } else {
+            auto p_tree = int_tree[index_name];
+            p_tree->insert(key.int_value, value);
+        }
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            p_part->insert(ordered_float(key.float_value), value);
+        } else if (float_buffer.count(index_name)) {
+            float_buffer[index_name]->insert(*float_tree[index_name], ordered_float(key.float_value), value);
+        } else {
+            auto p_tree = float_tree[index_name];
+            p_tree->insert(ordered_float(key.float_value), value);
+        }
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            p_part->insert(key.var_char, value);
+        } else if (char_buffer.count(index_name)) {
+            char_buffer[index_name]->insert(*char_tree[index_name], key.var_char, value);
+        } else {
+            auto p_tree = char_tree[index_name];
+            p_tree->insert(key.var_char, value);
+        }
+    }
+}
+
+void IndexManager::insert_index(const std::string &index_name, const IndexManager::dtype &key, const offset &value,
+                                const std::vector<char> &payload) {
+    INDEX_TRACE_SCOPE(trace_insert_index, index_name, &key, &key);
+    auto it = find_index(index_name, true);
     auto data_type = it->second;
     if (key.type_indicator != data_type) {
         throw TypeDisaccord();
-        return;
+    }
+    // Partitioned indexes have no included columns.
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw PayloadSizeDisaccord();
     }
     if (data_type == type_int) {
         auto p_tree = int_tree[index_name];
-        p_tree->insert(key.int_value, value);
+        if (static_cast<int>(payload.size()) != p_tree->payload_bytes())
+            throw PayloadSizeDisaccord();
+        p_tree->insert(key.int_value, value, payload.data());
     } else if (data_type == type_float) {
         auto p_tree = float_tree[index_name];
-        p_tree->insert(key.float_value, value);
+        if (static_cast<int>(payload.size()) != p_tree->payload_bytes())
+            throw PayloadSizeDisaccord();
+        p_tree->insert(ordered_float(key.float_value), value, payload.data());
     } else {
         auto p_tree = char_tree[index_name];
-        p_tree->insert(key.var_char, value);
+        if (static_cast<int>(payload.size()) != p_tree->payload_bytes())
+            throw PayloadSizeDisaccord();
+        p_tree->insert(key.var_char, value, payload.data());
     }
 }
 
 void IndexManager::delete_index(const std::string &index_name, const IndexManager::dtype &key) {
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
-        throw IndexNotExist();
-        return;
-    }
+    INDEX_TRACE_SCOPE(trace_delete_index, index_name, &key, &key);
+    auto it = find_index(index_name, true, serves_buffered);
     auto data_type = it->second;
     if (key.type_indicator != data_type) {
         throw TypeDisaccord();
         return;
     }
     if (data_type == type_int) {
-        auto p_tree = int_tree[index_name];
-        p_tree->delete_by_key(key.int_value);
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            p_part->delete_by_key(key.int_value);
+        } else if (int_buffer.count(index_name)) {
+            int_buffer[index_name]->delete_by_key(*int_tree[index_name], key.int_value);
+        } else {
+            auto p_tree = int_tree[index_name];
+            p_tree->delete_by_key(key.int_value);
+        }
     } else if (data_type == type_float) {
-        auto p_tree = float_tree[index_name];
-        p_tree->delete_by_key(key.float_value);
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            p_part->delete_by_key(ordered_float(key.float_value));
+        } else if (float_buffer.count(index_name)) {
+            float_buffer[index_name]->delete_by_key(*float_tree[index_name], ordered_float(key.float_value));
+        } else {
+            auto p_tree = float_tree[index_name];
+            p_tree->delete_by_key(ordered_float(key.float_value));
+        }
     } else {
-        auto p_tree = char_tree[index_name];
-        p_tree->delete_by_key(key.var_char);
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            p_part->delete_by_key(key.var_char);
+        } else if (char_buffer.count(index_name)) {
+            char_buffer[index_name]->delete_by_key(*char_tree[index_name], key.var_char);
+        } else {
+            auto p_tree = char_tree[index_name];
+            p_tree->delete_by_key(key.var_char);
+        }
     }
 }
 
 std::vector<offset> IndexManager::search_equal(const std::string &index_name, const IndexManager::dtype &data) {
+    INDEX_TRACE_SCOPE(trace_search_equal, index_name, &data, &data);
     std::vector<offset> result;
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
-        throw IndexNotExist();
-        return result;
-    }
+    auto it = find_index(index_name, false, serves_frozen | serves_buffered);
     auto data_type = it->second;
     if (data.type_indicator != data_type) {
         throw TypeDisaccord();
         return result;
     }
     if (data_type == type_int) {
-        auto p_tree = int_tree[index_name];
-        result.push_back(p_tree->search_by_key(data.int_value));
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            result.push_back(p_part->search_by_key(data.int_value));
+        } else if (int_frozen.count(index_name)) {
+            result.push_back(int_frozen[index_name]->search_by_key(data.int_value));
+        } else if (int_buffer.count(index_name)) {
+            result.push_back(int_buffer[index_name]->search_by_key(*int_tree[index_name], data.int_value));
+        } else {
+            auto p_tree = int_tree[index_name];
+            result.push_back(p_tree->search_by_key(data.int_value));
+        }
     } else if (data_type == type_float) {
-        auto p_tree = float_tree[index_name];
-        result.push_back(p_tree->search_by_key(data.float_value));
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            result.push_back(p_part->search_by_key(ordered_float(data.float_value)));
+        } else if (float_frozen.count(index_name)) {
+            result.push_back(float_frozen[index_name]->search_by_key(ordered_float(data.float_value)));
+        } else if (float_buffer.count(index_name)) {
+            result.push_back(
+                    float_buffer[index_name]->search_by_key(*float_tree[index_name], ordered_float(data.float_value)));
+        } else {
+            auto p_tree = float_tree[index_name];
+            result.push_back(p_tree->search_by_key(ordered_float(data.float_value)));
+        }
     } else {
-        auto p_tree = char_tree[index_name];
-        result.push_back(p_tree->search_by_key(data.var_char));
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            result.push_back(p_part->search_by_key(data.var_char));
+        } else if (char_frozen.count(index_name)) {
+            result.push_back(char_frozen[index_name]->search_by_key(data.var_char));
+        } else if (char_buffer.count(index_name)) {
+            result.push_back(char_buffer[index_name]->search_by_key(*char_tree[index_name], data.var_char));
+        } else {
+            auto p_tree = char_tree[index_name];
+            result.push_back(p_tree->search_by_key(data.var_char));
+        }
     }
-    return result;
+    return INDEX_TRACE_ROWS(result);
 }
 
 std::vector<offset> IndexManager::search_greater(const std::string &index_name, const IndexManager::dtype &key_begin) {
+    INDEX_TRACE_SCOPE(trace_search_greater, index_name, &key_begin, nullptr);
     auto result = std::vector<offset>();
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
-        throw IndexNotExist();
-        return result;
-    }
+    auto it = find_index(index_name, false, serves_frozen | serves_buffered);
     auto data_type = it->second;
     if (key_begin.type_indicator != data_type) {
         throw TypeDisaccord();
         return result;
     }
     if (data_type == type_int) {
-        auto p_tree = int_tree[index_name];
-        return p_tree->search_greater(key_begin.int_value);
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_greater(key_begin.int_value));
+        } else if (int_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_frozen[index_name]->search_greater(key_begin.int_value));
+        } else if (int_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_buffer[index_name]->search_greater(*int_tree[index_name], key_begin.int_value));
+        } else {
+            auto p_tree = int_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_greater(key_begin.int_value));
+        }
     } else if (data_type == type_float) {
-        auto p_tree = float_tree[index_name];
-        return p_tree->search_greater(key_begin.float_value);
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_greater(ordered_float(key_begin.float_value)));
+        } else if (float_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_frozen[index_name]->search_greater(ordered_float(key_begin.float_value)));
+        } else if (float_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_buffer[index_name]->search_greater(*float_tree[index_name],
+                                                                             ordered_float(key_begin.float_value)));
+        } else {
+            auto p_tree = float_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_greater(ordered_float(key_begin.float_value)));
+        }
     } else {
-        auto p_tree = char_tree[index_name];
-        return p_tree->search_greater(key_begin.var_char);
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_greater(key_begin.var_char));
+        } else if (char_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(char_frozen[index_name]->search_greater(key_begin.var_char));
+        } else if (char_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(
+                    char_buffer[index_name]->search_greater(*char_tree[index_name], key_begin.var_char));
+        } else {
+            auto p_tree = char_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_greater(key_begin.var_char));
+        }
     }
 }
 
 std::vector<offset> IndexManager::search_smaller(const std::string &index_name, const IndexManager::dtype &key_end) {
+    INDEX_TRACE_SCOPE(trace_search_smaller, index_name, nullptr, &key_end);
     auto result = std::vector<offset>();
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
-        throw IndexNotExist();
-        return result;
-    }
+    auto it = find_index(index_name, false, serves_frozen | serves_buffered);
     auto data_type = it->second;
     if (key_end.type_indicator != data_type) {
         throw TypeDisaccord();
         return result;
     }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_smaller(key_end.int_value));
+        } else if (int_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_frozen[index_name]->search_smaller(key_end.int_value));
+        } else if (int_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_buffer[index_name]->search_smaller(*int_tree[index_name], key_end.int_value));
+        } else {
+            auto p_tree = int_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_smaller(key_end.int_value));
+        }
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_smaller(ordered_float(key_end.float_value)));
+        } else if (float_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_frozen[index_name]->search_smaller(ordered_float(key_end.float_value)));
+        } else if (float_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_buffer[index_name]->search_smaller(*float_tree[index_name],
+                                                                             ordered_float(key_end.float_value)));
+        } else {
+            auto p_tree = float_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_smaller(ordered_float(key_end.float_value)));
+        }
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_smaller(key_end.var_char));
+        } else if (char_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(char_frozen[index_name]->search_smaller(key_end.var_char));
+        } else if (char_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(char_buffer[index_name]->search_smaller(*char_tree[index_name], key_end.var_char));
+        } else {
+            auto p_tree = char_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_smaller(key_end.var_char));
+        }
+    }
+}
+
+std::vector<offset> IndexManager::search_equal(const std::string &index_name, const IndexManager::dtype &key,
+                                               std::vector<char> &payload) {
+    INDEX_TRACE_SCOPE(trace_search_equal, index_name, &key, &key);
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (key.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        payload.clear();
+        return INDEX_TRACE_ROWS(search_equal(index_name, key));
+    }
+    std::vector<offset> result;
     if (data_type == type_int) {
         auto p_tree = int_tree[index_name];
-        return p_tree->search_greater(key_end.int_value);
+        payload.resize(static_cast<size_t>(p_tree->payload_bytes()));
+        result.push_back(p_tree->search_by_key(key.int_value, payload.data()));
     } else if (data_type == type_float) {
         auto p_tree = float_tree[index_name];
-        return p_tree->search_greater(key_end.float_value);
+        payload.resize(static_cast<size_t>(p_tree->payload_bytes()));
+        result.push_back(p_tree->search_by_key(ordered_float(key.float_value), payload.data()));
     } else {
         auto p_tree = char_tree[index_name];
-        return p_tree->search_greater(key_end.var_char);
+        payload.resize(static_cast<size_t>(p_tree->payload_bytes()));
+        result.push_back(p_tree->search_by_key(key.var_char, payload.data()));
     }
+    if (result.front() == -1)
+        payload.clear();
+    return INDEX_TRACE_ROWS(result);
 }
 
 std::vector<offset> IndexManager::search_between(const std::string &index_name, const IndexManager::dtype &key_begin,
-                                                 const IndexManager::dtype &key_end) {
-    auto result = std::vector<offset>();
-    auto it = type_reminder.find(index_name);
-    if (it == type_reminder.end()) {
+                                                 const IndexManager::dtype &key_end, std::vector<char> &payloads) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw PayloadSizeDisaccord();
+    }
+    if (data_type == type_int) {
+        return INDEX_TRACE_ROWS(scan_covering(int_tree[index_name], key_begin.int_value, key_end.int_value, payloads));
+    } else if (data_type == type_float) {
+        return INDEX_TRACE_ROWS(scan_covering(float_tree[index_name], ordered_float(key_begin.float_value),
+                                              ordered_float(key_end.float_value), payloads));
+    } else {
+        return INDEX_TRACE_ROWS(scan_covering(char_tree[index_name], key_begin.var_char, key_end.var_char, payloads));
+    }
+}
+
+template<typename T>
+std::vector<offset> IndexManager::scan_covering(BPTree<T> *tree, T begin_key, T end_key, std::vector<char> &payloads) {
+    // Same as search_between, a reversed range is searched the right way.
+    if (end_key < begin_key)
+        std::swap(begin_key, end_key);
+    std::vector<offset> result;
+    payloads.clear();
+    auto payload_size = static_cast<size_t>(tree->payload_bytes());
+    for (auto c = tree->seek(begin_key); c.valid() && !(end_key < c.key()); c.next()) {
+        result.push_back(c.value());
+        if (payload_size > 0)
+            payloads.insert(payloads.end(), c.payload(), c.payload() + payload_size);
+    }
+    return result;
+}
+
+std::vector<int> IndexManager::included_columns(const std::string &index_name) {
+    if (!type_reminder.count(index_name)) {
         throw IndexNotExist();
-        return result;
     }
+    auto it = included_sizes.find(index_name);
+    return it == included_sizes.end() ? std::vector<int>() : it->second;
+}
+
+std::vector<offset> IndexManager::search_smaller_desc(const std::string &index_name, const IndexManager::dtype &key_end,
+                                                     size_t limit, bool inclusive) {
+    INDEX_TRACE_SCOPE(trace_search_smaller_desc, index_name, nullptr, &key_end);
+    auto it = find_index(index_name);
     auto data_type = it->second;
-    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+    if (key_end.type_indicator != data_type) {
         throw TypeDisaccord();
-        return result;
     }
     if (data_type == type_int) {
-        auto p_tree = int_tree[index_name];
-        return p_tree->search_between(key_begin.int_value, key_end.int_value);
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_smaller_desc(key_end.int_value, limit, inclusive));
+        return INDEX_TRACE_ROWS(int_tree[index_name]->search_smaller_desc(key_end.int_value, limit, inclusive));
     } else if (data_type == type_float) {
-        auto p_tree = float_tree[index_name];
-        return p_tree->search_between(key_begin.float_value, key_end.float_value);
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_smaller_desc(ordered_float(key_end.float_value), limit, inclusive));
+        return INDEX_TRACE_ROWS(
+                float_tree[index_name]->search_smaller_desc(ordered_float(key_end.float_value), limit, inclusive));
     } else {
-        auto p_tree = char_tree[index_name];
-        return p_tree->search_between(key_begin.var_char, key_end.var_char);
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_smaller_desc(key_end.var_char, limit, inclusive));
+        return INDEX_TRACE_ROWS(char_tree[index_name]->search_smaller_desc(key_end.var_char, limit, inclusive));
     }
 }
 
-void IndexManager::batch_insert(const std::string &index_name, const std::vector<IndexManager::dtype> &keys,
-                                const std::vector<offset> &values) {
-    if (keys.size() != values.size()) {
-        throw BatchSizeNotEqual();
+std::vector<offset> IndexManager::search_last(const std::string &index_name, size_t limit) {
+    INDEX_TRACE_SCOPE(trace_search_last, index_name, nullptr, nullptr);
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_last(limit));
+        return INDEX_TRACE_ROWS(int_tree[index_name]->search_last(limit));
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_last(limit));
+        return INDEX_TRACE_ROWS(float_tree[index_name]->search_last(limit));
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_last(limit));
+        return INDEX_TRACE_ROWS(char_tree[index_name]->search_last(limit));
     }
-    for (int i = 0; i < keys.size(); i++) {
-        insert_index(index_name, keys[i], values[i]);
+}
+
+std::vector<offset> IndexManager::search_between(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                                 const IndexManager::dtype &key_end, size_t limit, size_t skip,
+                                                 IndexManager::page_token &token) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    return INDEX_TRACE_ROWS(search_page(index_name, &key_begin, &key_end, limit, skip, token));
+}
+
+std::vector<offset> IndexManager::search_greater(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                                 size_t limit, size_t skip, IndexManager::page_token &token) {
+    INDEX_TRACE_SCOPE(trace_search_greater, index_name, &key_begin, nullptr);
+    return INDEX_TRACE_ROWS(search_page(index_name, &key_begin, nullptr, limit, skip, token));
+}
+
+std::vector<offset> IndexManager::search_smaller(const std::string &index_name, const IndexManager::dtype &key_end,
+                                                 size_t limit, size_t skip, IndexManager::page_token &token) {
+    INDEX_TRACE_SCOPE(trace_search_smaller, index_name, nullptr, &key_end);
+    return INDEX_TRACE_ROWS(search_page(index_name, nullptr, &key_end, limit, skip, token));
+}
+
+std::vector<offset> IndexManager::search_where(const IndexManager::predicate &where) {
+    return evaluate(where);
+}
+
+size_t IndexManager::estimate(const IndexManager::predicate &where) {
+    if (where.op == predicate::op_and || where.op == predicate::op_or) {
+        size_t result = where.op == predicate::op_and ? SIZE_MAX : 0;
+        for (auto &child : where.children) {
+            size_t child_size = estimate(child);
+            if (where.op == predicate::op_and)
+                result = std::min(result, child_size);
+            else
+                result += child_size;
+        }
+        return where.children.empty() ? 0 : result;
+    }
+    if (where.op == predicate::op_equal)
+        return 1;
+    auto it = find_index(where.index_name, false, serves_frozen);
+    auto data_type = it->second;
+    const std::string &index_name = where.index_name;
+    bool counted;
+    size_t key_num;
+    if (int_frozen.count(index_name) || float_frozen.count(index_name) || char_frozen.count(index_name)) {
+        counted = true;
+        key_num = int_frozen.count(index_name) ? int_frozen[index_name]->size()
+                  : float_frozen.count(index_name) ? float_frozen[index_name]->size()
+                  : char_frozen[index_name]->size();
+    } else if (data_type == type_int) {
+        auto p_part = part_tree_of(int_part_tree, index_name);
+        counted = p_part ? p_part->counted_tree() : int_tree[index_name]->counted_tree();
+        key_num = p_part ? p_part->size() : int_tree[index_name]->size();
+    } else if (data_type == type_float) {
+        auto p_part = part_tree_of(float_part_tree, index_name);
+        counted = p_part ? p_part->counted_tree() : float_tree[index_name]->counted_tree();
+        key_num = p_part ? p_part->size() : float_tree[index_name]->size();
+    } else {
+        auto p_part = part_tree_of(char_part_tree, index_name);
+        counted = p_part ? p_part->counted_tree() : char_tree[index_name]->counted_tree();
+        key_num = p_part ? p_part->size() : char_tree[index_name]->size();
+    }
+    // Without counts, counting walks the range: take the whole index.
+    if (!counted)
+        return key_num;
+    if (where.op == predicate::op_between)
+        return count_between(index_name, where.key_begin, where.key_end);
+    if (where.op == predicate::op_greater)
+        return key_num - rank(index_name, where.key_begin);
+    return std::min(key_num, static_cast<size_t>(rank(index_name, where.key_end)) + 1);
+}
+
+std::vector<offset> IndexManager::evaluate(const IndexManager::predicate &where) {
+    std::vector<offset> result;
+    switch (where.op) {
+        case predicate::op_and: {
+            std::vector<std::pair<size_t, const predicate *>> order;
+            for (auto &child : where.children)
+                order.emplace_back(estimate(child), &child);
+            std::stable_sort(order.begin(), order.end(),
+                             [](const std::pair<size_t, const predicate *> &a,
+                                const std::pair<size_t, const predicate *> &b) { return a.first < b.first; });
+            for (size_t i = 0; i < order.size(); i++) {
+                const predicate &child = *order[i].second;
+                if (i == 0) {
+                    result = evaluate(child);
+                } else if (child.op != predicate::op_and && child.op != predicate::op_or &&
+                           order[i].first / std::max<size_t>(result.size(), 1) >= gallop_ratio) {
+                    result = filter_scan(child, offset_filter(result));
+                } else {
+                    result = intersect_offsets(result, evaluate(child));
+                }
+                if (result.empty())
+                    break;
+            }
+            return result;
+        }
+        case predicate::op_or: {
+            std::vector<std::vector<offset>> sets;
+            for (auto &child : where.children)
+                sets.push_back(evaluate(child));
+            return unite_offsets(sets);
+        }
+        case predicate::op_equal:
+            result = search_equal(where.index_name, where.key_begin);
+            // A missing key is searched as -1, which is no offset.
+            if (result.size() == 1 && result[0] == -1)
+                result.clear();
+            break;
+        case predicate::op_between:
+            result = search_between(where.index_name, where.key_begin, where.key_end);
+            break;
+        case predicate::op_greater:
+            result = search_greater(where.index_name, where.key_begin);
+            break;
+        case predicate::op_smaller:
+            result = search_smaller(where.index_name, where.key_end);
+            break;
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+std::vector<offset> IndexManager::filter_scan(const IndexManager::predicate &where, const offset_filter &filter) {
+    const dtype *key_begin = nullptr;
+    const dtype *key_end = nullptr;
+    if (where.op == predicate::op_equal || where.op == predicate::op_between || where.op == predicate::op_greater)
+        key_begin = &where.key_begin;
+    if (where.op == predicate::op_between || where.op == predicate::op_smaller)
+        key_end = &where.key_end;
+    else if (where.op == predicate::op_equal)
+        key_end = &where.key_begin;
+    std::vector<offset> result;
+    page_token token;
+    do {
+        for (auto value : search_page(where.index_name, key_begin, key_end, filter_page_size, 0, token)) {
+            if (filter.contains(value))
+                result.push_back(value);
+        }
+    } while (token.more);
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+std::vector<offset> IndexManager::search_page(const std::string &index_name, const IndexManager::dtype *key_begin,
+                                              const IndexManager::dtype *key_end, size_t limit, size_t skip,
+                                              IndexManager::page_token &token) {
+    auto it = find_index(index_name, false, serves_frozen);
+    auto data_type = it->second;
+    if ((key_begin && key_begin->type_indicator != data_type) || (key_end && key_end->type_indicator != data_type) ||
+        (token.more && token.last_key.type_indicator != data_type)) {
+        throw TypeDisaccord();
+    }
+    // Open bounds are never read.
+    const dtype open_bound = dtype();
+    const dtype &begin = key_begin ? *key_begin : open_bound;
+    const dtype &end = key_end ? *key_end : open_bound;
+    bool resume = token.more;
+    dtype &last = token.last_key;
+    if (data_type == type_int) {
+        int last_key = last.int_value;
+        std::vector<offset> result;
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            result = tree_page(p_part, key_begin != nullptr, begin.int_value, key_end != nullptr, end.int_value, limit,
+                               skip, resume, last.int_value, last_key, token.more);
+        else if (int_frozen.count(index_name))
+            result = tree_page(int_frozen[index_name], key_begin != nullptr, begin.int_value, key_end != nullptr,
+                               end.int_value, limit, skip, resume, last.int_value, last_key, token.more);
+        else
+            result = tree_page(int_tree[index_name], key_begin != nullptr, begin.int_value, key_end != nullptr,
+                               end.int_value, limit, skip, resume, last.int_value, last_key, token.more);
+        last.int_value = last_key;
+        last.type_indicator = data_type;
+        return result;
+    } else if (data_type == type_float) {
+        uint32_t resume_key = ordered_float(last.float_value);
+        uint32_t last_key = resume_key;
+        std::vector<offset> result;
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            result = tree_page(p_part, key_begin != nullptr, ordered_float(begin.float_value), key_end != nullptr,
+                               ordered_float(end.float_value), limit, skip, resume, resume_key, last_key, token.more);
+        else if (float_frozen.count(index_name))
+            result = tree_page(float_frozen[index_name], key_begin != nullptr, ordered_float(begin.float_value),
+                               key_end != nullptr, ordered_float(end.float_value), limit, skip, resume, resume_key,
+                               last_key, token.more);
+        else
+            result = tree_page(float_tree[index_name], key_begin != nullptr, ordered_float(begin.float_value),
+                               key_end != nullptr, ordered_float(end.float_value), limit, skip, resume, resume_key,
+                               last_key, token.more);
+        last.float_value = float_of_ordered(last_key);
+        last.type_indicator = data_type;
+        return result;
+    } else {
+        m_string last_key = last.var_char;
+        std::vector<offset> result;
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            result = tree_page(p_part, key_begin != nullptr, begin.var_char, key_end != nullptr, end.var_char, limit,
+                               skip, resume, last.var_char, last_key, token.more);
+        else if (char_frozen.count(index_name))
+            result = tree_page(char_frozen[index_name], key_begin != nullptr, begin.var_char, key_end != nullptr,
+                               end.var_char, limit, skip, resume, last.var_char, last_key, token.more);
+        else
+            result = tree_page(char_tree[index_name], key_begin != nullptr, begin.var_char, key_end != nullptr,
+                               end.var_char, limit, skip, resume, last.var_char, last_key, token.more);
+        last.var_char = last_key;
+        last.type_indicator = data_type;
+        return result;
+    }
+}
+
+template<typename Tree, typename T>
+std::vector<offset> IndexManager::tree_page(Tree *tree, bool bounded_begin, T begin_key, bool bounded_end, T end_key,
+                                            size_t limit, size_t skip, bool resume, const T &resume_key,
+                                            T &last_key, bool &more) {
+    // Same as search_between, a reversed range is searched the right way.
+    if (bounded_begin && bounded_end && end_key < begin_key)
+        std::swap(begin_key, end_key);
+    std::vector<offset> result;
+    if (resume)
+        more = tree->search_page(true, resume_key, true, bounded_end, end_key, skip, limit, result, last_key);
+    else
+        more = tree->search_page(bounded_begin, begin_key, false, bounded_end, end_key, skip, limit, result,
+                                 last_key);
+    return result;
+}
+
+std::vector<offset> IndexManager::search_between(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                                 const IndexManager::dtype &key_end) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    auto result = std::vector<offset>();
+    auto it = find_index(index_name, false, serves_frozen | serves_buffered);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+        throw TypeDisaccord();
+        return result;
+    }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_between(key_begin.int_value, key_end.int_value));
+        } else if (int_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_frozen[index_name]->search_between(key_begin.int_value, key_end.int_value));
+        } else if (int_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(int_buffer[index_name]->search_between(*int_tree[index_name], key_begin.int_value,
+                                                                           key_end.int_value));
+        } else {
+            auto p_tree = int_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_between(key_begin.int_value, key_end.int_value));
+        }
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_between(ordered_float(key_begin.float_value),
+                                                            ordered_float(key_end.float_value)));
+        } else if (float_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_frozen[index_name]->search_between(ordered_float(key_begin.float_value),
+                                                                             ordered_float(key_end.float_value)));
+        } else if (float_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(float_buffer[index_name]->search_between(*float_tree[index_name],
+                                                                             ordered_float(key_begin.float_value),
+                                                                             ordered_float(key_end.float_value)));
+        } else {
+            auto p_tree = float_tree[index_name];
+            return INDEX_TRACE_ROWS(
+                    p_tree->search_between(ordered_float(key_begin.float_value), ordered_float(key_end.float_value)));
+        }
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            return INDEX_TRACE_ROWS(p_part->search_between(key_begin.var_char, key_end.var_char));
+        } else if (char_frozen.count(index_name)) {
+            return INDEX_TRACE_ROWS(char_frozen[index_name]->search_between(key_begin.var_char, key_end.var_char));
+        } else if (char_buffer.count(index_name)) {
+            return INDEX_TRACE_ROWS(char_buffer[index_name]->search_between(*char_tree[index_name], key_begin.var_char,
+                                                                            key_end.var_char));
+        } else {
+            auto p_tree = char_tree[index_name];
+            return INDEX_TRACE_ROWS(p_tree->search_between(key_begin.var_char, key_end.var_char));
+        }
+    }
+}
+
+offset_bitmap IndexManager::search_between_bitmap(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                                  const IndexManager::dtype &key_end) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    offset_bitmap result;
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type)
+        throw TypeDisaccord();
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            p_part->search_between(key_begin.int_value, key_end.int_value, result);
+        else
+            int_tree[index_name]->search_between(key_begin.int_value, key_end.int_value, result);
+    } else if (data_type == type_float) {
+        uint32_t begin = ordered_float(key_begin.float_value), end = ordered_float(key_end.float_value);
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            p_part->search_between(begin, end, result);
+        else
+            float_tree[index_name]->search_between(begin, end, result);
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            p_part->search_between(key_begin.var_char, key_end.var_char, result);
+        else
+            char_tree[index_name]->search_between(key_begin.var_char, key_end.var_char, result);
+    }
+    return INDEX_TRACE_ROWS(result);
+}
+
+std::vector<offset> IndexManager::search_between_parallel(const std::string &index_name,
+                                                          const IndexManager::dtype &key_begin,
+                                                          const IndexManager::dtype &key_end) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type)
+        throw TypeDisaccord();
+    // Partitioned indexes are scanned from several threads, see
+    // create_partitioned_index, so the pool is published atomically.
+    std::shared_ptr<ThreadPool> pool_ptr = std::atomic_load(&scan_pool);
+    if (!pool_ptr) {
+        std::shared_ptr<ThreadPool> created(new ThreadPool());
+        if (std::atomic_compare_exchange_strong(&scan_pool, &pool_ptr, created))
+            pool_ptr = created;
+    }
+    ThreadPool &pool = *pool_ptr;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_between_parallel(key_begin.int_value, key_end.int_value, pool));
+        return INDEX_TRACE_ROWS(
+                int_tree[index_name]->search_between_parallel(key_begin.int_value, key_end.int_value, pool));
+    } else if (data_type == type_float) {
+        uint32_t begin = ordered_float(key_begin.float_value), end = ordered_float(key_end.float_value);
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_between_parallel(begin, end, pool));
+        return INDEX_TRACE_ROWS(float_tree[index_name]->search_between_parallel(begin, end, pool));
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return INDEX_TRACE_ROWS(p_part->search_between_parallel(key_begin.var_char, key_end.var_char, pool));
+        return INDEX_TRACE_ROWS(
+                char_tree[index_name]->search_between_parallel(key_begin.var_char, key_end.var_char, pool));
+    }
+}
+
+void IndexManager::batch_insert(const std::string &index_name, const std::vector<IndexManager::dtype> &keys,
+                                const std::vector<offset> &values) {
+    INDEX_TRACE_SCOPE(trace_batch_insert, index_name, keys.empty() ? nullptr : &keys.front(),
+                      keys.empty() ? nullptr : &keys.back(), keys.size());
+    if (keys.size() != values.size()) {
+        throw BatchSizeNotEqual();
+    }
+    // Partitioned index insert shards in parallel.
+    auto it = type_reminder.find(index_name);
+    if (it != type_reminder.end() && (int_part_tree.count(index_name) || float_part_tree.count(index_name) ||
+                                      char_part_tree.count(index_name))) {
+        auto data_type = it->second;
+        std::vector<int> int_keys;
+        std::vector<uint32_t> float_keys;
+        std::vector<m_string> char_keys;
+        for (auto &key : keys) {
+            if (key.type_indicator != data_type) {
+                throw TypeDisaccord();
+            }
+            if (data_type == type_int)
+                int_keys.push_back(key.int_value);
+            else if (data_type == type_float)
+                float_keys.push_back(ordered_float(key.float_value));
+            else
+                char_keys.push_back(key.var_char);
+        }
+        if (data_type == type_int) {
+            part_tree_of(int_part_tree, index_name)->batch_insert(int_keys, values);
+        } else if (data_type == type_float) {
+            part_tree_of(float_part_tree, index_name)->batch_insert(float_keys, values);
+        } else {
+            part_tree_of(char_part_tree, index_name)->batch_insert(char_keys, values);
+        }
+        return;
+    }
+    for (int i = 0; i < keys.size(); i++) {
+        insert_index(index_name, keys[i], values[i]);
+    }
+}
+
+unsigned int IndexManager::delete_range(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                        const IndexManager::dtype &key_end) {
+    INDEX_TRACE_SCOPE(trace_delete_index, index_name, &key_begin, &key_end);
+    auto it = find_index(index_name, true);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->delete_range(key_begin.int_value, key_end.int_value);
+        return int_tree[index_name]->delete_range(key_begin.int_value, key_end.int_value);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->delete_range(ordered_float(key_begin.float_value), ordered_float(key_end.float_value));
+        return float_tree[index_name]->delete_range(ordered_float(key_begin.float_value),
+                                                     ordered_float(key_end.float_value));
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->delete_range(key_begin.var_char, key_end.var_char);
+        return char_tree[index_name]->delete_range(key_begin.var_char, key_end.var_char);
+    }
+}
+
+index_stats IndexManager::stats(const std::string &index_name) {
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->stats();
+        return int_tree[index_name]->stats();
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->stats();
+        return float_tree[index_name]->stats();
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->stats();
+        return char_tree[index_name]->stats();
+    }
+}
+
+std::map<std::string, index_stats> IndexManager::all_stats() {
+    std::map<std::string, index_stats> result;
+    for (auto &index : type_reminder) {
+        if (!closed.count(index.first) && !frozen.count(index.first))
+            result[index.first] = stats(index.first);
+    }
+    return result;
+}
+
+void IndexManager::set_relaxed_delete(const std::string &index_name, bool relaxed) {
+    auto it = find_index(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            p_part->set_relaxed_delete(relaxed);
+        else
+            int_tree[index_name]->set_relaxed_delete(relaxed);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            p_part->set_relaxed_delete(relaxed);
+        else
+            float_tree[index_name]->set_relaxed_delete(relaxed);
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            p_part->set_relaxed_delete(relaxed);
+        else
+            char_tree[index_name]->set_relaxed_delete(relaxed);
+    }
+}
+
+unsigned int IndexManager::compact_index(const std::string &index_name, unsigned int budget) {
+    auto it = find_index(index_name);
+    index_bytes.erase(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->compact(budget);
+        return int_tree[index_name]->compact(budget);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->compact(budget);
+        return float_tree[index_name]->compact(budget);
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->compact(budget);
+        return char_tree[index_name]->compact(budget);
+    }
+}
+
+defrag_progress IndexManager::defragment_index(const std::string &index_name, unsigned int budget) {
+    auto it = find_index(index_name);
+    index_bytes.erase(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->defragment(budget);
+        return int_tree[index_name]->defragment(budget);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->defragment(budget);
+        return float_tree[index_name]->defragment(budget);
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->defragment(budget);
+        return char_tree[index_name]->defragment(budget);
+    }
+}
+
+void IndexManager::set_compressed_index(const std::string &index_name, bool compressed) {
+    auto it = find_index(index_name);
+    index_bytes.erase(index_name);
+    if (it->second != type_int) {
+        throw TypeDisaccord();
+    }
+    if (auto p_part = part_tree_of(int_part_tree, index_name))
+        p_part->set_compressed(compressed);
+    else
+        int_tree[index_name]->set_compressed(compressed);
+}
+
+void IndexManager::save_index(const std::string &index_name) {
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    // A closed or frozen index is not changed since it was saved.
+    if (closed.count(index_name) || frozen.count(index_name))
+        return;
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw IndexFileError("Partitioned indexes can not be saved");
+    }
+    flush_buffer(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        int_tree[index_name]->dump_to_disk();
+    } else if (data_type == type_float) {
+        float_tree[index_name]->dump_to_disk();
+    } else {
+        char_tree[index_name]->dump_to_disk();
+    }
+    dirty.erase(index_name);
+}
+
+std::vector<offset> IndexManager::search_between_saved(const std::string &index_name,
+                                                       const IndexManager::dtype &key_begin,
+                                                       const IndexManager::dtype &key_end, unsigned int read_ahead) {
+    INDEX_TRACE_SCOPE(trace_search_between, index_name, &key_begin, &key_end);
+    // The file is read as it is, so a closed index stays closed.
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw IndexFileError("Partitioned indexes can not be saved");
+    }
+    if (!io_pool)
+        io_pool.reset(new ThreadPool(io_thread_num));
+    if (data_type == type_int) {
+        TreeFile<int> file(BPTree<int>::file_name_of(index_name));
+        return INDEX_TRACE_ROWS(file.search_between(key_begin.int_value, key_end.int_value, *io_pool, read_ahead));
+    } else if (data_type == type_float) {
+        TreeFile<uint32_t> file(BPTree<uint32_t>::file_name_of(index_name));
+        return INDEX_TRACE_ROWS(file.search_between(ordered_float(key_begin.float_value),
+                                                    ordered_float(key_end.float_value), *io_pool, read_ahead));
+    } else {
+        TreeFile<m_string> file(BPTree<m_string>::file_name_of(index_name));
+        return INDEX_TRACE_ROWS(file.search_between(key_begin.var_char, key_end.var_char, *io_pool, read_ahead));
+    }
+}
+
+void IndexManager::set_counted_index(const std::string &index_name, bool counted) {
+    auto it = find_index(index_name);
+    index_bytes.erase(index_name);
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            p_part->set_counted(counted);
+        else
+            int_tree[index_name]->set_counted(counted);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            p_part->set_counted(counted);
+        else
+            float_tree[index_name]->set_counted(counted);
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            p_part->set_counted(counted);
+        else
+            char_tree[index_name]->set_counted(counted);
+    }
+}
+
+unsigned int IndexManager::count_between(const std::string &index_name, const IndexManager::dtype &key_begin,
+                                         const IndexManager::dtype &key_end) {
+    auto it = find_index(index_name, false, serves_frozen);
+    auto data_type = it->second;
+    if (key_begin.type_indicator != data_type || key_end.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->count_between(key_begin.int_value, key_end.int_value);
+        if (int_frozen.count(index_name))
+            return int_frozen[index_name]->count_between(key_begin.int_value, key_end.int_value);
+        return int_tree[index_name]->count_between(key_begin.int_value, key_end.int_value);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->count_between(ordered_float(key_begin.float_value), ordered_float(key_end.float_value));
+        if (float_frozen.count(index_name))
+            return float_frozen[index_name]->count_between(ordered_float(key_begin.float_value),
+                                                           ordered_float(key_end.float_value));
+        return float_tree[index_name]->count_between(ordered_float(key_begin.float_value),
+                                                     ordered_float(key_end.float_value));
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->count_between(key_begin.var_char, key_end.var_char);
+        if (char_frozen.count(index_name))
+            return char_frozen[index_name]->count_between(key_begin.var_char, key_end.var_char);
+        return char_tree[index_name]->count_between(key_begin.var_char, key_end.var_char);
+    }
+}
+
+unsigned int IndexManager::rank(const std::string &index_name, const IndexManager::dtype &key) {
+    auto it = find_index(index_name, false, serves_frozen);
+    auto data_type = it->second;
+    if (key.type_indicator != data_type) {
+        throw TypeDisaccord();
+    }
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->rank(key.int_value);
+        if (int_frozen.count(index_name))
+            return int_frozen[index_name]->rank(key.int_value);
+        return int_tree[index_name]->rank(key.int_value);
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            return p_part->rank(ordered_float(key.float_value));
+        if (float_frozen.count(index_name))
+            return float_frozen[index_name]->rank(ordered_float(key.float_value));
+        return float_tree[index_name]->rank(ordered_float(key.float_value));
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->rank(key.var_char);
+        if (char_frozen.count(index_name))
+            return char_frozen[index_name]->rank(key.var_char);
+        return char_tree[index_name]->rank(key.var_char);
+    }
+}
+
+bool IndexManager::key_at_rank(const std::string &index_name, unsigned int rank, IndexManager::dtype &key,
+                               offset &value) {
+    auto it = find_index(index_name, false, serves_frozen);
+    auto data_type = it->second;
+    key.type_indicator = data_type;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            return p_part->key_at_rank(rank, key.int_value, value);
+        if (int_frozen.count(index_name))
+            return int_frozen[index_name]->key_at_rank(rank, key.int_value, value);
+        return int_tree[index_name]->key_at_rank(rank, key.int_value, value);
+    } else if (data_type == type_float) {
+        uint32_t ordered_key = 0;
+        auto p_part = part_tree_of(float_part_tree, index_name);
+        bool found = p_part ? p_part->key_at_rank(rank, ordered_key, value) :
+                     float_frozen.count(index_name) ?
+                     float_frozen[index_name]->key_at_rank(rank, ordered_key, value) :
+                     float_tree[index_name]->key_at_rank(rank, ordered_key, value);
+        key.float_value = float_of_ordered(ordered_key);
+        return found;
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            return p_part->key_at_rank(rank, key.var_char, value);
+        if (char_frozen.count(index_name))
+            return char_frozen[index_name]->key_at_rank(rank, key.var_char, value);
+        return char_tree[index_name]->key_at_rank(rank, key.var_char, value);
+    }
+}
+
+void IndexManager::open_catalog(const std::string &catalog_file) {
+    this->catalog_file = catalog_file;
+    std::ifstream in(catalog_file);
+    if (!in)
+        return;
+    std::string line;
+    if (!std::getline(in, line) || line != "miniSQL catalog 3")
+        throw IndexFileError("Not a catalog file");
+    while (std::getline(in, line)) {
+        if (line.empty())
+            continue;
+        std::istringstream fields(line);
+        catalog_entry entry{};
+        int profile, relaxed, compressed, counted, frozen_flag;
+        size_t included_num;
+        fields >> entry.type_indicator >> profile >> relaxed >> compressed >> counted >> frozen_flag
+               >> entry.root_page >> included_num;
+        std::vector<int> included(included_num);
+        for (auto &column_size : included)
+            fields >> column_size;
+        std::string index_name;
+        fields.get();
+        std::getline(fields, index_name);
+        if ((!fields && !fields.eof()) || index_name.empty())
+            throw IndexFileError("Catalog line can not be read");
+        if (type_reminder.count(index_name))
+            throw DuplicateIndex();
+        entry.profile = static_cast<node_profile>(profile);
+        entry.relaxed = relaxed != 0;
+        entry.compressed = compressed != 0;
+        entry.counted = counted != 0;
+        entry.frozen = frozen_flag != 0;
+        type_reminder[index_name] = entry.type_indicator;
+        if (!included.empty())
+            included_sizes[index_name] = included;
+        closed[index_name] = entry;
+    }
+}
+
+void IndexManager::save_catalog() {
+    if (catalog_file.empty())
+        throw IndexFileError("No catalog is open");
+    std::ostringstream out;
+    out << "miniSQL catalog 3\n";
+    for (auto &index : type_reminder) {
+        const std::string &index_name = index.first;
+        if (int_part_tree.count(index_name) || float_part_tree.count(index_name) ||
+            char_part_tree.count(index_name))
+            continue;
+        catalog_entry entry{};
+        if (closed.count(index_name))
+            entry = closed[index_name];
+        else if (frozen.count(index_name)) {
+            entry = frozen[index_name];
+            entry.frozen = true;
+        } else
+            describe_index(index_name, entry);
+        out << entry.type_indicator << ' ' << entry.profile << ' ' << entry.relaxed << ' ' << entry.compressed << ' '
+            << entry.counted << ' ' << entry.frozen << ' ' << entry.root_page;
+        auto included = included_sizes.find(index_name);
+        out << ' ' << (included == included_sizes.end() ? 0 : included->second.size());
+        if (included != included_sizes.end()) {
+            for (auto column_size : included->second)
+                out << ' ' << column_size;
+        }
+        out << ' ' << index_name << '\n';
+    }
+    // Write a new catalog and rename it over the old one, so that a failed
+    // save leaves the old catalog.
+    std::string temp_file = catalog_file + ".tmp";
+    {
+        std::ofstream file(temp_file, std::ios::trunc);
+        file << out.str();
+        if (!file.flush())
+            throw IndexFileError("Catalog can not be written");
+    }
+    if (std::rename(temp_file.c_str(), catalog_file.c_str()) != 0)
+        throw IndexFileError("Catalog can not be written");
+}
+
+unsigned int IndexManager::close_idle(std::chrono::milliseconds idle) {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::string> idle_names;
+    for (auto &index : type_reminder) {
+        const std::string &index_name = index.first;
+        if (closed.count(index_name) || frozen.count(index_name) || int_part_tree.count(index_name) ||
+            float_part_tree.count(index_name) || char_part_tree.count(index_name))
+            continue;
+        if (now - last_used[index_name] > idle)
+            idle_names.push_back(index_name);
+    }
+    for (auto &index_name : idle_names)
+        close_index(index_name);
+    if (!idle_names.empty() && !catalog_file.empty())
+        save_catalog();
+    return static_cast<unsigned int>(idle_names.size());
+}
+
+void IndexManager::set_memory_budget(size_t budget) {
+    memory_budget = budget;
+    budget_accesses = 0;
+    if (memory_budget > 0)
+        enforce_budget(std::string());
+}
+
+size_t IndexManager::memory_used() {
+    size_t result = 0;
+    for (auto &index : type_reminder) {
+        if (!closed.count(index.first))
+            result += memory_used(index.first);
+    }
+    return result;
+}
+
+size_t IndexManager::memory_used(const std::string &index_name) {
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    if (closed.count(index_name))
+        return 0;
+    auto measured = index_bytes.find(index_name);
+    if (measured != index_bytes.end())
+        return measured->second;
+    size_t bytes;
+    auto data_type = it->second;
+    if (frozen.count(index_name)) {
+        bytes = int_frozen.count(index_name) ? int_frozen[index_name]->memory_bytes()
+                : float_frozen.count(index_name) ? float_frozen[index_name]->memory_bytes()
+                : char_frozen[index_name]->memory_bytes();
+    } else if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name))
+            bytes = p_part->memory_bytes();
+        else
+            bytes = int_tree[index_name]->memory_bytes();
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name))
+            bytes = p_part->memory_bytes();
+        else
+            bytes = float_tree[index_name]->memory_bytes();
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name))
+            bytes = p_part->memory_bytes();
+        else
+            bytes = char_tree[index_name]->memory_bytes();
+    }
+    if (int_buffer.count(index_name))
+        bytes += int_buffer[index_name]->memory_bytes();
+    else if (float_buffer.count(index_name))
+        bytes += float_buffer[index_name]->memory_bytes();
+    else if (char_buffer.count(index_name))
+        bytes += char_buffer[index_name]->memory_bytes();
+    // Writes to partitioned indexes do not reset the cache, see find_index.
+    if (!int_part_tree.count(index_name) && !float_part_tree.count(index_name) && !char_part_tree.count(index_name))
+        index_bytes[index_name] = bytes;
+    return bytes;
+}
+
+void IndexManager::close_index(const std::string &index_name) {
+    catalog_entry entry{};
+    describe_index(index_name, entry);
+    int data_type = type_reminder[index_name];
+    if (data_type == type_int) {
+        delete int_tree[index_name];
+        int_tree.erase(index_name);
+    } else if (data_type == type_float) {
+        delete float_tree[index_name];
+        float_tree.erase(index_name);
+    } else {
+        delete char_tree[index_name];
+        char_tree.erase(index_name);
+    }
+    last_used.erase(index_name);
+    index_bytes.erase(index_name);
+    closed[index_name] = entry;
+}
+
+void IndexManager::enforce_budget(const std::string &keep) {
+    size_t used = memory_used();
+    if (used <= memory_budget)
+        return;
+    // Coldest first.
+    std::vector<std::pair<std::chrono::steady_clock::time_point, std::string>> victims;
+    for (auto &index : type_reminder) {
+        const std::string &index_name = index.first;
+        if (index_name == keep || closed.count(index_name) || frozen.count(index_name) ||
+            int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name))
+            continue;
+        victims.emplace_back(last_used[index_name], index_name);
+    }
+    std::sort(victims.begin(), victims.end());
+    bool closed_any = false;
+    for (auto &victim : victims) {
+        if (used <= memory_budget)
+            break;
+        used -= memory_used(victim.second);
+        close_index(victim.second);
+        closed_any = true;
+    }
+    if (closed_any && !catalog_file.empty())
+        save_catalog();
+}
+
+bool IndexManager::index_open(const std::string &index_name) {
+    if (type_reminder.find(index_name) == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    return closed.count(index_name) == 0;
+}
+
+void IndexManager::freeze_index(const std::string &index_name) {
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    if (frozen.count(index_name) || (closed.count(index_name) && closed[index_name].frozen))
+        return;
+    find_index(index_name);
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw IndexFileError("Partitioned indexes can not be frozen");
+    }
+    catalog_entry entry{};
+    describe_index(index_name, entry);
+    freeze_tree(index_name, entry);
+}
+
+void IndexManager::freeze_tree(const std::string &index_name, const IndexManager::catalog_entry &entry) {
+    if (entry.type_indicator == type_int) {
+        int_frozen[index_name] = new FrozenTree<int>(*int_tree[index_name]);
+        delete int_tree[index_name];
+        int_tree.erase(index_name);
+    } else if (entry.type_indicator == type_float) {
+        float_frozen[index_name] = new FrozenTree<uint32_t>(*float_tree[index_name]);
+        delete float_tree[index_name];
+        float_tree.erase(index_name);
+    } else {
+        char_frozen[index_name] = new FrozenTree<m_string>(*char_tree[index_name]);
+        delete char_tree[index_name];
+        char_tree.erase(index_name);
+    }
+    index_bytes.erase(index_name);
+    frozen[index_name] = entry;
+    frozen[index_name].frozen = false;
+}
+
+void IndexManager::thaw_index(const std::string &index_name) {
+    if (type_reminder.find(index_name) == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    if (closed.count(index_name)) {
+        closed[index_name].frozen = false;
+        return;
+    }
+    if (!frozen.count(index_name))
+        return;
+    delete int_frozen[index_name];
+    delete float_frozen[index_name];
+    delete char_frozen[index_name];
+    int_frozen.erase(index_name);
+    float_frozen.erase(index_name);
+    char_frozen.erase(index_name);
+    index_bytes.erase(index_name);
+    closed[index_name] = frozen[index_name];
+    frozen.erase(index_name);
+}
+
+bool IndexManager::index_frozen(const std::string &index_name) {
+    if (type_reminder.find(index_name) == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    return frozen.count(index_name) != 0 || (closed.count(index_name) && closed[index_name].frozen);
+}
+
+void IndexManager::set_buffered_index(const std::string &index_name, bool buffered, size_t capacity) {
+    auto it = find_index(index_name, true);
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name)) {
+        throw TypeDisaccord("Partitioned indexes can not be buffered");
+    }
+    delete int_buffer[index_name];
+    delete float_buffer[index_name];
+    delete char_buffer[index_name];
+    int_buffer.erase(index_name);
+    float_buffer.erase(index_name);
+    char_buffer.erase(index_name);
+    if (!buffered)
+        return;
+    if (it->second == type_int) {
+        int_buffer[index_name] = new WriteBuffer<int>(capacity);
+    } else if (it->second == type_float) {
+        float_buffer[index_name] = new WriteBuffer<uint32_t>(capacity);
+    } else {
+        char_buffer[index_name] = new WriteBuffer<m_string>(capacity);
+    }
+}
+
+void IndexManager::flush_index(const std::string &index_name) {
+    find_index(index_name, false, serves_frozen);
+}
+
+void IndexManager::flush_buffer(const std::string &index_name, bool invalidate) {
+    // Freezing flushed the buffer, and the tree is gone.
+    if (frozen.count(index_name))
+        return;
+    if (int_buffer.count(index_name)) {
+        int_buffer[index_name]->flush(*int_tree[index_name]);
+        if (invalidate)
+            int_buffer[index_name]->invalidate();
+    } else if (float_buffer.count(index_name)) {
+        float_buffer[index_name]->flush(*float_tree[index_name]);
+        if (invalidate)
+            float_buffer[index_name]->invalidate();
+    } else if (char_buffer.count(index_name)) {
+        char_buffer[index_name]->flush(*char_tree[index_name]);
+        if (invalidate)
+            char_buffer[index_name]->invalidate();
+    }
+}
+
+std::map<std::string, int>::iterator IndexManager::find_index(const std::string &index_name, bool write,
+                                                              unsigned int served) {
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end()) {
+        throw IndexNotExist();
+    }
+    // Partitioned indexes never close nor go to the catalog, so they skip the
+    // bookkeeping below, which would race between threads sharing them.
+    if (int_part_tree.count(index_name) || float_part_tree.count(index_name) || char_part_tree.count(index_name))
+        return it;
+    bool opened = false;
+    if (closed.count(index_name)) {
+        open_index(index_name);
+        opened = true;
+    }
+    if (frozen.count(index_name) && (write || !(served & serves_frozen)))
+        throw IndexFrozen();
+    if (!(served & serves_buffered))
+        flush_buffer(index_name, write);
+    last_used[index_name] = std::chrono::steady_clock::now();
+    if (write) {
+        dirty.insert(index_name);
+        index_bytes.erase(index_name);
+    }
+    if (memory_budget > 0 && (opened || ++budget_accesses >= budget_check_interval)) {
+        budget_accesses = 0;
+        enforce_budget(index_name);
+    }
+    return it;
+}
+
+void IndexManager::open_index(const std::string &index_name) {
+    catalog_entry entry = closed[index_name];
+    if (entry.type_indicator == type_int) {
+        int_tree[index_name] = open_tree<int>(index_name, entry);
+    } else if (entry.type_indicator == type_float) {
+        float_tree[index_name] = open_tree<uint32_t>(index_name, entry);
+    } else {
+        char_tree[index_name] = open_tree<m_string>(index_name, entry);
+    }
+    closed.erase(index_name);
+    if (entry.frozen)
+        freeze_tree(index_name, entry);
+}
+
+void IndexManager::describe_index(const std::string &index_name, IndexManager::catalog_entry &entry) {
+    flush_buffer(index_name);
+    int data_type = type_reminder[index_name];
+    if (data_type == type_int) {
+        describe_tree(int_tree[index_name], index_name, entry);
+    } else if (data_type == type_float) {
+        describe_tree(float_tree[index_name], index_name, entry);
+    } else {
+        describe_tree(char_tree[index_name], index_name, entry);
+    }
+    entry.type_indicator = data_type;
+}
+
+#ifdef INDEX_TRACE
+
+IndexManager::trace_scope::trace_scope(IndexManager &manager, trace_op op, const std::string &index_name,
+                                       const IndexManager::dtype *key_begin, const IndexManager::dtype *key_end,
+                                       uint64_t rows) :
+        manager(manager), op(op), index_name(index_name), key_begin(key_begin), key_end(key_end), row_num(rows),
+        height(0), restructures(0) {
+    // Only pay for probing the tree when slow operations are logged.
+    if (Tracer::instance().slow_threshold() > 0)
+        manager.probe(index_name, height, restructures);
+    start = std::chrono::steady_clock::now();
+}
+
+IndexManager::trace_scope::~trace_scope() {
+    auto latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    Tracer &tracer = Tracer::instance();
+    tracer.local(op).record(latency);
+    uint64_t threshold = tracer.slow_threshold();
+    if (threshold == 0 || latency < threshold)
+        return;
+
+    slow_op record;
+    record.op = op;
+    record.index_name = index_name;
+    record.key_begin = key_begin ? key_text(*key_begin) : "";
+    record.key_end = key_end ? key_text(*key_end) : "";
+    record.latency = latency;
+    record.height = height;
+    record.rows = row_num;
+    unsigned int height_after;
+    uint64_t restructures_after;
+    manager.probe(index_name, height_after, restructures_after);
+    record.restructures = restructures_after >= restructures ? restructures_after - restructures : 0;
+    tracer.log_slow(record);
+}
+
+std::vector<offset> IndexManager::trace_scope::rows(std::vector<offset> result) {
+    row_num = result.size();
+    return result;
+}
+
+offset_bitmap IndexManager::trace_scope::rows(offset_bitmap result) {
+    row_num = result.cardinality();
+    return result;
+}
+
+void IndexManager::probe(const std::string &index_name, unsigned int &height, uint64_t &restructures) {
+    height = 0;
+    restructures = 0;
+    auto it = type_reminder.find(index_name);
+    if (it == type_reminder.end() || closed.count(index_name) || frozen.count(index_name))
+        return;
+    auto data_type = it->second;
+    if (data_type == type_int) {
+        if (auto p_part = part_tree_of(int_part_tree, index_name)) {
+            height = p_part->height();
+            restructures = p_part->restructures();
+        } else {
+            height = int_tree[index_name]->height();
+            restructures = int_tree[index_name]->restructures();
+        }
+    } else if (data_type == type_float) {
+        if (auto p_part = part_tree_of(float_part_tree, index_name)) {
+            height = p_part->height();
+            restructures = p_part->restructures();
+        } else {
+            height = float_tree[index_name]->height();
+            restructures = float_tree[index_name]->restructures();
+        }
+    } else {
+        if (auto p_part = part_tree_of(char_part_tree, index_name)) {
+            height = p_part->height();
+            restructures = p_part->restructures();
+        } else {
+            height = char_tree[index_name]->height();
+            restructures = char_tree[index_name]->restructures();
+        }
+    }
+}
+
+std::string IndexManager::key_text(const IndexManager::dtype &key) {
+    std::ostringstream out;
+    if (key.type_indicator == type_int)
+        out << key.int_value;
+    else if (key.type_indicator == type_float)
+        out << key.float_value;
+    else
+        out << key.var_char;
+    return out.str();
+}
+
+#endif
+
+template<typename T>
+PartitionedBPTree<T> *IndexManager::part_tree_of(const std::map<std::string, PartitionedBPTree<T> *> &trees,
+                                                 const std::string &index_name) {
+    auto found = trees.find(index_name);
+    return found == trees.end() ? nullptr : found->second;
+}
+
+template<typename T>
+BPTree<T> *IndexManager::build_tree(std::string index_name, std::vector<std::pair<T, offset>> &rows) {
+    std::sort(rows.begin(), rows.end(), [](const std::pair<T, offset> &a, const std::pair<T, offset> &b) {
+        return a.first < b.first;
+    });
+    std::vector<T> keys;
+    std::vector<offset> values;
+    keys.reserve(rows.size());
+    values.reserve(rows.size());
+    for (auto &row : rows) {
+        keys.push_back(row.first);
+        values.push_back(row.second);
+    }
+    auto p_tree = new BPTree<T>(index_name);
+    try {
+        p_tree->bulk_load(keys, values);
+    } catch (...) {
+        delete p_tree;
+        throw;
+    }
+    return p_tree;
+}
+
+template<typename T>
+BPTree<T> *IndexManager::open_tree(const std::string &index_name, const IndexManager::catalog_entry &entry) {
+    int payload_size = 0;
+    auto included = included_sizes.find(index_name);
+    if (included != included_sizes.end()) {
+        for (auto column_size : included->second)
+            payload_size += column_size;
+    }
+    std::string name = index_name;
+    auto tree = new BPTree<T>(name, entry.profile, payload_size);
+    // Set before loading, so that the bulk load builds counts and packs leaves.
+    tree->set_relaxed_delete(entry.relaxed);
+    tree->set_counted(entry.counted);
+    if (entry.compressed)
+        tree->set_compressed(true);
+    try {
+        tree->load_all_node();
+    } catch (...) {
+        delete tree;
+        throw;
+    }
+    return tree;
+}
+
+template<typename T>
+void IndexManager::describe_tree(BPTree<T> *tree, const std::string &index_name,
+                                 IndexManager::catalog_entry &entry) {
+    if (dirty.count(index_name)) {
+        tree->dump_to_disk();
+        dirty.erase(index_name);
+    }
+    entry.profile = tree->profile();
+    entry.relaxed = tree->relaxed_delete();
+    entry.compressed = tree->compressed_leaves();
+    entry.counted = tree->counted_tree();
+    entry.root_page = TreeFile<T>(tree->file_name()).root_page();
+}
+
+void IndexManager::batch_create_index(const std::vector<std::string> &index_names,
+                                      const std::vector<int> &type_indicators,
+                                      const std::vector<std::vector<IndexManager::dtype>> &columns,
+                                      const std::vector<offset> &values, unsigned int thread_num) {
+    if (index_names.size() != type_indicators.size() || index_names.size() != columns.size()) {
+        throw BatchSizeNotEqual();
+    }
+    // Check everything before building, so that a failure leaves no index behind.
+    for (size_t i = 0; i < index_names.size(); i++) {
+        if (type_reminder.find(index_names[i]) != type_reminder.end() ||
+            std::count(index_names.begin(), index_names.end(), index_names[i]) > 1) {
+            throw DuplicateIndex();
+        }
+        if (columns[i].size() != values.size()) {
+            throw BatchSizeNotEqual();
+        }
+        for (auto &key : columns[i]) {
+            if (key.type_indicator != type_indicators[i]) {
+                throw TypeDisaccord();
+            }
+        }
+    }
+
+    size_t index_num = index_names.size();
+    std::vector<BPTree<int> *> int_built(index_num, nullptr);
+    std::vector<BPTree<uint32_t> *> float_built(index_num, nullptr);
+    std::vector<BPTree<m_string> *> char_built(index_num, nullptr);
+    std::vector<std::future<void>> jobs;
+    {
+        ThreadPool pool(thread_num == 0 ? 0 : std::min(thread_num, static_cast<unsigned int>(index_num)));
+        for (size_t i = 0; i < index_num; i++) {
+            jobs.push_back(pool.submit([&, i]() {
+                const std::vector<dtype> &column = columns[i];
+                if (type_indicators[i] == type_int) {
+                    std::vector<std::pair<int, offset>> rows;
+                    rows.reserve(column.size());
+                    for (size_t j = 0; j < column.size(); j++)
+                        rows.emplace_back(column[j].int_value, values[j]);
+                    int_built[i] = build_tree(index_names[i], rows);
+                } else if (type_indicators[i] == type_float) {
+                    std::vector<std::pair<uint32_t, offset>> rows;
+                    rows.reserve(column.size());
+                    for (size_t j = 0; j < column.size(); j++)
+                        rows.emplace_back(ordered_float(column[j].float_value), values[j]);
+                    float_built[i] = build_tree(index_names[i], rows);
+                } else {
+                    std::vector<std::pair<m_string, offset>> rows;
+                    rows.reserve(column.size());
+                    for (size_t j = 0; j < column.size(); j++)
+                        rows.emplace_back(column[j].var_char, values[j]);
+                    char_built[i] = build_tree(index_names[i], rows);
+                }
+            }));
+        }
+    }
+
+    std::exception_ptr error;
+    for (auto &job : jobs) {
+        try {
+            job.get();
+        } catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error) {
+        for (size_t i = 0; i < index_num; i++) {
+            delete int_built[i];
+            delete float_built[i];
+            delete char_built[i];
+        }
+        std::rethrow_exception(error);
+    }
+
+    for (size_t i = 0; i < index_num; i++) {
+        type_reminder[index_names[i]] = type_indicators[i];
+        dirty.insert(index_names[i]);
+        last_used[index_names[i]] = std::chrono::steady_clock::now();
+        if (type_indicators[i] == type_int) {
+            int_tree[index_names[i]] = int_built[i];
+        } else if (type_indicators[i] == type_float) {
+            float_tree[index_names[i]] = float_built[i];
+        } else {
+            char_tree[index_names[i]] = char_built[i];
+        }
     }
 }
 
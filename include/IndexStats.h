@@ -0,0 +1,87 @@
+#ifndef MINISQL_INDEXSTATS_H
+#define MINISQL_INDEXSTATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Snapshot of the shape of an index and of the operations run on it.
+struct index_stats {
+    // Number of keys.
+    unsigned int key_num = 0;
+    // Number of levels, 1 for a single leaf.
+    unsigned int height = 0;
+    unsigned int node_num = 0;
+    unsigned int leaf_num = 0;
+    // Number of nodes on each level, root level first.
+    std::vector<unsigned int> level_nodes;
+    // Number of keys all leaves together can hold.
+    uint64_t leaf_capacity = 0;
+    // Keys stored in leaves over leaf_capacity.
+    double leaf_fill = 0;
+    // Bytes held by nodes, including key, value and child storage.
+    size_t bytes_used = 0;
+
+    // Operations since the index was created.
+    uint64_t lookups = 0;
+    uint64_t inserts = 0;
+    uint64_t deletes = 0;
+    uint64_t splits = 0;
+    uint64_t merges = 0;
+    uint64_t borrows = 0;
+    uint64_t scans = 0;
+    // Keys visited by scans.
+    uint64_t scanned_keys = 0;
+
+    // Add the numbers of another tree, e.g. another shard of the same index.
+    void accumulate(const index_stats &other);
+};
+
+inline void index_stats::accumulate(const index_stats &other) {
+    key_num += other.key_num;
+    height = height > other.height ? height : other.height;
+    node_num += other.node_num;
+    leaf_num += other.leaf_num;
+    // Align levels by their distance to the leaves.
+    if (level_nodes.size() < other.level_nodes.size())
+        level_nodes.insert(level_nodes.begin(), other.level_nodes.size() - level_nodes.size(), 0);
+    size_t shift = level_nodes.size() - other.level_nodes.size();
+    for (size_t i = 0; i < other.level_nodes.size(); i++)
+        level_nodes[shift + i] += other.level_nodes[i];
+    leaf_capacity += other.leaf_capacity;
+    leaf_fill = leaf_capacity == 0 ? 0 : static_cast<double>(key_num) / leaf_capacity;
+    bytes_used += other.bytes_used;
+    lookups += other.lookups;
+    inserts += other.inserts;
+    deletes += other.deletes;
+    splits += other.splits;
+    merges += other.merges;
+    borrows += other.borrows;
+    scans += other.scans;
+    scanned_keys += other.scanned_keys;
+}
+
+// Progress of an online defragmentation pass over the leaves of an index.
+struct defrag_progress {
+    // Leaves rewritten and leaves freed by the call.
+    unsigned int rewritten = 0;
+    unsigned int freed = 0;
+    // Keys rewritten since the pass started, out of key_num.
+    uint64_t pass_keys = 0;
+    uint64_t key_num = 0;
+    // The pass reached the last leaf, the next call starts a new one.
+    bool finished = true;
+
+    // Add the progress of another tree, e.g. another shard of the same index.
+    void accumulate(const defrag_progress &other);
+};
+
+inline void defrag_progress::accumulate(const defrag_progress &other) {
+    rewritten += other.rewritten;
+    freed += other.freed;
+    pass_keys += other.pass_keys;
+    key_num += other.key_num;
+    finished = finished && other.finished;
+}
+
+#endif //MINISQL_INDEXSTATS_H
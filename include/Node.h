@@ -6,6 +6,7 @@
 #define MINISQL_NODE_H
 
 #include "exceptions.h"
+#include "PackedLeaf.h"
 #include <string>
 #include <iostream>
 #include <vector>
@@ -16,10 +17,93 @@
 
 typedef int offset;
 
+// One step of a binary search over keys[0, n): move pos past the next Step
+// keys if they are all less than key.
+// Step is a compile-time constant, so every search is a fixed sequence of
+// compares without loop, and the compares compile to conditional moves.
+template<int Step>
+struct search_step {
+    template<typename K>
+    static void run(const K *keys, int n, const K &key, int &pos) {
+        if (pos + Step <= n && keys[pos + Step - 1] < key)
+            pos += Step;
+        search_step<Step / 2>::run(keys, n, key, pos);
+    }
+};
+
+template<>
+struct search_step<0> {
+    template<typename K>
+    static void run(const K *, int, const K &, int &) {}
+};
+
+// @return: number of keys in keys[0, n) less than key, n < 1 << Bits.
+template<int Bits, typename K>
+int lower_bound_keys(const K *keys, int n, const K &key) {
+    int pos = 0;
+    search_step<(1 << Bits) / 2>::run(keys, n, key, pos);
+    return pos;
+}
+
+// Only leaves of int keys can be packed, for other keys these do nothing.
+template<typename K>
+PackedLeaf *pack_entries(const std::vector<K> &, const std::vector<int> &, int) {
+    return nullptr;
+}
+
+inline PackedLeaf *pack_entries(const std::vector<int> &keys, const std::vector<int> &values, int num) {
+    return new PackedLeaf(keys.data(), values.data(), num);
+}
+
+template<typename K>
+void unpack_entries(const PackedLeaf &, std::vector<K> &, std::vector<int> &) {}
+
+inline void unpack_entries(const PackedLeaf &leaf, std::vector<int> &keys, std::vector<int> &values) {
+    leaf.decode(0, leaf.size(), keys.data(), values.data());
+}
+
+template<typename K>
+K packed_key(const PackedLeaf &, int) {
+    return K();
+}
+
+template<>
+inline int packed_key<int>(const PackedLeaf &leaf, int i) {
+    return leaf.key(i);
+}
+
+template<typename K>
+bool packed_find(const PackedLeaf &, const K &, int &) {
+    return false;
+}
+
+inline bool packed_find(const PackedLeaf &leaf, int key, int &index) {
+    return leaf.find(key, index);
+}
+
+template<typename K>
+bool packed_range(const PackedLeaf &, int, const K &, std::vector<int> &) {
+    return false;
+}
+
+inline bool packed_range(const PackedLeaf &leaf, int start_index, int terminate_key, std::vector<int> &results) {
+    // Find where the range ends, then decode all its values at once.
+    int end_index;
+    if (leaf.find(terminate_key, end_index))
+        end_index++;
+    end_index = std::max(end_index, start_index);
+    size_t old_size = results.size();
+    results.resize(old_size + end_index - start_index);
+    leaf.decode(start_index, end_index, nullptr, results.data() + old_size);
+    return end_index < leaf.size();
+}
+
 template<typename T>
 class Node {
 private:
     int min_node_num;
+    // Bits of the largest key number, which selects the search kernel.
+    int search_bits;
 public:
     // Indicator of node attributes.
     bool is_leaf;
@@ -27,26 +111,35 @@ public:
     int degree;
     // Number of keys stored in this node.
     int key_num;
-    // Pointer to its father
-    Node *father;
     // child pointer. Only used in internal node.
     std::vector<Node *> child;
+    // Number of entries under each child. Only used in internal nodes of
+    // counted trees, empty otherwise.
+    std::vector<unsigned int> counts;
     // Values's vector. Only used in leaf node.
     std::vector<int> values;
+    // Bytes of included columns stored with each value.
+    int payload_size;
+    // Included columns of each entry, payload_size bytes each. Only used in
+    // leaves of covering indexes, empty otherwise. Kept as is when packed.
+    std::vector<char> payloads;
     // Pointer to next lead node. Only used in leaf node.
     Node *sibling;
+    // Pointer to previous leaf node. Only used in leaf node.
+    Node *prev;
     // Keys in this node
     std::vector<T> keys;
+    // Entries of a packed leaf, nullptr if not packed.
+    // keys, values and child are released while packed.
+    PackedLeaf *packed;
 
 public:
-    explicit Node(int in_degree, bool is_leaf_node = false);
+    // @payload_size: bytes of included columns stored with each value.
+    explicit Node(int in_degree, bool is_leaf_node = false, int payload_size = 0);
 
     // Constructor
     ~Node();
 
-    //
-    bool is_root();
-
     // Find keys
     //Input:
     //  @key: key to find
@@ -62,21 +155,45 @@ public:
     // @key:
     Node *split_node(T &key);
 
+    // Split Node into two nodes, keeping left_num keys in this node.
+    // @key: key to insert into father.
+    // @left_num: number of keys left in this node.
+    Node *split_node(T &key, int left_num);
+
     // Insert into internal node.
     // @key: key to insert
     // @return: the offset to insert the key.
     int insert_key(const T &key);
 
+    // Insert into internal node at a known place.
+    // @index: index of key, right becomes child index + 1.
+    void insert_child(int index, const T &key, Node *right);
+
     // Insert into leaf node
     // @key: key to insert.
     // @val: value to insert.
-    int insert_key(const T &key, const int &val);
+    // @payload: included columns to store with val, nullptr for zeros.
+    int insert_key(const T &key, const int &val, const char *payload = nullptr);
+
+    // Merge keys into a leaf in one pass, included columns of new keys are
+    // zeros.
+    // @keys: num keys in ascending order, none of them in this leaf, and
+    //  key_num + num at most degree.
+    void merge_keys(const T *keys, const int *values, int num);
+
+    // @return: included columns of entry i of a leaf, nullptr if none.
+    char *payload_at(int i);
+
+    const char *payload_at(int i) const;
 
     // Delete the key with value of @value
     // @value value to delete associate with key.
     // @retrun true if success
     bool delete_key_start_by(int start_index);
 
+    // Delete num keys of a leaf from start_index on.
+    void delete_keys(int start_index, int num);
+
     // @return: return the pointer Node* sbling
     Node *get_sibling_node();
 
@@ -93,17 +210,48 @@ public:
     // @return true if successfully find elements
     bool find_greater_than(int start_index, std::vector<int> &values);
 
+    // Append values of keys [start_index, end_index) of a leaf.
+    void copy_values(int start_index, int end_index, std::vector<int> &values) const;
+
+    // @return: bytes held by this node and its containers.
+    size_t memory_size() const;
+
+    // @return: number of keys less than key, keys must not be packed.
+    int search_keys(const T &key) const;
+
+    // Replace keys and values of a leaf with a packed copy.
+    // Searches read packed leaves in place, anything else must unpack first.
+    // @return: true if packed, false for internal nodes and key types that
+    //  can not be packed.
+    bool pack();
+
+    // Restore keys and values of a packed leaf.
+    void unpack();
+
+    bool is_packed() const;
+
+    // @return: i-th key, packed or not.
+    T key_at(int i) const;
+
+    // @return: i-th value, packed or not.
+    int value_at(int i) const;
+
     void print_node();
 };
 
 template<class T>
-Node<T>::Node(int in_degree, bool is_leaf_node):
+Node<T>::Node(int in_degree, bool is_leaf_node, int payload_size):
         key_num(0),
-        father(NULL),
+        payload_size(is_leaf_node ? payload_size : 0),
         sibling(NULL),
+        prev(NULL),
+        packed(nullptr),
         is_leaf(is_leaf_node),
         degree(in_degree) {
     min_node_num = (degree - 1) / 2;
+    search_bits = 1;
+    while ((1 << search_bits) <= degree)
+        search_bits++;
     for (unsigned i = 0; i < degree + 1; i++) {
         child.push_back(NULL);
         keys.push_back(T());
@@ -111,16 +259,13 @@ Node<T>::Node(int in_degree, bool is_leaf_node):
     }
 
     child.push_back(NULL);
+    if (this->payload_size > 0)
+        payloads.assign(static_cast<size_t>(degree + 1) * this->payload_size, 0);
 }
 
-// Default de-constructor
-template<class T>
-Node<T>::~Node() = default;
-
-// To check if is a leaf node.
 template<class T>
-bool Node<T>::is_root() {
-    return father == nullptr;
+Node<T>::~Node() {
+    delete packed;
 }
 
 // Find keys
@@ -136,6 +281,8 @@ bool Node<T>::find_by_key(const T &key, int &value) {
         // This is an empty node.
         value = 0;
         return false;
+    } else if (packed) {
+        return packed_find(*packed, key, value);
     } else {
         // key is nor in this node since it is greater than the last key
         // in this node.
@@ -148,67 +295,110 @@ bool Node<T>::find_by_key(const T &key, int &value) {
             value = 0;
             return false;
         } else {
-            // scan all the value to find the key.
-            for (int i = 0; i < key_num; i++) {
-                if (keys[i] == key) {
-                    value = i;
-                    return true;
-                } else if (keys[i] < key)
-                    continue;
-                else if (keys[i] > key) {
-                    value = i;
-                    return false;
-                }
-            }
+            // keys[key_num - 1] >= key, so value < key_num.
+            value = search_keys(key);
+            return keys[value] == key;
         }
     }
 
     return false;
 }
 
+template<class T>
+int Node<T>::search_keys(const T &key) const {
+    // One kernel for each node size, so each profile of tree runs a search
+    // unrolled for its own degree.
+    const T *data = keys.data();
+    switch (search_bits) {
+        case 1:
+        case 2:
+        case 3:
+            return lower_bound_keys<3>(data, key_num, key);
+        case 4:
+            return lower_bound_keys<4>(data, key_num, key);
+        case 5:
+            return lower_bound_keys<5>(data, key_num, key);
+        case 6:
+            return lower_bound_keys<6>(data, key_num, key);
+        case 7:
+            return lower_bound_keys<7>(data, key_num, key);
+        case 8:
+            return lower_bound_keys<8>(data, key_num, key);
+        case 9:
+            return lower_bound_keys<9>(data, key_num, key);
+        case 10:
+            return lower_bound_keys<10>(data, key_num, key);
+        case 11:
+            return lower_bound_keys<11>(data, key_num, key);
+        case 12:
+            return lower_bound_keys<12>(data, key_num, key);
+        case 13:
+            return lower_bound_keys<13>(data, key_num, key);
+        case 14:
+            return lower_bound_keys<14>(data, key_num, key);
+        default:
+            return static_cast<int>(std::lower_bound(data, data + key_num, key) - data);
+    }
+}
+
 template<class T>
 Node<T> *Node<T>::split_node(T &key) {
-    auto *new_node = new Node(degree, this->is_leaf);
+    return split_node(key, is_leaf ? min_node_num + 1 : min_node_num);
+}
+
+template<class T>
+Node<T> *Node<T>::split_node(T &key, int left_num) {
+    auto *new_node = new Node(degree, this->is_leaf, payload_size);
 
     // When is leaf node, operate on value.
     if (is_leaf) {
-        key = keys[min_node_num + 1];
+        key = keys[left_num];
         // Copy keys:values to new node.
-        for (int i = min_node_num + 1; i < degree; i++) {
-            new_node->keys[i - min_node_num - 1] = keys[i];
+        for (int i = left_num; i < degree; i++) {
+            new_node->keys[i - left_num] = keys[i];
             keys[i] = T();
-            new_node->values[i - min_node_num - 1] = values[i];
+            new_node->values[i - left_num] = values[i];
             values[i] = int();
         }
-        // Update sibling and father pointers
+        if (payload_size > 0) {
+            std::copy(payload_at(left_num), payload_at(degree), new_node->payload_at(0));
+            std::fill(payload_at(left_num), payload_at(degree), 0);
+        }
+        // Update sibling pointers
         new_node->sibling = this->sibling;
+        if (new_node->sibling)
+            new_node->sibling->prev = new_node;
         this->sibling = new_node;
-        new_node->father = this->father;
+        new_node->prev = this;
 
         // Adjust key number.
-        new_node->key_num = min_node_num;
-        this->key_num = min_node_num + 1;
+        new_node->key_num = degree - left_num;
+        this->key_num = left_num;
     } else if (!is_leaf) {
         // for internal node, do not operate on value
-        key = keys[min_node_num];
+        key = keys[left_num];
         // copy keys to new node
-        for (int i = min_node_num + 1; i < degree + 1; i++) {
-            new_node->child[i - min_node_num - 1] = this->child[i];
-            new_node->child[i - min_node_num - 1]->father = new_node;
+        for (int i = left_num + 1; i < degree + 1; i++) {
+            new_node->child[i - left_num - 1] = this->child[i];
             this->child[i] = NULL;
         }
+        if (!counts.empty()) {
+            new_node->counts.assign(degree + 2, 0);
+            for (int i = left_num + 1; i < degree + 1; i++) {
+                new_node->counts[i - left_num - 1] = counts[i];
+                counts[i] = 0;
+            }
+        }
         // Copy value to new node.
-        for (int i = min_node_num + 1; i < degree; i++) {
-            new_node->keys[i - min_node_num - 1] = this->keys[i];
+        for (int i = left_num + 1; i < degree; i++) {
+            new_node->keys[i - left_num - 1] = this->keys[i];
             this->keys[i] = T();
         }
-        // Update father pointer
-        this->keys[min_node_num] = T();
-        new_node->father = this->father;
+        this->keys[left_num] = T();
 
         // Adjust key_num of each node.
-        new_node->key_num = min_node_num;
-        this->key_num = min_node_num;
+        new_node->key_num = degree - left_num - 1;
+        this->key_num = left_num;
     }
 
     return new_node;
@@ -229,13 +419,11 @@ int Node<T>::insert_key(const T &key) {
             throw DuplicateKey();
         } else {
             // Insert key into keys
-            for (int i = key_num; i > index; i--)
-                keys[i] = keys[i - 1];
+            std::copy_backward(keys.begin() + index, keys.begin() + key_num, keys.begin() + key_num + 1);
             keys[index] = key;
 
             //Adjust pointers
-            for (int i = key_num + 1; i > index + 1; i--)
-                child[i] = child[i - 1];
+            std::copy_backward(child.begin() + index + 1, child.begin() + key_num + 1, child.begin() + key_num + 2);
             child[index + 1] = NULL;
             // Key number increment
             key_num++;
@@ -249,35 +437,75 @@ int Node<T>::insert_key(const T &key) {
 
 
 template<class T>
-int Node<T>::insert_key(const T &key, const int &val) {
+void Node<T>::insert_child(int index, const T &key, Node *right) {
+    std::copy_backward(keys.begin() + index, keys.begin() + key_num, keys.begin() + key_num + 1);
+    keys[index] = key;
+    std::copy_backward(child.begin() + index + 1, child.begin() + key_num + 1, child.begin() + key_num + 2);
+    child[index + 1] = right;
+    if (!counts.empty()) {
+        std::copy_backward(counts.begin() + index + 1, counts.begin() + key_num + 1, counts.begin() + key_num + 2);
+        counts[index + 1] = 0;
+    }
+    key_num++;
+}
+
+
+template<class T>
+void Node<T>::merge_keys(const T *new_keys, const int *new_values, int num) {
+    // Fill from the back, so that no entry moves twice.
+    int i = key_num - 1, j = num - 1;
+    for (int k = key_num + num - 1; j >= 0; k--) {
+        if (i >= 0 && new_keys[j] < keys[i]) {
+            keys[k] = keys[i];
+            values[k] = values[i];
+            if (payload_size > 0)
+                std::copy(payload_at(i), payload_at(i + 1), payload_at(k));
+            i--;
+        } else {
+            keys[k] = new_keys[j];
+            values[k] = new_values[j];
+            if (payload_size > 0)
+                std::fill(payload_at(k), payload_at(k + 1), 0);
+            j--;
+        }
+    }
+    key_num += num;
+}
+
+template<class T>
+int Node<T>::insert_key(const T &key, const int &val, const char *payload) {
     if (!is_leaf) {
         throw BPTreeInnerException("This method is not allowed to be visted by internal nodes.");
         return -1;
     }
 
+    int index = 0;
     // Empty node:
     if (key_num == 0) {
         keys[0] = key;
         values[0] = val;
-        key_num++;
-        return 0;
     } else {
-        int index = 0;
         bool exist = find_by_key(key, index);
         if (exist) {
             throw DuplicateKey();
         } else {
             // Adjust key & values.
-            for (int i = key_num; i > index; i--) {
-                keys[i] = keys[i - 1];
-                values[i] = values[i - 1];
-            }
+            std::copy_backward(keys.begin() + index, keys.begin() + key_num, keys.begin() + key_num + 1);
+            std::copy_backward(values.begin() + index, values.begin() + key_num, values.begin() + key_num + 1);
+            if (payload_size > 0)
+                std::copy_backward(payload_at(index), payload_at(key_num), payload_at(key_num + 1));
             keys[index] = key;
             values[index] = val;
-            key_num++;
-            return index;
         }
     }
+    if (payload_size > 0) {
+        if (payload)
+            std::copy(payload, payload + payload_size, payload_at(index));
+        else
+            std::fill(payload_at(index), payload_at(index + 1), 0);
+    }
+    key_num++;
+    return index;
 
     return 0;
 }
@@ -289,22 +517,30 @@ bool Node<T>::delete_key_start_by(int start_index) {
     } else {
         if (is_leaf) {
             // For leaf node also move values
-            for (int i = start_index; i < key_num - 1; i++) {
-                keys[i] = keys[i + 1];
-                values[i] = values[i + 1];
+            if (start_index < key_num) {
+                std::copy(keys.begin() + start_index + 1, keys.begin() + key_num, keys.begin() + start_index);
+                std::copy(values.begin() + start_index + 1, values.begin() + key_num, values.begin() + start_index);
+                if (payload_size > 0)
+                    std::copy(payload_at(start_index + 1), payload_at(key_num), payload_at(start_index));
             }
             keys[key_num - 1] = T();
             values[key_num - 1] = int();
         } else {
             // As for internal node.
-            for (int i = start_index; i < key_num - 1; i++)
-                keys[i] = keys[i + 1];
-            // Update child pointers
-            for (int i = start_index + 1; i < key_num; i++)
-                child[i] = child[i + 1];
+            if (start_index < key_num) {
+                std::copy(keys.begin() + start_index + 1, keys.begin() + key_num, keys.begin() + start_index);
+                // Update child pointers
+                std::copy(child.begin() + start_index + 2, child.begin() + key_num + 1,
+                          child.begin() + start_index + 1);
+                if (!counts.empty())
+                    std::copy(counts.begin() + start_index + 2, counts.begin() + key_num + 1,
+                              counts.begin() + start_index + 1);
+            }
 
             keys[key_num - 1] = T();
             child[key_num] = NULL;
+            if (!counts.empty())
+                counts[key_num] = 0;
         }
 
         key_num--;
@@ -314,6 +550,30 @@ bool Node<T>::delete_key_start_by(int start_index) {
     return false;
 }
 
+template<class T>
+void Node<T>::delete_keys(int start_index, int num) {
+    if (!is_leaf || start_index < 0 || num < 0 || start_index + num > key_num)
+        throw BPTreeInnerException("Keys to delete are out of this leaf");
+    std::copy(keys.begin() + start_index + num, keys.begin() + key_num, keys.begin() + start_index);
+    std::copy(values.begin() + start_index + num, values.begin() + key_num, values.begin() + start_index);
+    if (payload_size > 0)
+        std::copy(payload_at(start_index + num), payload_at(key_num), payload_at(start_index));
+    key_num -= num;
+}
+
+template<class T>
+void Node<T>::copy_values(int start_index, int end_index, std::vector<int> &results) const {
+    if (start_index >= end_index)
+        return;
+    if (packed) {
+        size_t old_size = results.size();
+        results.resize(old_size + end_index - start_index);
+        packed->decode(start_index, end_index, nullptr, results.data() + old_size);
+        return;
+    }
+    results.insert(results.end(), values.begin() + start_index, values.begin() + end_index);
+}
+
 template<class T>
 Node<T> *Node<T>::get_sibling_node() {
     return sibling;
@@ -322,15 +582,23 @@ Node<T> *Node<T>::get_sibling_node() {
 
 template<class T>
 bool Node<T>::find_in_range(int start_index, const T &terminate_key, std::vector<int> &results) {
+    if (packed)
+        return packed_range(*packed, start_index, terminate_key, results);
     int i;
     for (i = start_index; i < key_num && keys[i] <= terminate_key; i++)
         results.push_back(values[i]);
 
-    return !(keys[i] < terminate_key);
+    return i < key_num;
 }
 
 template<class T>
 bool Node<T>::find_greater_than(int start_index, std::vector<int> &results) {
+    if (packed) {
+        size_t old_size = results.size();
+        results.resize(old_size + key_num - start_index);
+        packed->decode(start_index, key_num, nullptr, results.data() + old_size);
+        return false;
+    }
     int i;
     for (i = start_index; i < key_num; i++)
         results.push_back(values[i]);
@@ -338,10 +606,69 @@ bool Node<T>::find_greater_than(int start_index, std::vector<int> &results) {
     return false;
 }
 
+template<class T>
+size_t Node<T>::memory_size() const {
+    return sizeof(Node) + child.capacity() * sizeof(Node *) + values.capacity() * sizeof(int) +
+           keys.capacity() * sizeof(T) + counts.capacity() * sizeof(unsigned int) + payloads.capacity() +
+           (packed ? packed->memory_size() : 0);
+}
+
+template<class T>
+char *Node<T>::payload_at(int i) {
+    return payload_size > 0 ? payloads.data() + static_cast<size_t>(i) * payload_size : nullptr;
+}
+
+template<class T>
+const char *Node<T>::payload_at(int i) const {
+    return payload_size > 0 ? payloads.data() + static_cast<size_t>(i) * payload_size : nullptr;
+}
+
+template<class T>
+bool Node<T>::pack() {
+    if (!is_leaf)
+        return false;
+    if (packed)
+        return true;
+    packed = pack_entries(keys, values, key_num);
+    if (!packed)
+        return false;
+    std::vector<T>().swap(keys);
+    std::vector<int>().swap(values);
+    std::vector<Node *>().swap(child);
+    return true;
+}
+
+template<class T>
+void Node<T>::unpack() {
+    if (!packed)
+        return;
+    keys.assign(degree + 1, T());
+    values.assign(degree + 1, int());
+    child.assign(degree + 2, NULL);
+    unpack_entries(*packed, keys, values);
+    delete packed;
+    packed = nullptr;
+}
+
+template<class T>
+bool Node<T>::is_packed() const {
+    return packed != nullptr;
+}
+
+template<class T>
+T Node<T>::key_at(int i) const {
+    return packed ? packed_key<T>(*packed, i) : keys[i];
+}
+
+template<class T>
+int Node<T>::value_at(int i) const {
+    return packed ? packed->value(i) : values[i];
+}
+
 template<class T>
 void Node<T>::print_node() {
     for (int i = 0; i < key_num; i++)
-        std::cout << "->" << keys[i];
+        std::cout << "->" << key_at(i);
     std::cout << std::endl;
 
 }
@@ -0,0 +1,26 @@
+#ifndef MINISQL_NODEPROFILE_H
+#define MINISQL_NODEPROFILE_H
+
+// Size of the nodes of a tree, chosen per index.
+enum node_profile {
+    // A few cache lines, for hot indexes that stay in memory.
+    profile_cache,
+    // One page.
+    profile_page,
+    // Large nodes, for indexes mostly read by long scans from disk.
+    profile_disk
+};
+
+// @return: bytes of a node of profile.
+inline int node_bytes(node_profile profile) {
+    switch (profile) {
+        case profile_cache:
+            return 256;
+        case profile_disk:
+            return 65536;
+        default:
+            return 4096;
+    }
+}
+
+#endif //MINISQL_NODEPROFILE_H
@@ -0,0 +1,314 @@
+#ifndef MINISQL_OFFSETBITMAP_H
+#define MINISQL_OFFSETBITMAP_H
+
+#include "Node.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Compressed set of offsets for large results. Offsets are split by their
+// high 16 bits into containers, each holding the low 16 bits either in a
+// sorted array while it has at most array_max of them, or in a bitmap of
+// all 65536 otherwise, so dense ranges take a bit per offset and sparse
+// ones two bytes.
+class offset_bitmap {
+public:
+    static const size_t array_max = 4096;
+
+    // Add one offset.
+    void add(offset value);
+
+    // Add offsets in any order, with duplicates. Containers are sorted once
+    // per call, so larger batches cost less per offset.
+    void add_many(const offset *values, size_t num);
+
+    bool contains(offset value) const;
+
+    // @return: number of offsets.
+    size_t cardinality() const;
+
+    bool empty() const;
+
+    offset_bitmap &operator|=(const offset_bitmap &other);
+
+    offset_bitmap &operator&=(const offset_bitmap &other);
+
+    // Call visit on each offset in ascending order.
+    template<class F>
+    void for_each(F visit) const;
+
+    // @return: offsets in ascending order.
+    std::vector<offset> to_vector() const;
+
+    // @return: bytes held by the containers.
+    size_t memory_bytes() const;
+
+private:
+    static const size_t bitmap_words = 65536 / 64;
+
+    struct container {
+        uint16_t high;
+        // Low bits in ascending order, while bits is empty.
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bits;
+        // Array has values appended since it was last sorted.
+        bool pending = false;
+
+        bool is_bitmap() const { return !bits.empty(); }
+
+        size_t cardinality() const;
+
+        void to_bitmap();
+
+        // Turn a bitmap holding at most array_max values back into an array.
+        void shrink();
+
+        // Sort and dedup values appended by add_many.
+        void settle();
+    };
+
+    // Offsets map to unsigned keys in the same order.
+    static uint32_t key_of(offset value) { return static_cast<uint32_t>(value) ^ 0x80000000u; }
+
+    static offset offset_of(uint32_t key) { return static_cast<offset>(key ^ 0x80000000u); }
+
+    // @return: container for high, created if missing.
+    container &locate(uint16_t high, size_t &hint);
+
+    // Append low to a container, turning it into a bitmap when full.
+    static void append(container &c, uint16_t low);
+
+    // Containers in ascending order of high.
+    std::vector<container> containers;
+};
+
+inline size_t offset_bitmap::container::cardinality() const {
+    if (!is_bitmap())
+        return array.size();
+    size_t num = 0;
+    for (auto word : bits)
+        num += __builtin_popcountll(word);
+    return num;
+}
+
+inline void offset_bitmap::container::to_bitmap() {
+    bits.assign(bitmap_words, 0);
+    for (auto low : array)
+        bits[low / 64] |= uint64_t(1) << (low % 64);
+    std::vector<uint16_t>().swap(array);
+    pending = false;
+}
+
+inline void offset_bitmap::container::shrink() {
+    if (!is_bitmap() || cardinality() > array_max)
+        return;
+    array.clear();
+    for (size_t word = 0; word < bits.size(); word++) {
+        for (uint64_t w = bits[word]; w != 0; w &= w - 1)
+            array.push_back(static_cast<uint16_t>(word * 64 + __builtin_ctzll(w)));
+    }
+    std::vector<uint64_t>().swap(bits);
+}
+
+inline void offset_bitmap::container::settle() {
+    if (!pending)
+        return;
+    std::sort(array.begin(), array.end());
+    array.erase(std::unique(array.begin(), array.end()), array.end());
+    pending = false;
+}
+
+inline offset_bitmap::container &offset_bitmap::locate(uint16_t high, size_t &hint) {
+    if (hint < containers.size() && containers[hint].high == high)
+        return containers[hint];
+    auto it = std::lower_bound(containers.begin(), containers.end(), high,
+                               [](const container &c, uint16_t h) { return c.high < h; });
+    if (it == containers.end() || it->high != high) {
+        it = containers.insert(it, container());
+        it->high = high;
+    }
+    hint = static_cast<size_t>(it - containers.begin());
+    return *it;
+}
+
+inline void offset_bitmap::append(container &c, uint16_t low) {
+    if (c.is_bitmap()) {
+        c.bits[low / 64] |= uint64_t(1) << (low % 64);
+        return;
+    }
+    if (!c.array.empty() && c.array.back() >= low)
+        c.pending = true;
+    c.array.push_back(low);
+    if (c.array.size() > array_max)
+        c.to_bitmap();
+}
+
+inline void offset_bitmap::add(offset value) {
+    uint32_t key = key_of(value);
+    size_t hint = containers.size();
+    container &c = locate(static_cast<uint16_t>(key >> 16), hint);
+    auto low = static_cast<uint16_t>(key & 0xffff);
+    if (c.is_bitmap()) {
+        c.bits[low / 64] |= uint64_t(1) << (low % 64);
+        return;
+    }
+    auto it = std::lower_bound(c.array.begin(), c.array.end(), low);
+    if (it != c.array.end() && *it == low)
+        return;
+    c.array.insert(it, low);
+    if (c.array.size() > array_max)
+        c.to_bitmap();
+}
+
+inline void offset_bitmap::add_many(const offset *values, size_t num) {
+    size_t hint = 0;
+    for (size_t i = 0; i < num; i++) {
+        uint32_t key = key_of(values[i]);
+        append(locate(static_cast<uint16_t>(key >> 16), hint), static_cast<uint16_t>(key & 0xffff));
+    }
+    for (auto &c : containers)
+        c.settle();
+}
+
+inline bool offset_bitmap::contains(offset value) const {
+    uint32_t key = key_of(value);
+    auto high = static_cast<uint16_t>(key >> 16);
+    auto low = static_cast<uint16_t>(key & 0xffff);
+    auto it = std::lower_bound(containers.begin(), containers.end(), high,
+                               [](const container &c, uint16_t h) { return c.high < h; });
+    if (it == containers.end() || it->high != high)
+        return false;
+    if (it->is_bitmap())
+        return (it->bits[low / 64] >> (low % 64)) & 1;
+    return std::binary_search(it->array.begin(), it->array.end(), low);
+}
+
+inline size_t offset_bitmap::cardinality() const {
+    size_t num = 0;
+    for (auto &c : containers)
+        num += c.cardinality();
+    return num;
+}
+
+inline bool offset_bitmap::empty() const {
+    return containers.empty();
+}
+
+inline offset_bitmap &offset_bitmap::operator|=(const offset_bitmap &other) {
+    std::vector<container> merged;
+    merged.reserve(containers.size() + other.containers.size());
+    size_t i = 0, j = 0;
+    while (i < containers.size() || j < other.containers.size()) {
+        if (j == other.containers.size() || (i < containers.size() && containers[i].high < other.containers[j].high)) {
+            merged.push_back(std::move(containers[i++]));
+            continue;
+        }
+        if (i == containers.size() || other.containers[j].high < containers[i].high) {
+            merged.push_back(other.containers[j++]);
+            continue;
+        }
+        container c = std::move(containers[i++]);
+        const container &o = other.containers[j++];
+        if (!c.is_bitmap() && !o.is_bitmap() && c.array.size() + o.array.size() <= array_max) {
+            std::vector<uint16_t> united;
+            united.reserve(c.array.size() + o.array.size());
+            std::set_union(c.array.begin(), c.array.end(), o.array.begin(), o.array.end(),
+                           std::back_inserter(united));
+            c.array.swap(united);
+        } else {
+            if (!c.is_bitmap())
+                c.to_bitmap();
+            if (o.is_bitmap()) {
+                for (size_t word = 0; word < bitmap_words; word++)
+                    c.bits[word] |= o.bits[word];
+            } else {
+                for (auto low : o.array)
+                    c.bits[low / 64] |= uint64_t(1) << (low % 64);
+            }
+        }
+        merged.push_back(std::move(c));
+    }
+    containers.swap(merged);
+    return *this;
+}
+
+inline offset_bitmap &offset_bitmap::operator&=(const offset_bitmap &other) {
+    std::vector<container> kept;
+    size_t i = 0, j = 0;
+    while (i < containers.size() && j < other.containers.size()) {
+        if (containers[i].high < other.containers[j].high) {
+            i++;
+            continue;
+        }
+        if (other.containers[j].high < containers[i].high) {
+            j++;
+            continue;
+        }
+        container c = std::move(containers[i++]);
+        const container &o = other.containers[j++];
+        if (c.is_bitmap() && o.is_bitmap()) {
+            for (size_t word = 0; word < bitmap_words; word++)
+                c.bits[word] &= o.bits[word];
+            c.shrink();
+        } else if (c.is_bitmap() || o.is_bitmap()) {
+            const container &array_side = c.is_bitmap() ? o : c;
+            const container &bitmap_side = c.is_bitmap() ? c : o;
+            std::vector<uint16_t> both;
+            for (auto low : array_side.array) {
+                if ((bitmap_side.bits[low / 64] >> (low % 64)) & 1)
+                    both.push_back(low);
+            }
+            c.array.swap(both);
+            std::vector<uint64_t>().swap(c.bits);
+        } else {
+            std::vector<uint16_t> both;
+            std::set_intersection(c.array.begin(), c.array.end(), o.array.begin(), o.array.end(),
+                                  std::back_inserter(both));
+            c.array.swap(both);
+        }
+        if (c.cardinality() != 0)
+            kept.push_back(std::move(c));
+    }
+    containers.swap(kept);
+    return *this;
+}
+
+inline offset_bitmap operator|(offset_bitmap a, const offset_bitmap &b) {
+    return a |= b;
+}
+
+inline offset_bitmap operator&(offset_bitmap a, const offset_bitmap &b) {
+    return a &= b;
+}
+
+template<class F>
+void offset_bitmap::for_each(F visit) const {
+    for (auto &c : containers) {
+        uint32_t base = static_cast<uint32_t>(c.high) << 16;
+        if (!c.is_bitmap()) {
+            for (auto low : c.array)
+                visit(offset_of(base | low));
+            continue;
+        }
+        for (size_t word = 0; word < bitmap_words; word++) {
+            for (uint64_t w = c.bits[word]; w != 0; w &= w - 1)
+                visit(offset_of(base | static_cast<uint32_t>(word * 64 + __builtin_ctzll(w))));
+        }
+    }
+}
+
+inline std::vector<offset> offset_bitmap::to_vector() const {
+    std::vector<offset> result;
+    result.reserve(cardinality());
+    for_each([&result](offset value) { result.push_back(value); });
+    return result;
+}
+
+inline size_t offset_bitmap::memory_bytes() const {
+    size_t bytes = containers.capacity() * sizeof(container);
+    for (auto &c : containers)
+        bytes += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+    return bytes;
+}
+
+#endif //MINISQL_OFFSETBITMAP_H
@@ -0,0 +1,136 @@
+#ifndef MINISQL_OFFSETSET_H
+#define MINISQL_OFFSETSET_H
+
+#include "Node.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Set operations on offsets sorted in ascending order without duplicates,
+// to combine the results of several indexes.
+
+// Sizes at least this far apart intersect by galloping the smaller set
+// through the larger one instead of merging both.
+const size_t gallop_ratio = 32;
+
+// Sets spanning at most this many offsets per element are combined in a
+// bitmap of the span.
+const size_t bitmap_density = 8;
+
+// @return: offsets in both a and b.
+inline std::vector<offset> intersect_offsets(const std::vector<offset> &a, const std::vector<offset> &b) {
+    const std::vector<offset> &small = a.size() <= b.size() ? a : b;
+    const std::vector<offset> &large = a.size() <= b.size() ? b : a;
+    std::vector<offset> result;
+    if (small.empty())
+        return result;
+    if (large.size() / small.size() >= gallop_ratio) {
+        auto low = large.begin();
+        for (auto value : small) {
+            // Double the step until past value, then search the last step.
+            size_t step = 1;
+            auto high = low;
+            while (high != large.end() && *high < value) {
+                low = high;
+                high = static_cast<size_t>(large.end() - high) > step ? high + step : large.end();
+                step *= 2;
+            }
+            low = std::lower_bound(low, high, value);
+            if (low == large.end())
+                break;
+            if (*low == value)
+                result.push_back(value);
+        }
+        return result;
+    }
+    // Advance both sides without branching on which one is smaller.
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        offset x = a[i], y = b[j];
+        if (x == y)
+            result.push_back(x);
+        i += x <= y;
+        j += y <= x;
+    }
+    return result;
+}
+
+// @return: offsets in any of sets.
+inline std::vector<offset> unite_offsets(const std::vector<std::vector<offset>> &sets) {
+    std::vector<offset> result;
+    size_t total = 0;
+    offset low = 0, high = 0;
+    bool first = true;
+    for (auto &set : sets) {
+        if (set.empty())
+            continue;
+        total += set.size();
+        low = first ? set.front() : std::min(low, set.front());
+        high = first ? set.back() : std::max(high, set.back());
+        first = false;
+    }
+    if (total == 0)
+        return result;
+    size_t span = static_cast<size_t>(static_cast<int64_t>(high) - low) + 1;
+    if (span <= total * bitmap_density) {
+        std::vector<uint64_t> bits((span + 63) / 64, 0);
+        for (auto &set : sets) {
+            for (auto value : set) {
+                size_t bit = static_cast<size_t>(static_cast<int64_t>(value) - low);
+                bits[bit / 64] |= uint64_t(1) << (bit % 64);
+            }
+        }
+        result.reserve(total);
+        for (size_t word = 0; word < bits.size(); word++) {
+            for (uint64_t w = bits[word]; w != 0; w &= w - 1)
+                result.push_back(static_cast<offset>(low + static_cast<int64_t>(word * 64 + __builtin_ctzll(w))));
+        }
+        return result;
+    }
+    result.reserve(total);
+    for (auto &set : sets)
+        result.insert(result.end(), set.begin(), set.end());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// Membership test against a set of offsets, for offsets arriving in any
+// order. Dense sets are tested in a bitmap, sparse ones by binary search.
+class offset_filter {
+public:
+    // @sorted: the set, must outlive the filter.
+    explicit offset_filter(const std::vector<offset> &sorted);
+
+    bool contains(offset value) const;
+
+private:
+    const std::vector<offset> &sorted;
+    offset low;
+    std::vector<uint64_t> bits;
+};
+
+inline offset_filter::offset_filter(const std::vector<offset> &sorted) : sorted(sorted), low(0) {
+    if (sorted.empty())
+        return;
+    low = sorted.front();
+    size_t span = static_cast<size_t>(static_cast<int64_t>(sorted.back()) - low) + 1;
+    if (span <= sorted.size() * bitmap_density * 8) {
+        bits.assign((span + 63) / 64, 0);
+        for (auto value : sorted) {
+            size_t bit = static_cast<size_t>(static_cast<int64_t>(value) - low);
+            bits[bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+    }
+}
+
+inline bool offset_filter::contains(offset value) const {
+    if (bits.empty())
+        return std::binary_search(sorted.begin(), sorted.end(), value);
+    if (value < low)
+        return false;
+    size_t bit = static_cast<size_t>(static_cast<int64_t>(value) - low);
+    return bit / 64 < bits.size() && (bits[bit / 64] >> (bit % 64) & 1);
+}
+
+#endif //MINISQL_OFFSETSET_H
@@ -0,0 +1,46 @@
+#ifndef MINISQL_ORDEREDKEY_H
+#define MINISQL_ORDEREDKEY_H
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+// Order preserving encodings of keys. IndexManager stores keys in these forms
+// so that trees compare unsigned integers instead of floats or whole strings.
+
+// @return: bits of value as an unsigned integer in the order of the floats.
+//  -0.0 is stored as 0.0, and every NaN as one NaN ordered after infinity,
+//  so that both can be searched for.
+inline uint32_t ordered_float(float value) {
+    if (value != value)
+        value = std::numeric_limits<float>::quiet_NaN();
+    else if (value == 0)
+        value = 0;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    // Negative floats order backwards, so flip all their bits, and move
+    // positive ones above them.
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+// @return: float of a key made by ordered_float.
+inline float float_of_ordered(uint32_t key) {
+    uint32_t bits = (key & 0x80000000u) ? key & 0x7fffffffu : ~key;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// @return: up to the first 8 chars of a C string as a big endian integer,
+//  zero padded, so that prefixes compare as strcmp compares them.
+inline uint64_t ordered_prefix(const char *str) {
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (*str)
+            prefix |= static_cast<unsigned char>(*str++);
+    }
+    return prefix;
+}
+
+#endif //MINISQL_ORDEREDKEY_H
@@ -0,0 +1,219 @@
+#ifndef MINISQL_PACKEDLEAF_H
+#define MINISQL_PACKEDLEAF_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fields decoded together by unpack_block, so that a block of Width bit
+// fields fills Width words.
+const unsigned int packed_block_fields = 64;
+
+// Decode field Field and the ones after it in a block of Width bit fields,
+// adding base to each. Width and Field are compile-time constants, so every
+// shift and mask is a constant and the block decodes as straight code
+// without loop.
+template<unsigned int Width, unsigned int Field>
+struct unpack_field {
+    static void run(const uint64_t *data, uint32_t base, int *out) {
+        const unsigned int shift = (Field * Width) & 63;
+        uint64_t field = data[Field * Width / 64] >> shift;
+        if (shift + Width > 64)
+            field |= data[Field * Width / 64 + 1] << ((64 - shift) & 63);
+        out[Field] = static_cast<int>(base + static_cast<uint32_t>(field & ((static_cast<uint64_t>(1) << Width) - 1)));
+        unpack_field<Width, Field + 1>::run(data, base, out);
+    }
+};
+
+template<unsigned int Width>
+struct unpack_field<Width, packed_block_fields> {
+    static void run(const uint64_t *, uint32_t, int *) {}
+};
+
+// Decode the packed_block_fields fields of width bits held by width words,
+// with unpack_field of the same Width.
+template<unsigned int Width>
+struct unpack_block {
+    static void run(unsigned int width, const uint64_t *data, uint32_t base, int *out) {
+        if (width == Width)
+            unpack_field<Width, 0>::run(data, base, out);
+        else
+            unpack_block<Width - 1>::run(width, data, base, out);
+    }
+};
+
+template<>
+struct unpack_block<0> {
+    static void run(unsigned int, const uint64_t *, uint32_t base, int *out) {
+        std::fill(out, out + packed_block_fields, static_cast<int>(base));
+    }
+};
+
+// Frame of reference encoding of the entries of an int leaf.
+// Keys are stored as deltas from the first key, values as deltas from the
+// smallest value, each in the least number of bits holding the largest
+// delta. All deltas of a kind have the same width, so entry i is read
+// without decoding the entries before it. Runs of entries decode a block of
+// 64 at a time, see unpack_block, and value deltas start on a word so that
+// their blocks do too.
+class PackedLeaf {
+public:
+    // @keys: keys in ascending order.
+    // @values: value of each key.
+    // @num: number of entries.
+    PackedLeaf(const int *keys, const int *values, int num);
+
+    // @return: number of entries.
+    int size() const;
+
+    int key(int i) const;
+
+    int value(int i) const;
+
+    // Decode entries [begin, end).
+    // @keys: where to store the keys, nullptr to skip them.
+    // @values: where to store the values, nullptr to skip them.
+    void decode(int begin, int end, int *keys, int *values) const;
+
+    // @index: index of key if found, otherwise of the first greater key.
+    // @return: true if key is found.
+    bool find(int key, int &index) const;
+
+    // @return: bytes held by this leaf.
+    size_t memory_size() const;
+
+private:
+    // @return: number of bits needed to store range.
+    static unsigned int bits_of(uint32_t range);
+
+    // Read width bits starting at bit.
+    uint32_t get(uint64_t bit, unsigned int width) const;
+
+    // Write delta into width bits starting at bit.
+    void put(uint64_t bit, unsigned int width, uint32_t delta);
+
+    // Decode fields [begin, end) of an array of width bit fields, whole
+    // blocks with unpack_block.
+    // @start: first bit of the array, on a word.
+    // @base: added to every field.
+    // @out: where to store them.
+    void unpack(uint64_t start, unsigned int width, uint32_t base, int begin, int end, int *out) const;
+
+    int num;
+    int key_base;
+    int value_base;
+    unsigned int key_bits;
+    unsigned int value_bits;
+    // Bit offset of the first value delta.
+    uint64_t value_start;
+    // Key deltas, then value deltas, then a spare word so that a field can
+    // always be read from two adjacent words.
+    std::vector<uint64_t> words;
+};
+
+inline PackedLeaf::PackedLeaf(const int *keys, const int *values, int num) :
+        num(num), key_base(0), value_base(0), key_bits(0), value_bits(0), value_start(0) {
+    if (num > 0) {
+        key_base = keys[0];
+        value_base = values[0];
+        for (int i = 1; i < num; i++) {
+            if (values[i] < value_base)
+                value_base = values[i];
+        }
+        uint32_t value_range = 0;
+        for (int i = 0; i < num; i++) {
+            uint32_t delta = static_cast<uint32_t>(values[i]) - static_cast<uint32_t>(value_base);
+            if (delta > value_range)
+                value_range = delta;
+        }
+        key_bits = bits_of(static_cast<uint32_t>(keys[num - 1]) - static_cast<uint32_t>(key_base));
+        value_bits = bits_of(value_range);
+    }
+    value_start = (static_cast<uint64_t>(num) * key_bits + 63) / 64 * 64;
+    uint64_t bit_num = value_start + static_cast<uint64_t>(num) * value_bits;
+    // A zero width field may start right at bit_num.
+    words.assign(static_cast<size_t>(bit_num / 64 + 2), 0);
+    for (int i = 0; i < num; i++) {
+        put(static_cast<uint64_t>(i) * key_bits, key_bits,
+            static_cast<uint32_t>(keys[i]) - static_cast<uint32_t>(key_base));
+        put(value_start + static_cast<uint64_t>(i) * value_bits, value_bits,
+            static_cast<uint32_t>(values[i]) - static_cast<uint32_t>(value_base));
+    }
+}
+
+inline unsigned int PackedLeaf::bits_of(uint32_t range) {
+    return range == 0 ? 0 : 32 - __builtin_clz(range);
+}
+
+inline uint32_t PackedLeaf::get(uint64_t bit, unsigned int width) const {
+    size_t word = static_cast<size_t>(bit >> 6);
+    unsigned int shift = static_cast<unsigned int>(bit & 63);
+    // Two shifts, as shifting a 64 bit word by 64 is undefined.
+    uint64_t field = (words[word] >> shift) | ((words[word + 1] << 1) << (63 - shift));
+    return static_cast<uint32_t>(field & ((static_cast<uint64_t>(1) << width) - 1));
+}
+
+inline void PackedLeaf::put(uint64_t bit, unsigned int width, uint32_t delta) {
+    if (width == 0)
+        return;
+    size_t word = static_cast<size_t>(bit >> 6);
+    unsigned int shift = static_cast<unsigned int>(bit & 63);
+    words[word] |= static_cast<uint64_t>(delta) << shift;
+    if (shift + width > 64)
+        words[word + 1] |= static_cast<uint64_t>(delta) >> (64 - shift);
+}
+
+inline int PackedLeaf::size() const {
+    return num;
+}
+
+inline int PackedLeaf::key(int i) const {
+    return static_cast<int>(static_cast<uint32_t>(key_base) + get(static_cast<uint64_t>(i) * key_bits, key_bits));
+}
+
+inline int PackedLeaf::value(int i) const {
+    return static_cast<int>(static_cast<uint32_t>(value_base) +
+                            get(value_start + static_cast<uint64_t>(i) * value_bits, value_bits));
+}
+
+inline void PackedLeaf::unpack(uint64_t start, unsigned int width, uint32_t base, int begin, int end,
+                               int *out) const {
+    const int block = static_cast<int>(packed_block_fields);
+    int i = begin;
+    // Up to the first whole block, then whole blocks, then the rest.
+    int first_block = std::min(end, (begin + block - 1) / block * block);
+    for (; i < first_block; i++)
+        out[i - begin] = static_cast<int>(base + get(start + static_cast<uint64_t>(i) * width, width));
+    for (; i + block <= end; i += block)
+        unpack_block<32>::run(width, words.data() + (start + static_cast<uint64_t>(i) * width) / 64, base,
+                              out + (i - begin));
+    for (; i < end; i++)
+        out[i - begin] = static_cast<int>(base + get(start + static_cast<uint64_t>(i) * width, width));
+}
+
+inline void PackedLeaf::decode(int begin, int end, int *keys, int *values) const {
+    if (keys)
+        unpack(0, key_bits, static_cast<uint32_t>(key_base), begin, end, keys);
+    if (values)
+        unpack(value_start, value_bits, static_cast<uint32_t>(value_base), begin, end, values);
+}
+
+inline bool PackedLeaf::find(int key, int &index) const {
+    int low = 0, high = num;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (this->key(middle) < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    index = low;
+    return low < num && this->key(low) == key;
+}
+
+inline size_t PackedLeaf::memory_size() const {
+    return sizeof(PackedLeaf) + words.capacity() * sizeof(uint64_t);
+}
+
+#endif //MINISQL_PACKEDLEAF_H
@@ -0,0 +1,87 @@
+#ifndef MINISQL_PAGEFILE_H
+#define MINISQL_PAGEFILE_H
+
+#include "exceptions.h"
+#include <cstddef>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File of fixed size pages.
+// Pages are read and written with pread and pwrite, which take no file
+// position, so several threads may read pages of one file at once.
+class PageFile {
+public:
+    // @file_name: path of the file.
+    // @page_size: bytes of a page.
+    // @create: create the file, or truncate it if it exists.
+    PageFile(const std::string &file_name, size_t page_size, bool create);
+
+    ~PageFile();
+
+    PageFile(const PageFile &) = delete;
+
+    PageFile &operator=(const PageFile &) = delete;
+
+    size_t page_size() const;
+
+    // @return: number of pages in the file.
+    unsigned int page_num() const;
+
+    // @page: page_size() bytes to store page page_id.
+    void read(unsigned int page_id, char *page) const;
+
+    // @page: page_size() bytes to store as page page_id.
+    void write(unsigned int page_id, const char *page);
+
+private:
+    int fd;
+    size_t m_page_size;
+};
+
+inline PageFile::PageFile(const std::string &file_name, size_t page_size, bool create) : m_page_size(page_size) {
+    fd = create ? open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw IndexFileError("Index file can not be opened");
+}
+
+inline PageFile::~PageFile() {
+    close(fd);
+}
+
+inline size_t PageFile::page_size() const {
+    return m_page_size;
+}
+
+inline unsigned int PageFile::page_num() const {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+        throw IndexFileError();
+    return static_cast<unsigned int>(static_cast<size_t>(file_stat.st_size) / m_page_size);
+}
+
+inline void PageFile::read(unsigned int page_id, char *page) const {
+    auto position = static_cast<off_t>(page_id) * static_cast<off_t>(m_page_size);
+    size_t done = 0;
+    // pread may return less than asked, e.g. when interrupted.
+    while (done < m_page_size) {
+        ssize_t n = pread(fd, page + done, m_page_size - done, position + static_cast<off_t>(done));
+        if (n <= 0)
+            throw IndexFileError("Index page can not be read");
+        done += static_cast<size_t>(n);
+    }
+}
+
+inline void PageFile::write(unsigned int page_id, const char *page) {
+    auto position = static_cast<off_t>(page_id) * static_cast<off_t>(m_page_size);
+    size_t done = 0;
+    while (done < m_page_size) {
+        ssize_t n = pwrite(fd, page + done, m_page_size - done, position + static_cast<off_t>(done));
+        if (n <= 0)
+            throw IndexFileError("Index page can not be written");
+        done += static_cast<size_t>(n);
+    }
+}
+
+#endif //MINISQL_PAGEFILE_H
@@ -0,0 +1,918 @@
+#ifndef MINISQL_PARTITIONEDTREE_H
+#define MINISQL_PARTITIONEDTREE_H
+
+#include "BPTree.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+// Index split into range shards, each one an independent B+ tree.
+// Range r is [bounds[r - 1], bounds[r]) and is owned by shard owners[r].
+// Until bounds are set every key is in shard 0. A batch inserted into an
+// empty index seeds the bounds from its own keys, otherwise they are seeded
+// once seed_keys keys per shard are in, the only time every shard is locked.
+// Afterwards a skewed shard moves one bound at a time: it hands keys to a
+// neighbouring range, or its upper half to a shard owning no range, which
+// merging two small neighbouring ranges frees if needed. Only the two shards
+// involved are locked. Keys appended at the end of the index thus open new
+// ranges instead of being pushed through every shard.
+// Every shard has its own lock. Routing reads an immutable snapshot of the
+// bounds and then checks the epoch of the locked shard, so no lock is shared
+// by all operations.
+template<typename T>
+class PartitionedBPTree {
+public:
+    // @name: name of index.
+    // @shard_num: number of shards, 0 means one per hardware thread.
+    // @profile: size of the nodes of every shard.
+    explicit PartitionedBPTree(const std::string &name, unsigned int shard_num = 0,
+                               node_profile profile = profile_page);
+
+    ~PartitionedBPTree();
+
+    PartitionedBPTree(const PartitionedBPTree &) = delete;
+
+    PartitionedBPTree &operator=(const PartitionedBPTree &) = delete;
+
+    // Search by key
+    // @return the value stored in index.
+    //  -1 if not find
+    offset search_by_key(const T &key);
+
+    // Insert key:value into its shard.
+    // @return true if success inserted.
+    bool insert(const T &key, int value);
+
+    // Delete key:value from its shard.
+    // @return true if delete success
+    bool delete_by_key(const T &key);
+
+    // Same semantic as BPTree, shards in range are locked together in
+    // ascending order.
+    unsigned int delete_range(const T &begin_key, const T &end_key);
+
+    // Insert key:value pairs, each shard on its own worker.
+    void batch_insert(const std::vector<T> &keys, const std::vector<offset> &values);
+
+    // Same semantic as BPTree, shards in range are searched in parallel.
+    std::vector<offset> search_between(const T &begin_key, const T &end_key);
+
+    // Same semantic as BPTree, each shard in range fills its own bitmap in
+    // parallel, then the bitmaps are united.
+    void search_between(const T &begin_key, const T &end_key, offset_bitmap &results);
+
+    // Same semantic as BPTree, shards are scanned one after another in key
+    // order, each split over pool.
+    std::vector<offset> search_between_parallel(const T &begin_key, const T &end_key, ThreadPool &pool);
+
+    std::vector<offset> search_smaller(const T &end_key);
+
+    std::vector<offset> search_greater(const T &begin_key);
+
+    // Same semantic as BPTree, shards are walked from the last one in range
+    // down, until limit values are found.
+    std::vector<offset> search_smaller_desc(const T &end_key, size_t limit, bool inclusive = false);
+
+    std::vector<offset> search_last(size_t limit);
+
+    // Same semantic as BPTree, shards are walked from the first one in range
+    // up, until limit values are taken.
+    bool search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end, const T &end_key,
+                     size_t &skip, size_t limit, std::vector<offset> &values, T &last_key);
+
+    // @return: number of keys in all shards.
+    unsigned int size() const;
+
+    // @return: number of shards.
+    unsigned int shard_num() const;
+
+    // @return: number of keys in shard index.
+    unsigned int shard_size(unsigned int index) const;
+
+    // Stats of all shards added together.
+    index_stats stats();
+
+    // @return: bytes held by all shards, see BPTree::memory_bytes.
+    size_t memory_bytes();
+
+    // @return: number of levels of the highest shard.
+    unsigned int height();
+
+    // @return: number of splits, merges and borrows in all shards so far.
+    uint64_t restructures();
+
+    // Same semantic as BPTree, for every shard.
+    void set_relaxed_delete(bool relaxed);
+
+    void set_compressed(bool compressed);
+
+    // Run one compaction step on every shard, locking one shard at a time,
+    // so it may run on its own thread while the index is in use.
+    // @budget: max number of leaves to visit, split over the shards.
+    // @return: number of leaves merged away.
+    unsigned int compact(unsigned int budget);
+
+    // Run one defragmentation step on every shard, locking one shard at a
+    // time like compact.
+    // @budget: max number of leaves to rewrite, split over the shards.
+    // @return: progress of all shards added together.
+    defrag_progress defragment(unsigned int budget);
+
+    // Same semantic as BPTree, for every shard.
+    void set_counted(bool counted);
+
+    bool counted_tree() const;
+
+    // Same semantic as BPTree, shards in range are locked together in
+    // ascending order, so the result is consistent.
+    unsigned int count_between(const T &begin_key, const T &end_key);
+
+    unsigned int rank(const T &key);
+
+    // @rank: 0 for the smallest key.
+    // @key: key of rank.
+    // @value: value of key.
+    // @return: false if rank is out of range.
+    bool key_at_rank(unsigned int rank, T &key, offset &value);
+
+private:
+    struct shard {
+        BPTree<T> *tree;
+        std::mutex lock;
+        // Epoch of the partition map in which this shard's range last changed.
+        unsigned long epoch;
+        std::atomic<unsigned int> key_num;
+    };
+    struct partition_map {
+        std::vector<T> bounds;
+        // Shard of each range, one more than bounds.
+        std::vector<unsigned int> owners;
+        unsigned long epoch;
+    };
+    typedef std::shared_ptr<const partition_map> map_ptr;
+
+    // Shard holding more than skew_percent percent of the average is
+    // rebalanced. Below the number of shards times 100, so that any shard
+    // count can be skewed.
+    static const unsigned int skew_percent = 150;
+    // Shards smaller than this are never rebalanced once bounds are set.
+    static const unsigned int min_rebalance_keys = 4096;
+    // Keys per shard that seeding the bounds waits for.
+    static const unsigned int seed_keys = 64;
+
+    std::string m_name;
+    node_profile m_profile;
+    std::vector<std::unique_ptr<shard>> shards;
+    // Read and replaced with std::atomic_load / std::atomic_store only.
+    map_ptr partition;
+    // Serialize rebalancing, only its holder replaces partition.
+    std::mutex rebalance_lock;
+    std::atomic<bool> counted;
+    ThreadPool pool;
+
+    // @return: range of key in map, map.owners of it is its shard.
+    static unsigned int route(const partition_map &map, const T &key);
+
+    // Lock the shard owning key, retrying while it is being rebalanced.
+    // @guard: lock holder, owns the shard lock after return.
+    // @return: index of the locked shard.
+    unsigned int lock_shard(const T &key, std::unique_lock<std::mutex> &guard);
+
+    // Search shards in range of one partition map in parallel.
+    // @search: called on the tree of each shard.
+    // @return: result of each shard in ascending order of ranges.
+    template<class R, class F>
+    std::vector<R> search_shards(bool bounded_begin, const T &begin_key, bool bounded_end, const T &end_key,
+                                 F search);
+
+    // Same as search_shards, with the results merged into sorted offsets.
+    template<class F>
+    std::vector<offset> fan_out(bool bounded_begin, const T &begin_key, bool bounded_end, const T &end_key,
+                                F search);
+
+    // Walk shards backward from the one owning end_key, or from the last
+    // one if not bounded, under one partition map.
+    std::vector<offset> search_backward(bool bounded, const T &end_key, size_t limit, bool inclusive);
+
+    // Lock the shards of the ranges from the first one, or the one of
+    // begin_key if bounded, up to the one of end_key, in ascending order of
+    // shards.
+    // @guards: lock holders, own the shard locks after return.
+    // @return: locked shards in ascending order of their ranges.
+    std::vector<unsigned int> lock_range(bool bounded, const T &begin_key, const T &end_key,
+                                         std::vector<std::unique_lock<std::mutex>> &guards);
+
+    // Rebalance if shard index is too large.
+    void try_rebalance(unsigned int index);
+
+    // Set the bounds of an empty index from the quantiles of keys.
+    void seed(const std::vector<T> &keys);
+
+    // Set the bounds from the keys in shard 0, and hand each shard its range.
+    void spread();
+
+    // Move one bound to shrink shard index.
+    // Each move takes a constant part of the skewed shard, which then needs
+    // as many inserts to be skewed again, so the cost is O(1) moved keys per
+    // insert amortized.
+    void rebalance(unsigned int index);
+
+    // Move keys of range pos into a neighbouring range, with only the shards
+    // of the two ranges locked, and publish a map in which only their ranges
+    // changed.
+    // @up: move the greatest keys into range pos + 1, else the smallest into
+    //  range pos - 1.
+    // @num: number of keys to move, all of them removes range pos.
+    // @spare: shard owning no range, which takes the keys as a new range
+    //  pos + 1, if less than shard_num().
+    void move_keys(unsigned int pos, bool up, unsigned int num, unsigned int spare);
+};
+
+template<typename T>
+PartitionedBPTree<T>::PartitionedBPTree(const std::string &name, unsigned int shard_num, node_profile profile):
+        m_name(name),
+        m_profile(profile),
+        counted(false),
+        pool(shard_num) {
+    auto map = std::make_shared<partition_map>();
+    map->owners.push_back(0);
+    map->epoch = 0;
+    std::atomic_store(&partition, map_ptr(map));
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        std::string shard_name = m_name + "#" + std::to_string(i);
+        std::unique_ptr<shard> p_shard(new shard);
+        p_shard->tree = new BPTree<T>(shard_name, m_profile);
+        p_shard->epoch = 0;
+        p_shard->key_num = 0;
+        shards.push_back(std::move(p_shard));
+    }
+}
+
+template<typename T>
+PartitionedBPTree<T>::~PartitionedBPTree() {
+    for (auto &p_shard : shards)
+        delete p_shard->tree;
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::route(const partition_map &map, const T &key) {
+    return static_cast<unsigned int>(std::upper_bound(map.bounds.begin(), map.bounds.end(), key) -
+                                     map.bounds.begin());
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::lock_shard(const T &key, std::unique_lock<std::mutex> &guard) {
+    while (true) {
+        map_ptr map = std::atomic_load(&partition);
+        unsigned int index = map->owners[route(*map, key)];
+        std::unique_lock<std::mutex> shard_guard(shards[index]->lock);
+        if (shards[index]->epoch <= map->epoch) {
+            guard = std::move(shard_guard);
+            return index;
+        }
+    }
+}
+
+template<typename T>
+offset PartitionedBPTree<T>::search_by_key(const T &key) {
+    std::unique_lock<std::mutex> guard;
+    unsigned int index = lock_shard(key, guard);
+    return shards[index]->tree->search_by_key(key);
+}
+
+template<typename T>
+bool PartitionedBPTree<T>::insert(const T &key, int value) {
+    std::unique_lock<std::mutex> guard;
+    unsigned int index = lock_shard(key, guard);
+    shards[index]->tree->insert(key, value);
+    shards[index]->key_num++;
+    guard.unlock();
+
+    try_rebalance(index);
+    return true;
+}
+
+template<typename T>
+bool PartitionedBPTree<T>::delete_by_key(const T &key) {
+    std::unique_lock<std::mutex> guard;
+    unsigned int index = lock_shard(key, guard);
+    shards[index]->tree->delete_by_key(key);
+    shards[index]->key_num--;
+    return true;
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::delete_range(const T &begin_key, const T &end_key) {
+    if (end_key < begin_key)
+        return 0;
+    std::vector<std::unique_lock<std::mutex>> guards;
+    unsigned int result = 0;
+    for (auto index : lock_range(true, begin_key, end_key, guards)) {
+        unsigned int removed = shards[index]->tree->delete_range(begin_key, end_key);
+        shards[index]->key_num -= removed;
+        result += removed;
+    }
+    return result;
+}
+
+template<typename T>
+void PartitionedBPTree<T>::batch_insert(const std::vector<T> &keys, const std::vector<offset> &values) {
+    if (keys.size() != values.size())
+        throw BatchSizeNotEqual();
+    if (std::atomic_load(&partition)->bounds.empty())
+        seed(keys);
+
+    std::vector<size_t> pending(keys.size());
+    for (size_t i = 0; i < pending.size(); i++)
+        pending[i] = i;
+    std::vector<bool> touched(shards.size(), false);
+
+    // Rows routed with a stale map are routed again in the next round.
+    while (!pending.empty()) {
+        map_ptr map = std::atomic_load(&partition);
+        std::vector<std::vector<size_t>> groups(shards.size());
+        for (auto row : pending)
+            groups[map->owners[route(*map, keys[row])]].push_back(row);
+
+        std::vector<std::future<bool>> jobs;
+        for (unsigned int index = 0; index < shards.size(); index++) {
+            if (groups[index].empty())
+                continue;
+            touched[index] = true;
+            const std::vector<size_t> &group = groups[index];
+            shard *p_shard = shards[index].get();
+            jobs.push_back(pool.submit([&keys, &values, &group, p_shard, map]() {
+                std::lock_guard<std::mutex> guard(p_shard->lock);
+                if (p_shard->epoch > map->epoch)
+                    return false;
+                for (auto row : group) {
+                    p_shard->tree->insert(keys[row], values[row]);
+                    p_shard->key_num++;
+                }
+                return true;
+            }));
+        }
+
+        std::vector<size_t> stale;
+        std::exception_ptr error;
+        for (unsigned int index = 0, job = 0; index < shards.size(); index++) {
+            if (groups[index].empty())
+                continue;
+            try {
+                if (!jobs[job].get())
+                    stale.insert(stale.end(), groups[index].begin(), groups[index].end());
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+            job++;
+        }
+        if (error)
+            std::rethrow_exception(error);
+        pending.swap(stale);
+    }
+
+    for (unsigned int index = 0; index < shards.size(); index++) {
+        if (touched[index])
+            try_rebalance(index);
+    }
+}
+
+template<typename T>
+template<class R, class F>
+std::vector<R> PartitionedBPTree<T>::search_shards(bool bounded_begin, const T &begin_key, bool bounded_end,
+                                                   const T &end_key, F search) {
+    while (true) {
+        map_ptr map = std::atomic_load(&partition);
+        unsigned int first = bounded_begin ? route(*map, begin_key) : 0;
+        unsigned int last = bounded_end ? route(*map, end_key) : static_cast<unsigned int>(map->bounds.size());
+
+        std::vector<R> parts(last - first + 1);
+        std::vector<std::future<bool>> jobs;
+        for (unsigned int pos = first; pos <= last; pos++) {
+            shard *p_shard = shards[map->owners[pos]].get();
+            R &part = parts[pos - first];
+            jobs.push_back(pool.submit([p_shard, map, &part, &search]() {
+                std::lock_guard<std::mutex> guard(p_shard->lock);
+                if (p_shard->epoch > map->epoch)
+                    return false;
+                part = search(p_shard->tree);
+                return true;
+            }));
+        }
+
+        bool consistent = true;
+        for (auto &job : jobs)
+            consistent = job.get() && consistent;
+        if (consistent)
+            return parts;
+    }
+}
+
+template<typename T>
+template<class F>
+std::vector<offset> PartitionedBPTree<T>::fan_out(bool bounded_begin, const T &begin_key, bool bounded_end,
+                                                  const T &end_key, F search) {
+    std::vector<offset> results;
+    for (auto &part : search_shards<std::vector<offset>>(bounded_begin, begin_key, bounded_end, end_key, search))
+        results.insert(results.end(), part.begin(), part.end());
+    std::sort(results.begin(), results.end());
+    results.erase(unique(results.begin(), results.end()), results.end());
+    return results;
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_between(const T &begin_key, const T &end_key) {
+    const T &low = begin_key > end_key ? end_key : begin_key;
+    const T &high = begin_key > end_key ? begin_key : end_key;
+    return fan_out(true, low, true, high, [&](BPTree<T> *tree) {
+        return tree->search_between(begin_key, end_key);
+    });
+}
+
+template<typename T>
+void PartitionedBPTree<T>::search_between(const T &begin_key, const T &end_key, offset_bitmap &results) {
+    const T &low = begin_key > end_key ? end_key : begin_key;
+    const T &high = begin_key > end_key ? begin_key : end_key;
+    auto parts = search_shards<offset_bitmap>(true, low, true, high, [&](BPTree<T> *tree) {
+        offset_bitmap part;
+        tree->search_between(begin_key, end_key, part);
+        return part;
+    });
+    for (auto &part : parts)
+        results |= part;
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_between_parallel(const T &begin_key, const T &end_key,
+                                                                  ThreadPool &pool) {
+    while (true) {
+        map_ptr map = std::atomic_load(&partition);
+        const T &low = begin_key > end_key ? end_key : begin_key;
+        const T &high = begin_key > end_key ? begin_key : end_key;
+        unsigned int first = route(*map, low), last = route(*map, high);
+        std::vector<offset> results;
+        bool consistent = true;
+        for (unsigned int pos = first; pos <= last && consistent; pos++) {
+            shard *p_shard = shards[map->owners[pos]].get();
+            std::lock_guard<std::mutex> guard(p_shard->lock);
+            consistent = p_shard->epoch <= map->epoch;
+            if (!consistent)
+                break;
+            std::vector<offset> part = p_shard->tree->search_between_parallel(begin_key, end_key, pool);
+            results.insert(results.end(), part.begin(), part.end());
+        }
+        if (consistent)
+            return results;
+    }
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_smaller(const T &end_key) {
+    return fan_out(false, end_key, true, end_key, [&](BPTree<T> *tree) {
+        return tree->search_smaller(end_key);
+    });
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_greater(const T &begin_key) {
+    return fan_out(true, begin_key, false, begin_key, [&](BPTree<T> *tree) {
+        return tree->search_greater(begin_key);
+    });
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_smaller_desc(const T &end_key, size_t limit, bool inclusive) {
+    return search_backward(true, end_key, limit, inclusive);
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_last(size_t limit) {
+    return search_backward(false, T(), limit, false);
+}
+
+template<typename T>
+std::vector<offset> PartitionedBPTree<T>::search_backward(bool bounded, const T &end_key, size_t limit,
+                                                          bool inclusive) {
+    while (true) {
+        map_ptr map = std::atomic_load(&partition);
+        int pos = bounded ? static_cast<int>(route(*map, end_key)) : static_cast<int>(map->bounds.size());
+        std::vector<offset> results;
+        bool consistent = true;
+        // Ranges are ascending, so going down keeps keys descending.
+        for (; pos >= 0 && results.size() < limit; pos--) {
+            shard *p_shard = shards[map->owners[pos]].get();
+            std::lock_guard<std::mutex> guard(p_shard->lock);
+            if (p_shard->epoch > map->epoch) {
+                consistent = false;
+                break;
+            }
+            size_t rest = limit - results.size();
+            std::vector<offset> part = bounded ? p_shard->tree->search_smaller_desc(end_key, rest, inclusive)
+                                               : p_shard->tree->search_last(rest);
+            results.insert(results.end(), part.begin(), part.end());
+        }
+        if (consistent)
+            return results;
+    }
+}
+
+template<typename T>
+bool PartitionedBPTree<T>::search_page(bool bounded_begin, const T &begin_key, bool after, bool bounded_end,
+                                       const T &end_key, size_t &skip, size_t limit,
+                                       std::vector<offset> &values, T &last_key) {
+    size_t first_value = values.size();
+    size_t first_skip = skip;
+    while (true) {
+        map_ptr map = std::atomic_load(&partition);
+        unsigned int pos = bounded_begin ? route(*map, begin_key) : 0;
+        unsigned int last = bounded_end ? route(*map, end_key) : static_cast<unsigned int>(map->bounds.size());
+        bool more = false;
+        bool consistent = true;
+        // Ranges are ascending, so going up keeps keys ascending.
+        for (; pos <= last; pos++) {
+            shard *p_shard = shards[map->owners[pos]].get();
+            std::lock_guard<std::mutex> guard(p_shard->lock);
+            if (p_shard->epoch > map->epoch) {
+                consistent = false;
+                break;
+            }
+            // Once the page is full, shards are only asked whether keys are left.
+            size_t rest = limit - (values.size() - first_value);
+            more = p_shard->tree->search_page(bounded_begin, begin_key, after, bounded_end, end_key, skip, rest,
+                                              values, last_key);
+            if (more && values.size() - first_value == limit)
+                break;
+        }
+        if (consistent)
+            return more;
+        values.resize(first_value);
+        skip = first_skip;
+    }
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::size() const {
+    unsigned int total = 0;
+    for (auto &p_shard : shards)
+        total += p_shard->key_num;
+    return total;
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::shard_num() const {
+    return static_cast<unsigned int>(shards.size());
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::shard_size(unsigned int index) const {
+    return shards.at(index)->key_num;
+}
+
+template<typename T>
+index_stats PartitionedBPTree<T>::stats() {
+    index_stats result;
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        result.accumulate(p_shard->tree->stats());
+    }
+    return result;
+}
+
+template<typename T>
+size_t PartitionedBPTree<T>::memory_bytes() {
+    size_t result = sizeof(*this);
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        result += p_shard->tree->memory_bytes();
+    }
+    return result;
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::height() {
+    unsigned int result = 0;
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        result = std::max(result, p_shard->tree->height());
+    }
+    return result;
+}
+
+template<typename T>
+uint64_t PartitionedBPTree<T>::restructures() {
+    uint64_t result = 0;
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        result += p_shard->tree->restructures();
+    }
+    return result;
+}
+
+template<typename T>
+void PartitionedBPTree<T>::set_relaxed_delete(bool relaxed) {
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        p_shard->tree->set_relaxed_delete(relaxed);
+    }
+}
+
+template<typename T>
+void PartitionedBPTree<T>::set_compressed(bool compressed) {
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        p_shard->tree->set_compressed(compressed);
+    }
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::compact(unsigned int budget) {
+    unsigned int shard_budget = std::max(1u, budget / static_cast<unsigned int>(shards.size()));
+    unsigned int merged = 0;
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        merged += p_shard->tree->compact(shard_budget);
+    }
+    return merged;
+}
+
+template<typename T>
+defrag_progress PartitionedBPTree<T>::defragment(unsigned int budget) {
+    unsigned int shard_budget = std::max(1u, budget / static_cast<unsigned int>(shards.size()));
+    defrag_progress progress;
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        progress.accumulate(p_shard->tree->defragment(shard_budget));
+    }
+    return progress;
+}
+
+template<typename T>
+void PartitionedBPTree<T>::set_counted(bool counted) {
+    for (auto &p_shard : shards) {
+        std::lock_guard<std::mutex> guard(p_shard->lock);
+        p_shard->tree->set_counted(counted);
+    }
+    this->counted = counted;
+}
+
+template<typename T>
+bool PartitionedBPTree<T>::counted_tree() const {
+    return counted;
+}
+
+template<typename T>
+std::vector<unsigned int> PartitionedBPTree<T>::lock_range(bool bounded, const T &begin_key, const T &end_key,
+                                                           std::vector<std::unique_lock<std::mutex>> &guards) {
+    while (true) {
+        guards.clear();
+        map_ptr map = std::atomic_load(&partition);
+        unsigned int first = bounded ? route(*map, begin_key) : 0;
+        unsigned int last = route(*map, end_key);
+        std::vector<unsigned int> owners(map->owners.begin() + first, map->owners.begin() + last + 1);
+        // Ranges may be owned out of order, lock by shard as rebalancing does.
+        std::vector<unsigned int> order(owners);
+        std::sort(order.begin(), order.end());
+        bool consistent = true;
+        for (auto index : order) {
+            guards.emplace_back(shards[index]->lock);
+            consistent = consistent && shards[index]->epoch <= map->epoch;
+        }
+        if (consistent)
+            return owners;
+    }
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::count_between(const T &begin_key, const T &end_key) {
+    const T &low = begin_key > end_key ? end_key : begin_key;
+    const T &high = begin_key > end_key ? begin_key : end_key;
+    std::vector<std::unique_lock<std::mutex>> guards;
+    unsigned int result = 0;
+    // Every shard only holds keys of its own range.
+    for (auto index : lock_range(true, low, high, guards))
+        result += shards[index]->tree->count_between(low, high);
+    return result;
+}
+
+template<typename T>
+unsigned int PartitionedBPTree<T>::rank(const T &key) {
+    std::vector<std::unique_lock<std::mutex>> guards;
+    std::vector<unsigned int> owners = lock_range(false, key, key, guards);
+    unsigned int result = 0;
+    for (size_t pos = 0; pos + 1 < owners.size(); pos++)
+        result += shards[owners[pos]]->tree->size();
+    return result + shards[owners.back()]->tree->rank(key);
+}
+
+template<typename T>
+bool PartitionedBPTree<T>::key_at_rank(unsigned int rank, T &key, offset &value) {
+    // Lock in ascending order, as rebalance does.
+    std::vector<std::unique_lock<std::mutex>> guards;
+    for (auto &p_shard : shards)
+        guards.emplace_back(p_shard->lock);
+    // No map is published while every shard is locked.
+    map_ptr map = std::atomic_load(&partition);
+    for (auto index : map->owners) {
+        BPTree<T> *tree = shards[index]->tree;
+        if (rank < tree->size()) {
+            auto it = tree->at_rank(rank);
+            key = it.key();
+            value = it.value();
+            return true;
+        }
+        rank -= tree->size();
+    }
+    return false;
+}
+
+template<typename T>
+void PartitionedBPTree<T>::try_rebalance(unsigned int index) {
+    uint64_t shard_size = shards[index]->key_num;
+    // Without bounds every key is in shard 0, so split it early.
+    bool seeded = !std::atomic_load(&partition)->bounds.empty();
+    uint64_t least = seeded ? min_rebalance_keys : uint64_t(seed_keys) * shards.size();
+    if (shards.size() < 2 || shard_size < least || shard_size * shards.size() * 100 <= uint64_t(skew_percent) * size())
+        return;
+    std::unique_lock<std::mutex> guard(rebalance_lock, std::try_to_lock);
+    if (!guard.owns_lock())
+        return;
+    if (seeded)
+        rebalance(index);
+    else
+        spread();
+}
+
+template<typename T>
+void PartitionedBPTree<T>::seed(const std::vector<T> &keys) {
+    if (shards.size() < 2 || keys.size() < shards.size())
+        return;
+    std::vector<T> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    std::lock_guard<std::mutex> rebalance_guard(rebalance_lock);
+    std::vector<std::unique_lock<std::mutex>> guards;
+    for (auto &p_shard : shards)
+        guards.emplace_back(p_shard->lock);
+    // Keys already in shard 0 would fall out of its new range.
+    map_ptr old_map = std::atomic_load(&partition);
+    if (!old_map->bounds.empty() || size() != 0)
+        return;
+    auto map = std::make_shared<partition_map>();
+    map->epoch = old_map->epoch + 1;
+    for (unsigned int index = 0; index < shards.size(); index++) {
+        if (index > 0)
+            map->bounds.push_back(sorted[index * sorted.size() / shards.size()]);
+        map->owners.push_back(index);
+    }
+    for (auto &p_shard : shards)
+        p_shard->epoch = map->epoch;
+    std::atomic_store(&partition, map_ptr(map));
+}
+
+template<typename T>
+void PartitionedBPTree<T>::spread() {
+    // Always lock in ascending order.
+    std::vector<std::unique_lock<std::mutex>> guards;
+    for (auto &p_shard : shards)
+        guards.emplace_back(p_shard->lock);
+    map_ptr old_map = std::atomic_load(&partition);
+    if (!old_map->bounds.empty())
+        return;
+
+    std::vector<T> keys;
+    std::vector<offset> values;
+    shards[0]->tree->dump_entries(keys, values);
+    size_t n = keys.size();
+    if (n < shards.size())
+        return;
+    auto map = std::make_shared<partition_map>();
+    map->epoch = old_map->epoch + 1;
+    map->owners.push_back(0);
+    size_t pos = n / shards.size() + (n % shards.size() > 0 ? 1 : 0);
+    // Shard 0 keeps the first range.
+    shards[0]->tree->delete_range(keys[pos], keys.back());
+    shards[0]->key_num = static_cast<unsigned int>(pos);
+    for (unsigned int index = 1; index < shards.size(); index++) {
+        size_t cnt = n / shards.size() + (index < n % shards.size() ? 1 : 0);
+        shards[index]->tree->bulk_load(std::vector<T>(keys.begin() + pos, keys.begin() + pos + cnt),
+                                       std::vector<offset>(values.begin() + pos, values.begin() + pos + cnt));
+        shards[index]->key_num = static_cast<unsigned int>(cnt);
+        map->bounds.push_back(keys[pos]);
+        map->owners.push_back(index);
+        pos += cnt;
+    }
+    for (auto &p_shard : shards)
+        p_shard->epoch = map->epoch;
+    // Publish the new bounds while all shards are still locked.
+    std::atomic_store(&partition, map_ptr(map));
+}
+
+template<typename T>
+void PartitionedBPTree<T>::rebalance(unsigned int index) {
+    map_ptr map = std::atomic_load(&partition);
+    auto found = std::find(map->owners.begin(), map->owners.end(), index);
+    if (found == map->owners.end())
+        return;
+    unsigned int pos = static_cast<unsigned int>(found - map->owners.begin());
+    unsigned int shard_size = shards[index]->key_num;
+    std::vector<bool> owning(shards.size(), false);
+    for (auto owner : map->owners)
+        owning[owner] = true;
+    unsigned int spare = static_cast<unsigned int>(std::find(owning.begin(), owning.end(), false) - owning.begin());
+
+    // Even out with the smaller neighbour, if that moves a fair part.
+    if (spare == shards.size()) {
+        unsigned int neighbour = pos;
+        for (unsigned int other : {pos - 1, pos + 1}) {
+            if (other < map->owners.size() &&
+                (neighbour == pos || shards[map->owners[other]]->key_num < shards[map->owners[neighbour]]->key_num))
+                neighbour = other;
+        }
+        unsigned int neighbour_size = shards[map->owners[neighbour]]->key_num;
+        if (neighbour != pos && neighbour_size * 4 <= shard_size * 3) {
+            move_keys(pos, neighbour > pos, (shard_size - neighbour_size) / 2, spare);
+            return;
+        }
+
+        // Free a shard by merging the two smallest neighbouring ranges, as
+        // long as they hold fewer keys together than the skewed shard.
+        unsigned int merged = 0;
+        uint64_t merged_size = shard_size;
+        for (unsigned int other = 0; other + 1 < map->owners.size(); other++) {
+            unsigned int low = map->owners[other], high = map->owners[other + 1];
+            uint64_t both = uint64_t(shards[low]->key_num) + shards[high]->key_num;
+            if (low != index && high != index && both < merged_size) {
+                merged = other;
+                merged_size = both;
+            }
+        }
+        if (merged_size == shard_size)
+            return;
+        // The smaller one of the two moves into the other.
+        bool up = shards[map->owners[merged]]->key_num <= shards[map->owners[merged + 1]]->key_num;
+        unsigned int freed = up ? merged : merged + 1;
+        spare = map->owners[freed];
+        move_keys(freed, up, std::numeric_limits<unsigned int>::max(), shards.size());
+        if (freed < pos)
+            pos--;
+    }
+    // A shard owning no range takes the upper half as a new range.
+    move_keys(pos, true, shard_size / 2, spare);
+}
+
+template<typename T>
+void PartitionedBPTree<T>::move_keys(unsigned int pos, bool up, unsigned int num, unsigned int spare) {
+    map_ptr old_map = std::atomic_load(&partition);
+    unsigned int source = old_map->owners[pos];
+    unsigned int target = spare < shards.size() ? spare : old_map->owners[up ? pos + 1 : pos - 1];
+    // Always lock in ascending order.
+    std::unique_lock<std::mutex> low_guard(shards[std::min(source, target)]->lock);
+    std::unique_lock<std::mutex> high_guard(shards[std::max(source, target)]->lock);
+    BPTree<T> *from = shards[source]->tree, *to = shards[target]->tree;
+    bool whole = num >= from->size() && spare == shards.size();
+    // Never empty range pos, unless it is to be removed.
+    num = std::min(num, whole || from->size() == 0 ? from->size() : from->size() - 1);
+    if (num == 0 && !whole)
+        return;
+
+    std::vector<T> keys;
+    std::vector<offset> values;
+    if (num > 0) {
+        auto it = up ? from->last() : from->first();
+        for (unsigned int i = 1; up && i < num; i++)
+            it.prev();
+        for (unsigned int i = 0; i < num; i++, it.next()) {
+            keys.push_back(it.key());
+            values.push_back(it.value());
+        }
+        from->delete_range(keys.front(), keys.back());
+        if (to->size() == 0)
+            to->bulk_load(keys, values);
+        else
+            to->insert_sorted(keys, values);
+        shards[source]->key_num -= num;
+        shards[target]->key_num += num;
+    }
+
+    auto map = std::make_shared<partition_map>(*old_map);
+    map->epoch = old_map->epoch + 1;
+    if (whole) {
+        map->bounds.erase(map->bounds.begin() + (up ? pos : pos - 1));
+        map->owners.erase(map->owners.begin() + pos);
+    } else if (spare < shards.size()) {
+        map->bounds.insert(map->bounds.begin() + pos, keys.front());
+        map->owners.insert(map->owners.begin() + pos + 1, spare);
+    } else if (up) {
+        map->bounds[pos] = keys.front();
+    } else {
+        map->bounds[pos - 1] = from->first().key();
+    }
+    shards[source]->epoch = map->epoch;
+    shards[target]->epoch = map->epoch;
+    // Publish the new bounds while both shards are still locked.
+    std::atomic_store(&partition, map_ptr(map));
+}
+
+#endif //MINISQL_PARTITIONEDTREE_H
@@ -0,0 +1,98 @@
+#ifndef MINISQL_THREADPOOL_H
+#define MINISQL_THREADPOOL_H
+
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <queue>
+#include <vector>
+
+// Fixed size pool of worker threads.
+// Tasks are taken in FIFO order, and the result (or exception) of each task
+// is delivered through the future returned by submit.
+class ThreadPool {
+public:
+    // @thread_num: number of workers, 0 means one per hardware thread.
+    explicit ThreadPool(unsigned int thread_num = 0);
+
+    // Finish all queued tasks, then join workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queue a task.
+    // @task: callable without argument.
+    // @return: future of the task's return value.
+    template<class F>
+    std::future<typename std::result_of<F()>::type> submit(F task);
+
+    // @return: number of workers.
+    unsigned int size() const;
+
+private:
+    void work();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stop;
+};
+
+inline ThreadPool::ThreadPool(unsigned int thread_num) : stop(false) {
+    if (thread_num == 0)
+        thread_num = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < thread_num; i++)
+        workers.emplace_back(&ThreadPool::work, this);
+}
+
+inline ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+template<class F>
+std::future<typename std::result_of<F()>::type> ThreadPool::submit(F task) {
+    typedef typename std::result_of<F()>::type result_type;
+    // packaged_task is move only, share it so that std::function can copy it.
+    auto p_task = std::make_shared<std::packaged_task<result_type()>>(task);
+    auto result = p_task->get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push([p_task]() { (*p_task)(); });
+    }
+    wake.notify_one();
+    return result;
+}
+
+inline unsigned int ThreadPool::size() const {
+    return static_cast<unsigned int>(workers.size());
+}
+
+inline void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this]() { return stop || !tasks.empty(); });
+            if (stop && tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+#endif //MINISQL_THREADPOOL_H
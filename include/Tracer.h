@@ -0,0 +1,155 @@
+#ifndef MINISQL_TRACER_H
+#define MINISQL_TRACER_H
+
+#include "Histogram.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Latency tracing of IndexManager operations.
+// IndexManager only records when built with INDEX_TRACE defined, otherwise
+// the tracer is never touched and costs nothing.
+// Each thread records into its own histograms without locking, and
+// histograms are merged over all threads when asked for.
+
+enum trace_op {
+    trace_search_equal,
+    trace_search_between,
+    trace_search_smaller,
+    trace_search_greater,
+    trace_insert_index,
+    trace_delete_index,
+    trace_batch_insert,
+    trace_search_smaller_desc,
+    trace_search_last,
+    trace_op_num
+};
+
+// One operation slower than the slow threshold.
+struct slow_op {
+    trace_op op;
+    std::string index_name;
+    // Searched or modified key range, as text.
+    std::string key_begin;
+    std::string key_end;
+    // Latency in nanoseconds.
+    uint64_t latency;
+    // Height of the tree when the operation started.
+    unsigned int height;
+    // Number of offsets returned or keys inserted.
+    uint64_t rows;
+    // Splits, merges and borrows the operation caused.
+    uint64_t restructures;
+};
+
+class Tracer {
+public:
+    static Tracer &instance();
+
+    // @return: name of op, as the IndexManager method.
+    static const char *op_name(trace_op op);
+
+    // @return: histogram of op owned by the calling thread.
+    Histogram &local(trace_op op);
+
+    // @return: histogram of op merged over all threads.
+    Histogram merged(trace_op op);
+
+    // Clear all histograms and the slow operation log.
+    void reset();
+
+    // @threshold: latency in nanoseconds above which operations are logged,
+    //  0 disables the log.
+    void set_slow_threshold(uint64_t threshold);
+
+    uint64_t slow_threshold() const;
+
+    // Keep record in the slow operation log, dropping the oldest when full.
+    void log_slow(const slow_op &record);
+
+    // @return: slow operations, oldest first.
+    std::vector<slow_op> slow_ops();
+
+    static const size_t slow_log_capacity = 1024;
+
+private:
+    struct thread_histograms {
+        Histogram ops[trace_op_num];
+    };
+
+    Tracer();
+
+    std::mutex lock;
+    // Histograms of every thread that ever recorded, kept after the thread
+    // exits so that its samples still count.
+    std::vector<std::shared_ptr<thread_histograms>> threads;
+    std::atomic<uint64_t> threshold;
+    std::deque<slow_op> slow_log;
+};
+
+inline Tracer::Tracer() : threshold(0) {}
+
+inline Tracer &Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+inline const char *Tracer::op_name(trace_op op) {
+    static const char *names[trace_op_num] = {"search_equal", "search_between", "search_smaller",
+                                              "search_greater", "insert_index", "delete_index",
+                                              "batch_insert", "search_smaller_desc", "search_last"};
+    return names[op];
+}
+
+inline Histogram &Tracer::local(trace_op op) {
+    static thread_local thread_histograms *current = nullptr;
+    if (!current) {
+        auto histograms = std::make_shared<thread_histograms>();
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(histograms);
+        current = histograms.get();
+    }
+    return current->ops[op];
+}
+
+inline Histogram Tracer::merged(trace_op op) {
+    Histogram result;
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &histograms : threads)
+        result.merge(histograms->ops[op]);
+    return result;
+}
+
+inline void Tracer::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &histograms : threads) {
+        for (auto &histogram : histograms->ops)
+            histogram.reset();
+    }
+    slow_log.clear();
+}
+
+inline void Tracer::set_slow_threshold(uint64_t threshold) {
+    this->threshold.store(threshold, std::memory_order_relaxed);
+}
+
+inline uint64_t Tracer::slow_threshold() const {
+    return threshold.load(std::memory_order_relaxed);
+}
+
+inline void Tracer::log_slow(const slow_op &record) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (slow_log.size() == slow_log_capacity)
+        slow_log.pop_front();
+    slow_log.push_back(record);
+}
+
+inline std::vector<slow_op> Tracer::slow_ops() {
+    std::lock_guard<std::mutex> guard(lock);
+    return std::vector<slow_op>(slow_log.begin(), slow_log.end());
+}
+
+#endif //MINISQL_TRACER_H
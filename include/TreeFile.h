@@ -0,0 +1,329 @@
+#ifndef MINISQL_TREEFILE_H
+#define MINISQL_TREEFILE_H
+
+#include "Node.h"
+#include "PageFile.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+// Image of a B+ tree in a page file, one node per page.
+// Page 0 holds the header, pages 1 to leaf_num the leaves in key order, and
+// the pages after them the internal nodes, each one after its children.
+// Every page starts with a page_header. Leaf pages go on with the keys, the
+// values and the included columns, internal pages with the keys and the page
+// ids of the children.
+// Range scans read leaf pages ahead on pool workers: the page ids of the
+// coming leaves are known from their father, so reads of the next leaves
+// overlap with the scan of the current one.
+template<typename T>
+class TreeFile {
+public:
+    // Open an image written by write.
+    explicit TreeFile(const std::string &file_name);
+
+    // Write the image of a tree, replacing the file.
+    // @root: root of the tree.
+    // @leaf_head: first leaf of the tree.
+    // @key_num: number of keys in the tree.
+    // @level: number of levels of the tree.
+    // @degree: degree of the tree.
+    // @payload_size: bytes of included columns stored with each value.
+    static void write(const std::string &file_name, Node<T> *root, Node<T> *leaf_head, unsigned int key_num,
+                      unsigned int level, int degree, int payload_size);
+
+    // Values of keys in [begin_key, end_key], in key order.
+    // @pool: workers reading the leaf pages.
+    // @read_ahead: max number of leaf pages read ahead of the one being
+    //  scanned.
+    std::vector<offset> search_between(T begin_key, T end_key, ThreadPool &pool, unsigned int read_ahead = 8);
+
+    // Read all entries of the image in key order.
+    // @keys: container to store the keys.
+    // @values: container to store the values.
+    // @payloads: container to store the included columns of each key one
+    //  after another.
+    void dump_entries(std::vector<T> &keys, std::vector<offset> &values, std::vector<char> &payloads);
+
+    // @return: number of keys in the image.
+    unsigned int size() const;
+
+    // @return: page of the root.
+    unsigned int root_page() const;
+
+    // @return: bytes of included columns stored with each value.
+    int payload_bytes() const;
+
+private:
+    struct file_header {
+        uint32_t magic;
+        uint32_t key_size;
+        uint32_t payload_size;
+        uint32_t page_size;
+        uint32_t key_num;
+        uint32_t level;
+        uint32_t root;
+    };
+    struct page_header {
+        uint32_t is_leaf;
+        uint32_t key_num;
+        // Page of the next leaf, 0 for the last one and for internal nodes.
+        uint32_t next;
+    };
+    // Internal page on the way down to the scanned leaf.
+    struct path_page {
+        std::vector<T> keys;
+        std::vector<uint32_t> children;
+        // Index of the child being scanned.
+        int index;
+    };
+
+    static const uint32_t file_magic = 0x42505446;
+
+    // @return: bytes of a page holding any node of degree.
+    static size_t page_size_of(int degree, int payload_size);
+
+    // Write the page of pNode and of the nodes under it.
+    // @ids: page of every leaf.
+    // @next_id: first page free for internal nodes, moved past the written ones.
+    // @return: page of pNode.
+    static uint32_t write_node(PageFile &file, Node<T> *pNode, std::unordered_map<Node<T> *, uint32_t> &ids,
+                               uint32_t &next_id, std::vector<char> &page);
+
+    // Read an internal page into path_page.
+    void read_internal(uint32_t page_id, path_page &result);
+
+    // Move path to the next leaf.
+    // @return: page of the next leaf, 0 after the last one.
+    uint32_t next_leaf(std::vector<path_page> &path);
+
+    file_header header;
+    std::unique_ptr<PageFile> file;
+};
+
+template<typename T>
+TreeFile<T>::TreeFile(const std::string &file_name) {
+    // The header fits in the first bytes of page 0, read it before knowing the page size.
+    {
+        PageFile header_file(file_name, sizeof(file_header), false);
+        if (header_file.page_num() == 0)
+            throw IndexFileError("Index file is empty");
+        header_file.read(0, reinterpret_cast<char *>(&header));
+    }
+    if (header.magic != file_magic || header.key_size != sizeof(T))
+        throw IndexFileError("Index file does not hold an index of this type");
+    file.reset(new PageFile(file_name, header.page_size, false));
+}
+
+template<typename T>
+size_t TreeFile<T>::page_size_of(int degree, int payload_size) {
+    size_t leaf = sizeof(page_header) + degree * (sizeof(T) + sizeof(int) + payload_size);
+    size_t internal = sizeof(page_header) + degree * sizeof(T) + (degree + 1) * sizeof(uint32_t);
+    size_t size = std::max(sizeof(file_header), std::max(leaf, internal));
+    // Whole disk sectors.
+    return (size + 511) / 512 * 512;
+}
+
+template<typename T>
+void TreeFile<T>::write(const std::string &file_name, Node<T> *root, Node<T> *leaf_head, unsigned int key_num,
+                        unsigned int level, int degree, int payload_size) {
+    size_t page_size = page_size_of(degree, payload_size);
+    PageFile file(file_name, page_size, true);
+    std::vector<char> page(page_size);
+
+    std::unordered_map<Node<T> *, uint32_t> ids;
+    uint32_t next_id = 1;
+    for (Node<T> *p = leaf_head; p != nullptr; p = p->get_sibling_node())
+        ids[p] = next_id++;
+    for (Node<T> *p = leaf_head; p != nullptr; p = p->get_sibling_node()) {
+        std::fill(page.begin(), page.end(), 0);
+        page_header node_header = {1, static_cast<uint32_t>(p->key_num), p->sibling ? ids[p->sibling] : 0};
+        std::memcpy(page.data(), &node_header, sizeof(node_header));
+        char *keys = page.data() + sizeof(page_header);
+        char *values = keys + p->key_num * sizeof(T);
+        for (int i = 0; i < p->key_num; i++) {
+            T key = p->key_at(i);
+            int value = p->value_at(i);
+            std::memcpy(keys + i * sizeof(T), &key, sizeof(T));
+            std::memcpy(values + i * sizeof(int), &value, sizeof(int));
+        }
+        if (payload_size > 0 && p->key_num > 0)
+            std::memcpy(values + p->key_num * sizeof(int), p->payload_at(0),
+                        static_cast<size_t>(p->key_num) * payload_size);
+        file.write(ids[p], page.data());
+    }
+    uint32_t root_id = write_node(file, root, ids, next_id, page);
+
+    std::fill(page.begin(), page.end(), 0);
+    file_header header = {file_magic, sizeof(T), static_cast<uint32_t>(payload_size),
+                          static_cast<uint32_t>(page_size), key_num, level, root_id};
+    std::memcpy(page.data(), &header, sizeof(header));
+    file.write(0, page.data());
+}
+
+template<typename T>
+uint32_t TreeFile<T>::write_node(PageFile &file, Node<T> *pNode, std::unordered_map<Node<T> *, uint32_t> &ids,
+                                 uint32_t &next_id, std::vector<char> &page) {
+    if (pNode->is_leaf)
+        return ids[pNode];
+    std::vector<uint32_t> children;
+    for (int i = 0; i <= pNode->key_num; i++)
+        children.push_back(write_node(file, pNode->child[i], ids, next_id, page));
+
+    std::fill(page.begin(), page.end(), 0);
+    page_header node_header = {0, static_cast<uint32_t>(pNode->key_num), 0};
+    std::memcpy(page.data(), &node_header, sizeof(node_header));
+    char *keys = page.data() + sizeof(page_header);
+    for (int i = 0; i < pNode->key_num; i++)
+        std::memcpy(keys + i * sizeof(T), &pNode->keys[i], sizeof(T));
+    std::memcpy(keys + pNode->key_num * sizeof(T), children.data(), children.size() * sizeof(uint32_t));
+    uint32_t page_id = next_id++;
+    file.write(page_id, page.data());
+    return page_id;
+}
+
+template<typename T>
+void TreeFile<T>::read_internal(uint32_t page_id, path_page &result) {
+    std::vector<char> page(file->page_size());
+    file->read(page_id, page.data());
+    page_header node_header;
+    std::memcpy(&node_header, page.data(), sizeof(node_header));
+    const char *keys = page.data() + sizeof(page_header);
+    result.keys.resize(node_header.key_num);
+    result.children.resize(node_header.key_num + 1);
+    for (uint32_t i = 0; i < node_header.key_num; i++)
+        std::memcpy(&result.keys[i], keys + i * sizeof(T), sizeof(T));
+    std::memcpy(result.children.data(), keys + node_header.key_num * sizeof(T),
+                result.children.size() * sizeof(uint32_t));
+    result.index = 0;
+}
+
+template<typename T>
+uint32_t TreeFile<T>::next_leaf(std::vector<path_page> &path) {
+    // Go up to the first father with a child left, then down its left edge.
+    size_t depth = path.size();
+    while (depth > 0 && path[depth - 1].index + 1 >= static_cast<int>(path[depth - 1].children.size()))
+        depth--;
+    if (depth == 0)
+        return 0;
+    path[depth - 1].index++;
+    for (; depth < path.size(); depth++)
+        read_internal(path[depth - 1].children[path[depth - 1].index], path[depth]);
+    return path.back().children[path.back().index];
+}
+
+template<typename T>
+std::vector<offset> TreeFile<T>::search_between(T begin_key, T end_key, ThreadPool &pool, unsigned int read_ahead) {
+    // Same as BPTree::search_between, a reversed range is searched the right way.
+    if (end_key < begin_key)
+        std::swap(begin_key, end_key);
+    std::vector<offset> results;
+    read_ahead = std::max(1u, read_ahead);
+
+    // Internal pages down to the father of the first leaf in range.
+    std::vector<path_page> path(header.level > 0 ? header.level - 1 : 0);
+    uint32_t leaf_id = header.root;
+    for (size_t depth = 0; depth < path.size(); depth++) {
+        read_internal(leaf_id, path[depth]);
+        // Like BPTree::find_by_key, a key equal to a separator is in the right subtree.
+        auto &keys = path[depth].keys;
+        path[depth].index = static_cast<int>(std::upper_bound(keys.begin(), keys.end(), begin_key) - keys.begin());
+        leaf_id = path[depth].children[path[depth].index];
+    }
+
+    PageFile *p_file = file.get();
+    std::deque<std::future<std::vector<char>>> pages;
+    bool finished = false;
+    while (!finished) {
+        // Keep read_ahead leaves on their way.
+        while (leaf_id != 0 && pages.size() < read_ahead) {
+            pages.push_back(pool.submit([p_file, leaf_id]() {
+                std::vector<char> page(p_file->page_size());
+                p_file->read(leaf_id, page.data());
+                return page;
+            }));
+            leaf_id = path.empty() ? 0 : next_leaf(path);
+        }
+        if (pages.empty())
+            break;
+        std::vector<char> page;
+        try {
+            page = pages.front().get();
+        } catch (...) {
+            // Reads still running use the file, wait for them.
+            for (auto &rest : pages)
+                rest.wait();
+            throw;
+        }
+        pages.pop_front();
+
+        page_header node_header;
+        std::memcpy(&node_header, page.data(), sizeof(node_header));
+        const char *keys = page.data() + sizeof(page_header);
+        const char *values = keys + node_header.key_num * sizeof(T);
+        for (uint32_t i = 0; i < node_header.key_num; i++) {
+            T key;
+            std::memcpy(&key, keys + i * sizeof(T), sizeof(T));
+            if (key < begin_key)
+                continue;
+            if (end_key < key) {
+                finished = true;
+                break;
+            }
+            int value;
+            std::memcpy(&value, values + i * sizeof(int), sizeof(int));
+            results.push_back(value);
+        }
+    }
+    // Reads still running use the file, wait for them.
+    for (auto &page : pages)
+        page.wait();
+    return results;
+}
+
+template<typename T>
+void TreeFile<T>::dump_entries(std::vector<T> &keys, std::vector<offset> &values, std::vector<char> &payloads) {
+    keys.reserve(keys.size() + header.key_num);
+    values.reserve(values.size() + header.key_num);
+    payloads.reserve(payloads.size() + static_cast<size_t>(header.key_num) * header.payload_size);
+    std::vector<char> page(file->page_size());
+    // Leaves start at page 1 and are chained in key order.
+    for (uint32_t page_id = 1; page_id != 0;) {
+        file->read(page_id, page.data());
+        page_header node_header;
+        std::memcpy(&node_header, page.data(), sizeof(node_header));
+        const char *page_keys = page.data() + sizeof(page_header);
+        const char *page_values = page_keys + node_header.key_num * sizeof(T);
+        for (uint32_t i = 0; i < node_header.key_num; i++) {
+            T key;
+            int value;
+            std::memcpy(&key, page_keys + i * sizeof(T), sizeof(T));
+            std::memcpy(&value, page_values + i * sizeof(int), sizeof(int));
+            keys.push_back(key);
+            values.push_back(value);
+        }
+        const char *page_payloads = page_values + node_header.key_num * sizeof(int);
+        payloads.insert(payloads.end(), page_payloads,
+                        page_payloads + static_cast<size_t>(node_header.key_num) * header.payload_size);
+        page_id = node_header.next;
+    }
+}
+
+template<typename T>
+unsigned int TreeFile<T>::size() const {
+    return header.key_num;
+}
+
+template<typename T>
+unsigned int TreeFile<T>::root_page() const {
+    return header.root;
+}
+
+template<typename T>
+int TreeFile<T>::payload_bytes() const {
+    return static_cast<int>(header.payload_size);
+}
+
+#endif //MINISQL_TREEFILE_H
@@ -0,0 +1,357 @@
+#ifndef MINISQL_WRITEBUFFER_H
+#define MINISQL_WRITEBUFFER_H
+
+#include "BPTree.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// @return: hash of a key for the filter of WriteBuffer.
+inline uint64_t key_hash(int key) {
+    uint64_t h = static_cast<uint32_t>(key) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+inline uint64_t key_hash(uint32_t key) {
+    return key_hash(static_cast<int>(key));
+}
+
+// Changes to a BPTree held back and applied in batches, for indexes taking
+// many writes at random keys. A write only appends to the buffer, and the
+// tree takes a whole batch at once in key order with insert_sorted, in one
+// descent per leaf instead of one per key. Searches merge the buffered
+// changes with the tree.
+// Keys stay unique as in BPTree. Whether a key is in the tree is first
+// asked of a filter of the keys in the tree, so that new keys never search
+// the tree, and whether it is in the buffer of a hash table on the changes.
+// Changes are sorted by key when a range is searched or on flush.
+// The tree is passed to each call, since it may be reloaded in between.
+template<class T>
+class WriteBuffer {
+public:
+    // @capacity: changes held before they are applied, 0 for as many as fit
+    //  in default_bytes. Batches take fewer descents per key the more keys
+    //  they put in each leaf, so they should be large next to the number of
+    //  leaves.
+    explicit WriteBuffer(size_t capacity = 0);
+
+    // Same semantic as BPTree, applies the changes once full.
+    void insert(BPTree<T> &tree, const T &key, offset value);
+
+    void delete_by_key(BPTree<T> &tree, const T &key);
+
+    offset search_by_key(BPTree<T> &tree, const T &key);
+
+    std::vector<offset> search_between(BPTree<T> &tree, const T &begin_key, const T &end_key);
+
+    std::vector<offset> search_smaller(BPTree<T> &tree, const T &end_key);
+
+    std::vector<offset> search_greater(BPTree<T> &tree, const T &begin_key);
+
+    // Apply the buffered changes to tree.
+    void flush(BPTree<T> &tree);
+
+    // The tree took writes past the buffer, so refill the filter before it
+    // is asked again.
+    void invalidate();
+
+    // @return: number of buffered changes.
+    size_t size() const;
+
+    // @return: bytes held by the changes, the hash table and the filter.
+    size_t memory_bytes() const;
+
+    static const size_t default_bytes = 8 << 20;
+
+private:
+    struct change {
+        T key;
+        // The key is deleted from the tree, whose value was old_value.
+        bool erased;
+        offset old_value;
+        // The key is inserted with value.
+        bool inserted;
+        offset value;
+    };
+    typedef typename std::vector<change>::iterator change_iterator;
+
+    // Filter bits per key, 3 bits of one word are set for each.
+    static const size_t filter_bits = 16;
+
+    // @return: the change of key, nullptr if none.
+    change *find(const T &key);
+
+    // Add a change, applying all of them once full.
+    void append(BPTree<T> &tree, const change &c);
+
+    // Sort the changes appended since the last sort into the others.
+    void settle();
+
+    // Point the hash table at the changes again, after they moved.
+    void rehash();
+
+    // @return: false if key is surely not in tree.
+    bool may_contain(const T &key) const;
+
+    void add_to_filter(const T &key);
+
+    // Size the filter for the tree and fill it with its keys.
+    void refill(BPTree<T> &tree);
+
+    // Make the filter cover the tree, refilling it if invalid or too full.
+    void prepare(BPTree<T> &tree);
+
+    // @return: offsets of a tree search, less the values erased and plus
+    //  the values inserted by changes in [first, last).
+    static std::vector<offset> merge(std::vector<offset> found, change_iterator first, change_iterator last);
+
+    // @return: first change with key not less than begin_key, after
+    //  sorting them.
+    change_iterator lower_bound(const T &begin_key);
+
+    change_iterator upper_bound(const T &end_key);
+
+    size_t capacity;
+    // Changes, in key order up to sorted_num.
+    std::vector<change> changes;
+    size_t sorted_num;
+    // Open addressing on key_hash, position in changes plus one, 0 if empty.
+    std::vector<uint32_t> slots;
+    std::vector<uint64_t> filter;
+    // Keys the filter was sized for, and keys added to it.
+    size_t filter_planned;
+    size_t filter_keys;
+    bool filter_valid;
+};
+
+template<class T>
+WriteBuffer<T>::WriteBuffer(size_t capacity)
+        : capacity(capacity > 0 ? capacity : default_bytes / sizeof(change)), sorted_num(0), filter_planned(0),
+          filter_keys(0), filter_valid(false) {
+    size_t slot_num = 2;
+    while (slot_num < 2 * this->capacity)
+        slot_num *= 2;
+    slots.assign(slot_num, 0);
+    changes.reserve(this->capacity);
+}
+
+template<class T>
+typename WriteBuffer<T>::change *WriteBuffer<T>::find(const T &key) {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = key_hash(key) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        change &c = changes[slots[slot] - 1];
+        if (c.key == key)
+            return &c;
+    }
+    return nullptr;
+}
+
+template<class T>
+void WriteBuffer<T>::append(BPTree<T> &tree, const change &c) {
+    size_t mask = slots.size() - 1;
+    size_t slot = key_hash(c.key) & mask;
+    while (slots[slot] != 0)
+        slot = (slot + 1) & mask;
+    changes.push_back(c);
+    slots[slot] = static_cast<uint32_t>(changes.size());
+    if (changes.size() >= capacity)
+        flush(tree);
+}
+
+template<class T>
+void WriteBuffer<T>::rehash() {
+    std::fill(slots.begin(), slots.end(), 0);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < changes.size(); i++) {
+        size_t slot = key_hash(changes[i].key) & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+template<class T>
+void WriteBuffer<T>::settle() {
+    if (sorted_num == changes.size())
+        return;
+    auto less = [](const change &a, const change &b) { return a.key < b.key; };
+    std::sort(changes.begin() + sorted_num, changes.end(), less);
+    std::inplace_merge(changes.begin(), changes.begin() + sorted_num, changes.end(), less);
+    sorted_num = changes.size();
+    rehash();
+}
+
+template<class T>
+typename WriteBuffer<T>::change_iterator WriteBuffer<T>::lower_bound(const T &begin_key) {
+    settle();
+    return std::lower_bound(changes.begin(), changes.end(), begin_key,
+                            [](const change &c, const T &key) { return c.key < key; });
+}
+
+template<class T>
+typename WriteBuffer<T>::change_iterator WriteBuffer<T>::upper_bound(const T &end_key) {
+    settle();
+    return std::upper_bound(changes.begin(), changes.end(), end_key,
+                            [](const T &key, const change &c) { return key < c.key; });
+}
+
+template<class T>
+bool WriteBuffer<T>::may_contain(const T &key) const {
+    uint64_t h = key_hash(key);
+    uint64_t word = filter[h & (filter.size() - 1)];
+    uint64_t bits = (uint64_t(1) << ((h >> 32) & 63)) | (uint64_t(1) << ((h >> 40) & 63)) |
+                    (uint64_t(1) << ((h >> 48) & 63));
+    return (word & bits) == bits;
+}
+
+template<class T>
+void WriteBuffer<T>::add_to_filter(const T &key) {
+    uint64_t h = key_hash(key);
+    filter[h & (filter.size() - 1)] |= (uint64_t(1) << ((h >> 32) & 63)) | (uint64_t(1) << ((h >> 40) & 63)) |
+                                       (uint64_t(1) << ((h >> 48) & 63));
+    filter_keys++;
+}
+
+template<class T>
+void WriteBuffer<T>::refill(BPTree<T> &tree) {
+    // Leave room for the tree to double.
+    filter_planned = 2 * (static_cast<size_t>(tree.size()) + capacity);
+    size_t words = 1;
+    while (words * 64 < filter_planned * filter_bits)
+        words *= 2;
+    filter.assign(words, 0);
+    filter_keys = 0;
+    for (auto it = tree.first(); it.valid(); it.next())
+        add_to_filter(it.key());
+    filter_valid = true;
+}
+
+template<class T>
+void WriteBuffer<T>::prepare(BPTree<T> &tree) {
+    if (!filter_valid || filter_keys > filter_planned)
+        refill(tree);
+}
+
+template<class T>
+void WriteBuffer<T>::insert(BPTree<T> &tree, const T &key, offset value) {
+    change *c = find(key);
+    if (c) {
+        if (c->inserted)
+            throw DuplicateKey();
+        c->inserted = true;
+        c->value = value;
+        return;
+    }
+    prepare(tree);
+    if (may_contain(key) && tree.search_by_key(key) != -1)
+        throw DuplicateKey();
+    append(tree, change{key, false, 0, true, value});
+}
+
+template<class T>
+void WriteBuffer<T>::delete_by_key(BPTree<T> &tree, const T &key) {
+    change *c = find(key);
+    if (c) {
+        // A change of neither kind is left in place, the hash table can not
+        // drop it.
+        if (!c->inserted)
+            throw KeyNotExist();
+        c->inserted = false;
+        return;
+    }
+    prepare(tree);
+    offset old_value = may_contain(key) ? tree.search_by_key(key) : -1;
+    if (old_value == -1)
+        throw KeyNotExist();
+    append(tree, change{key, true, old_value, false, 0});
+}
+
+template<class T>
+offset WriteBuffer<T>::search_by_key(BPTree<T> &tree, const T &key) {
+    change *c = find(key);
+    if (!c)
+        return tree.search_by_key(key);
+    return c->inserted ? c->value : -1;
+}
+
+template<class T>
+std::vector<offset> WriteBuffer<T>::merge(std::vector<offset> found, change_iterator first, change_iterator last) {
+    std::vector<offset> erased, inserted;
+    for (auto it = first; it != last; ++it) {
+        if (it->erased)
+            erased.push_back(it->old_value);
+        if (it->inserted)
+            inserted.push_back(it->value);
+    }
+    if (erased.empty() && inserted.empty())
+        return found;
+    std::sort(erased.begin(), erased.end());
+    std::vector<offset> results;
+    std::set_difference(found.begin(), found.end(), erased.begin(), erased.end(), std::back_inserter(results));
+    results.insert(results.end(), inserted.begin(), inserted.end());
+    std::sort(results.begin(), results.end());
+    results.erase(std::unique(results.begin(), results.end()), results.end());
+    return results;
+}
+
+template<class T>
+std::vector<offset> WriteBuffer<T>::search_between(BPTree<T> &tree, const T &begin_key, const T &end_key) {
+    if (end_key < begin_key)
+        return search_between(tree, end_key, begin_key);
+    return merge(tree.search_between(begin_key, end_key), lower_bound(begin_key), upper_bound(end_key));
+}
+
+template<class T>
+std::vector<offset> WriteBuffer<T>::search_smaller(BPTree<T> &tree, const T &end_key) {
+    auto last = upper_bound(end_key);
+    return merge(tree.search_smaller(end_key), changes.begin(), last);
+}
+
+template<class T>
+std::vector<offset> WriteBuffer<T>::search_greater(BPTree<T> &tree, const T &begin_key) {
+    auto first = lower_bound(begin_key);
+    return merge(tree.search_greater(begin_key), first, changes.end());
+}
+
+template<class T>
+void WriteBuffer<T>::flush(BPTree<T> &tree) {
+    if (changes.empty())
+        return;
+    settle();
+    std::vector<T> keys;
+    std::vector<offset> values;
+    for (auto &c : changes) {
+        if (c.erased)
+            tree.delete_by_key(c.key);
+        if (c.inserted) {
+            keys.push_back(c.key);
+            values.push_back(c.value);
+        }
+    }
+    changes.clear();
+    sorted_num = 0;
+    std::fill(slots.begin(), slots.end(), 0);
+    tree.insert_sorted(keys, values);
+    if (filter_valid) {
+        for (auto &key : keys)
+            add_to_filter(key);
+    }
+}
+
+template<class T>
+void WriteBuffer<T>::invalidate() {
+    filter_valid = false;
+}
+
+template<class T>
+size_t WriteBuffer<T>::size() const {
+    return changes.size();
+}
+
+template<class T>
+size_t WriteBuffer<T>::memory_bytes() const {
+    return changes.capacity() * sizeof(change) + slots.capacity() * sizeof(uint32_t) +
+           filter.capacity() * sizeof(uint64_t);
+}
+
+#endif //MINISQL_WRITEBUFFER_H
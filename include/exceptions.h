@@ -87,6 +87,48 @@ public:
     }
 
 
+private:
+    const char *ptr;
+};
+
+class PayloadSizeDisaccord : public std::exception {
+public:
+    explicit PayloadSizeDisaccord(const char *ptr = "Included columns disaccord with the index") : ptr(ptr) {}
+
+    char const *what() const noexcept override {
+        std::cout << this->ptr << std::endl;
+        return ptr;
+    }
+
+
+private:
+    const char *ptr;
+};
+
+class IndexFileError : public std::exception {
+public:
+    explicit IndexFileError(const char *ptr = "Index file can not be read or written") : ptr(ptr) {}
+
+    char const *what() const noexcept override {
+        std::cout << this->ptr << std::endl;
+        return ptr;
+    }
+
+
+private:
+    const char *ptr;
+};
+
+class IndexFrozen : public std::exception {
+public:
+    explicit IndexFrozen(const char *ptr = "Index is frozen, thaw it first") : ptr(ptr) {}
+
+    char const *what() const noexcept override {
+        std::cout << this->ptr << std::endl;
+        return ptr;
+    }
+
+
 private:
     const char *ptr;
 };
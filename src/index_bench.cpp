@@ -0,0 +1,365 @@
+// YCSB style benchmark of IndexManager.
+// Usage:
+//   index_bench [--workload=read|write|scan|mixed|all] [--dist=seq|uniform|zipf|all]
+//               [--key=int|float|string|all] [--keys=N] [--ops=N] [--scan=N]
+//               [--theta=F] [--seed=N] [--csv=FILE] [--json=FILE]
+// Every combination of the chosen workloads, distributions and key types is
+// run on a fresh index. A row per operation type is printed, and appended to
+// the CSV file and, as one JSON object per line, to the JSON file.
+
+#include "IndexManager.h"
+#include "Histogram.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <random>
+
+namespace {
+
+struct bench_config {
+    std::string workload = "read";
+    std::string dist = "uniform";
+    std::string key = "int";
+    uint64_t keys = 100000;
+    uint64_t ops = 1000000;
+    int scan = 100;
+    double theta = 0.99;
+    unsigned int seed = 42;
+    std::string csv;
+    std::string json;
+};
+
+// Mix of operations in percent.
+struct workload_mix {
+    const char *name;
+    int read;
+    int insert;
+    int remove;
+    int scan;
+};
+
+const workload_mix workloads[] = {
+        {"read",  95, 5,  0,  0},
+        {"write", 5,  95, 0,  0},
+        {"scan",  0,  5,  0,  95},
+        {"mixed", 50, 25, 25, 0},
+};
+
+enum op_type {
+    op_read, op_insert, op_remove, op_scan, op_num
+};
+
+const char *op_names[op_num] = {"read", "insert", "delete", "scan"};
+
+// Zipfian generator over [0, n) as in YCSB (Gray et al.): item 0 is hottest.
+class zipf_generator {
+public:
+    zipf_generator(uint64_t n, double theta) : n(n), theta(theta) {
+        for (uint64_t i = 1; i <= n; i++)
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    template<class G>
+    uint64_t next(G &gen) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+        double uz = u * zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, theta))
+            return 1;
+        auto item = static_cast<uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha));
+        return item < n ? item : n - 1;
+    }
+
+private:
+    uint64_t n;
+    double theta;
+    double zetan = 0.0;
+    double alpha;
+    double eta;
+};
+
+// Keys live in a 30 bit space, small enough to map every key to a distinct
+// finite float.
+const uint32_t key_space = 1u << 30;
+
+// Position in key space of the id-th record. Ids map to keys in order for
+// the sequential distribution, and through a bijective hash otherwise, so
+// that new ids land all over the key space.
+uint32_t key_slot(const bench_config &config, uint64_t id) {
+    uint32_t k = static_cast<uint32_t>(id);
+    if (config.dist != "seq")
+        k *= 2654435761u;
+    return k & (key_space - 1);
+}
+
+IndexManager::dtype make_key(const bench_config &config, uint32_t slot) {
+    if (config.key == "float") {
+        // Keep floats ordered: 1.0f plus slot units in the last place.
+        uint32_t bits = 0x3f800000u + slot;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return IndexManager::dtype(f);
+    } else if (config.key == "string") {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key%012u", slot);
+        return IndexManager::dtype(std::string(buf));
+    }
+    return IndexManager::dtype(static_cast<int>(slot));
+}
+
+int key_type(const bench_config &config) {
+    if (config.key == "float")
+        return IndexManager::type_float;
+    if (config.key == "string")
+        return 15;
+    return IndexManager::type_int;
+}
+
+struct bench_result {
+    double load_seconds;
+    double run_seconds;
+    Histogram latency[op_num];
+    uint64_t misses[op_num];
+};
+
+void run_one(const bench_config &config, const workload_mix &mix, bench_result &result) {
+    typedef std::chrono::steady_clock clock;
+    std::mt19937_64 gen(config.seed);
+    IndexManager manager;
+    std::string name = "bench";
+    manager.create_index(name, key_type(config));
+
+    // Load phase, in key order for seq and in random order otherwise.
+    std::vector<uint64_t> ids(config.keys);
+    for (uint64_t i = 0; i < config.keys; i++)
+        ids[i] = i;
+    if (config.dist != "seq")
+        std::shuffle(ids.begin(), ids.end(), gen);
+    auto start = clock::now();
+    for (auto id : ids)
+        manager.insert_index(name, make_key(config, key_slot(config, id)), static_cast<offset>(id));
+    result.load_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    std::vector<uint64_t>().swap(ids);
+
+    std::unique_ptr<zipf_generator> zipf;
+    if (config.dist == "zipf")
+        zipf.reset(new zipf_generator(config.keys, config.theta));
+    std::uniform_int_distribution<uint64_t> uniform(0, config.keys - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    uint64_t next_insert = config.keys, next_seq = 0;
+    // Width of key space holding about config.scan keys.
+    uint64_t scan_width = config.dist == "seq" ? config.scan : config.scan * (key_space / config.keys);
+    auto pick = [&]() -> uint64_t {
+        if (config.dist == "seq")
+            return next_seq++ % config.keys;
+        if (zipf)
+            return zipf->next(gen);
+        return uniform(gen);
+    };
+
+    for (int i = 0; i < op_num; i++) {
+        result.latency[i].reset();
+        result.misses[i] = 0;
+    }
+    start = clock::now();
+    for (uint64_t n = 0; n < config.ops; n++) {
+        int dice = percent(gen);
+        op_type op;
+        if (dice < mix.read)
+            op = op_read;
+        else if (dice < mix.read + mix.insert)
+            op = op_insert;
+        else if (dice < mix.read + mix.insert + mix.remove)
+            op = op_remove;
+        else
+            op = op_scan;
+
+        uint64_t id = op == op_insert ? next_insert++ : pick();
+        uint32_t slot = key_slot(config, id);
+        IndexManager::dtype key = make_key(config, slot);
+        IndexManager::dtype key_end = key;
+        if (op == op_scan)
+            key_end = make_key(config, static_cast<uint32_t>(std::min<uint64_t>(slot + scan_width - 1,
+                                                                                  key_space - 1)));
+        auto op_start = clock::now();
+        try {
+            switch (op) {
+                case op_read:
+                    if (manager.search_equal(name, key)[0] < 0)
+                        result.misses[op]++;
+                    break;
+                case op_insert:
+                    manager.insert_index(name, key, static_cast<offset>(id));
+                    break;
+                case op_remove:
+                    manager.delete_index(name, key);
+                    break;
+                default:
+                    manager.search_between(name, key, key_end);
+                    break;
+            }
+        } catch (std::exception &) {
+            result.misses[op]++;
+        }
+        auto op_end = clock::now();
+        result.latency[op].record(
+                static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(op_end - op_start).count()));
+    }
+    result.run_seconds = std::chrono::duration<double>(clock::now() - start).count();
+    manager.drop_index(name);
+}
+
+bool parse_arg(const std::string &arg, const std::string &name, std::string &value) {
+    std::string prefix = "--" + name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+std::vector<std::string> expand(const std::string &value, const std::vector<std::string> &all) {
+    if (value == "all")
+        return all;
+    return std::vector<std::string>(1, value);
+}
+
+void report(const bench_config &config, const bench_result &result) {
+    static bool header_printed = false;
+    if (!header_printed) {
+        printf("%-8s %-8s %-7s %10s %-7s %10s %12s %9s %9s %9s %9s %8s\n", "workload", "dist", "key", "keys", "op",
+               "count", "ops/s", "p50(ns)", "p99(ns)", "p999(ns)", "max(ns)", "misses");
+        header_printed = true;
+    }
+    std::time_t stamp = std::time(nullptr);
+    double throughput = result.run_seconds > 0 ? config.ops / result.run_seconds : 0.0;
+
+    bool csv_header = false;
+    if (!config.csv.empty()) {
+        std::ifstream probe(config.csv);
+        csv_header = !probe.good() || probe.peek() == std::ifstream::traits_type::eof();
+    }
+    std::ofstream csv, json;
+    if (!config.csv.empty())
+        csv.open(config.csv, std::ios::app);
+    if (!config.json.empty())
+        json.open(config.json, std::ios::app);
+    if (csv_header)
+        csv << "timestamp,workload,dist,key,keys,ops,load_s,run_s,throughput,op,count,mean_ns,p50_ns,p99_ns,"
+               "p999_ns,max_ns,misses\n";
+
+    if (json.is_open()) {
+        json << "{\"timestamp\":" << stamp << ",\"workload\":\"" << config.workload << "\",\"dist\":\""
+             << config.dist << "\",\"key\":\"" << config.key << "\",\"keys\":" << config.keys << ",\"ops\":"
+             << config.ops << ",\"load_s\":" << result.load_seconds << ",\"run_s\":" << result.run_seconds
+             << ",\"throughput\":" << throughput << ",\"latency\":{";
+    }
+    bool first = true;
+    for (int op = 0; op < op_num; op++) {
+        const Histogram &h = result.latency[op];
+        if (h.count() == 0)
+            continue;
+        printf("%-8s %-8s %-7s %10llu %-7s %10llu %12.0f %9llu %9llu %9llu %9llu %8llu\n", config.workload.c_str(),
+               config.dist.c_str(), config.key.c_str(), (unsigned long long) config.keys, op_names[op],
+               (unsigned long long) h.count(), throughput, (unsigned long long) h.percentile(0.5),
+               (unsigned long long) h.percentile(0.99), (unsigned long long) h.percentile(0.999),
+               (unsigned long long) h.max(), (unsigned long long) result.misses[op]);
+        if (csv.is_open()) {
+            csv << stamp << ',' << config.workload << ',' << config.dist << ',' << config.key << ',' << config.keys
+                << ',' << config.ops << ',' << result.load_seconds << ',' << result.run_seconds << ','
+                << throughput << ',' << op_names[op] << ',' << h.count() << ',' << h.mean() << ','
+                << h.percentile(0.5) << ',' << h.percentile(0.99) << ',' << h.percentile(0.999) << ',' << h.max()
+                << ',' << result.misses[op] << '\n';
+        }
+        if (json.is_open()) {
+            json << (first ? "" : ",") << '"' << op_names[op] << "\":{\"count\":" << h.count() << ",\"mean_ns\":"
+                 << h.mean() << ",\"p50_ns\":" << h.percentile(0.5) << ",\"p99_ns\":" << h.percentile(0.99)
+                 << ",\"p999_ns\":" << h.percentile(0.999) << ",\"max_ns\":" << h.max() << ",\"misses\":"
+                 << result.misses[op] << '}';
+        }
+        first = false;
+    }
+    if (json.is_open())
+        json << "}}\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    bench_config config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i], value;
+        if (parse_arg(arg, "workload", value))
+            config.workload = value;
+        else if (parse_arg(arg, "dist", value))
+            config.dist = value;
+        else if (parse_arg(arg, "key", value))
+            config.key = value;
+        else if (parse_arg(arg, "keys", value))
+            config.keys = std::stoull(value);
+        else if (parse_arg(arg, "ops", value))
+            config.ops = std::stoull(value);
+        else if (parse_arg(arg, "scan", value))
+            config.scan = std::stoi(value);
+        else if (parse_arg(arg, "theta", value))
+            config.theta = std::stod(value);
+        else if (parse_arg(arg, "seed", value))
+            config.seed = static_cast<unsigned int>(std::stoul(value));
+        else if (parse_arg(arg, "csv", value))
+            config.csv = value;
+        else if (parse_arg(arg, "json", value))
+            config.json = value;
+        else {
+            fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (config.keys == 0) {
+        fprintf(stderr, "--keys must be positive\n");
+        return 1;
+    }
+
+    auto workload_names = expand(config.workload, {"read", "write", "scan", "mixed"});
+    auto dist_names = expand(config.dist, {"seq", "uniform", "zipf"});
+    auto key_names = expand(config.key, {"int", "float", "string"});
+    std::unique_ptr<bench_result> result(new bench_result);
+    for (auto &workload : workload_names) {
+        const workload_mix *mix = nullptr;
+        for (auto &candidate : workloads) {
+            if (workload == candidate.name)
+                mix = &candidate;
+        }
+        if (!mix) {
+            fprintf(stderr, "unknown workload %s\n", workload.c_str());
+            return 1;
+        }
+        for (auto &dist : dist_names) {
+            if (dist != "seq" && dist != "uniform" && dist != "zipf") {
+                fprintf(stderr, "unknown distribution %s\n", dist.c_str());
+                return 1;
+            }
+            for (auto &key : key_names) {
+                if (key != "int" && key != "float" && key != "string") {
+                    fprintf(stderr, "unknown key type %s\n", key.c_str());
+                    return 1;
+                }
+                bench_config run = config;
+                run.workload = workload;
+                run.dist = dist;
+                run.key = key;
+                run_one(run, *mix, *result);
+                report(run, *result);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
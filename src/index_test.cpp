@@ -2,7 +2,1104 @@
 #ifdef INDEX_TEST
 
 #include "IndexManager.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <random>
+#include <thread>
+
+// Failed checks, main returns nonzero if any.
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            failures++; \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(exception, statement) \
+    do { \
+        bool thrown = false; \
+        try { \
+            statement; \
+        } catch (exception &) { \
+            thrown = true; \
+        } \
+        CHECK(thrown && #statement); \
+    } while (0)
+
+// @return: offsets of the keys of reference in [key_begin, key_end], sorted
+//  as IndexManager returns them.
+template<typename T>
+std::vector<offset> reference_between(const std::map<T, offset> &reference, const T &key_begin, const T &key_end) {
+    std::vector<offset> results;
+    for (auto it = reference.lower_bound(key_begin); it != reference.end() && !(key_end < it->first); ++it)
+        results.push_back(it->second);
+    std::sort(results.begin(), results.end());
+    return results;
+}
+
+// Indexes built together from a batch of columns match ones built key by key.
+void test_batch_create_index() {
+    IndexManager manager;
+    std::vector<std::vector<IndexManager::dtype>> columns(3);
+    std::vector<offset> values;
+    const int row_num = 5000;
+    for (int i = 0; i < row_num; i++) {
+        int key = (i * 7919) % row_num;
+        char name[8];
+        snprintf(name, sizeof(name), "s%05d", key);
+        columns[0].push_back(key - row_num / 2);
+        columns[1].push_back(float(key) / 4);
+        columns[2].push_back(std::string(name));
+        values.push_back(i);
+    }
+    manager.batch_create_index({"batch_int", "batch_float", "batch_char"},
+                               {IndexManager::type_int, IndexManager::type_float, 6}, columns, values, 4);
+    manager.create_index("single_int", IndexManager::type_int);
+    manager.create_index("single_float", IndexManager::type_float);
+    manager.create_index("single_char", 6);
+    for (int i = 0; i < row_num; i++) {
+        manager.insert_index("single_int", columns[0][i], values[i]);
+        manager.insert_index("single_float", columns[1][i], values[i]);
+        manager.insert_index("single_char", columns[2][i], values[i]);
+    }
+    CHECK(manager.search_between("batch_int", -100, 100) == manager.search_between("single_int", -100, 100));
+    CHECK(manager.search_between("batch_int", -100, 100).size() == 201);
+    CHECK(manager.search_between("batch_float", 10.0f, 20.0f) == manager.search_between("single_float", 10.0f, 20.0f));
+    CHECK(manager.search_greater("batch_char", std::string("s04000")) ==
+          manager.search_greater("single_char", std::string("s04000")));
+    CHECK(manager.search_equal("batch_int", 7919 % row_num - row_num / 2) == std::vector<offset>{1});
+    CHECK_THROWS(DuplicateIndex, manager.batch_create_index({"batch_int"}, {IndexManager::type_int},
+                                                            {columns[0]}, values));
+}
+
+// A partitioned index matches a map through random inserts and deletes, takes
+// inserts from several threads, and spreads keys over its shards.
+void test_partitioned_index() {
+    IndexManager manager;
+    manager.create_partitioned_index("partitioned", IndexManager::type_int, 4);
+    std::map<int, offset> reference;
+    std::mt19937 gen(27);
+    for (int i = 0; i < 20000; i++) {
+        int key = static_cast<int>(gen() % 10000) - 5000;
+        if (gen() % 3) {
+            bool duplicate = reference.count(key) != 0;
+            try {
+                manager.insert_index("partitioned", key, i);
+                reference[key] = i;
+                CHECK(!duplicate);
+            } catch (DuplicateKey &) {
+                CHECK(duplicate);
+            }
+        } else {
+            bool missing = reference.count(key) == 0;
+            try {
+                manager.delete_index("partitioned", key);
+                reference.erase(key);
+                CHECK(!missing);
+            } catch (KeyNotExist &) {
+                CHECK(missing);
+            }
+        }
+    }
+    CHECK(manager.search_between("partitioned", -2000, 3000) == reference_between(reference, -2000, 3000));
+    CHECK(manager.search_greater("partitioned", 0) == reference_between(reference, 0, 5000));
+    CHECK(manager.search_smaller("partitioned", 0) == reference_between(reference, -5000, 0));
+
+    manager.create_partitioned_index("shared", IndexManager::type_int, 4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&manager, t]() {
+            for (int i = t; i < 8000; i += 4) {
+                manager.insert_index("shared", i, i);
+                if (i % 64 == t)
+                    manager.search_between("shared", i - 100, i);
+            }
+            std::vector<IndexManager::dtype> keys;
+            std::vector<offset> values;
+            for (int i = 0; i < 100; i++) {
+                keys.push_back(10000 + t * 100 + i);
+                values.push_back(10000 + t * 100 + i);
+            }
+            manager.batch_insert("shared", keys, values);
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    CHECK(manager.search_between("shared", 0, 8000).size() == 8000);
+    CHECK(manager.count_between("shared", 0, 20000) == 8400);
+
+    // Rebalancing splits ascending keys between two shards too.
+    PartitionedBPTree<int> tree("two_shards", 2);
+    for (int i = 0; i < 20000; i++)
+        tree.insert(i, i);
+    CHECK(tree.size() == 20000);
+    CHECK(tree.shard_size(0) > 5000 && tree.shard_size(1) > 5000);
+
+    // Appended keys open new ranges, so rebalancing moves about a key per
+    // insert instead of copying every shard again. Moved keys count as
+    // deletes of their old shard.
+    PartitionedBPTree<int> many("many_shards", 16);
+    for (int i = 0; i < 100000; i++)
+        many.insert(i, i);
+    unsigned int largest = 0;
+    for (unsigned int index = 0; index < many.shard_num(); index++)
+        largest = std::max(largest, many.shard_size(index));
+    CHECK(many.stats().deletes < 200000);
+    CHECK(largest * many.shard_num() < 2 * many.size());
+    CHECK(many.count_between(0, 100000) == 100000);
+    CHECK(many.rank(50000) == 50000);
+}
+
+// Histogram percentiles stay within the bucket error, and merging adds up.
+void test_histogram() {
+    Histogram histogram, other;
+    for (uint64_t value = 1; value <= 10000; value++)
+        histogram.record(value);
+    CHECK(histogram.count() == 10000);
+    CHECK(histogram.max() == 10000);
+    CHECK(histogram.mean() > 5000 && histogram.mean() < 5001);
+    uint64_t median = histogram.percentile(0.5), p99 = histogram.percentile(0.99);
+    CHECK(median * Histogram::sub_bucket_num >= 5000 * (Histogram::sub_bucket_num - 1) &&
+          median * (Histogram::sub_bucket_num - 1) <= 5000 * Histogram::sub_bucket_num);
+    CHECK(p99 * Histogram::sub_bucket_num >= 9900 * (Histogram::sub_bucket_num - 1) &&
+          p99 * (Histogram::sub_bucket_num - 1) <= 9900 * Histogram::sub_bucket_num);
+    other.record(1000000);
+    histogram.merge(other);
+    CHECK(histogram.count() == 10001);
+    CHECK(histogram.max() == 1000000);
+    histogram.reset();
+    CHECK(histogram.count() == 0 && histogram.percentile(0.5) == 0);
+}
+
+// Stats follow the shape of the tree and count the operations run on it.
+void test_stats() {
+    IndexManager manager;
+    manager.create_index("stats", IndexManager::type_int);
+    for (int i = 0; i < 10000; i++)
+        manager.insert_index("stats", i, i);
+    for (int i = 0; i < 1000; i++)
+        manager.delete_index("stats", i);
+    for (int i = 0; i < 100; i++)
+        manager.search_equal("stats", i);
+    index_stats stats = manager.stats("stats");
+    CHECK(stats.key_num == 9000);
+    CHECK(stats.inserts == 10000 && stats.deletes == 1000);
+    CHECK(stats.lookups >= 100);
+    CHECK(stats.splits > 0);
+    CHECK(stats.height > 1 && stats.height == stats.level_nodes.size());
+    CHECK(stats.level_nodes.front() == 1 && stats.level_nodes.back() == stats.leaf_num);
+    unsigned int node_num = 0;
+    for (auto level_node_num : stats.level_nodes)
+        node_num += level_node_num;
+    CHECK(node_num == stats.node_num);
+    CHECK(stats.leaf_fill > 0 && stats.leaf_fill <= 1);
+    CHECK(stats.bytes_used > 0);
+    manager.search_between("stats", 2000, 2999);
+    CHECK(manager.stats("stats").scanned_keys >= stats.scanned_keys + 1000);
+    CHECK(manager.all_stats().count("stats") == 1);
+    CHECK_THROWS(IndexNotExist, manager.stats("missing"));
+}
+
+// Tracer merges the histograms of every thread and keeps the newest slow
+// operations.
+void test_tracer() {
+    Tracer &tracer = Tracer::instance();
+    tracer.reset();
+    std::thread recorder([&tracer]() {
+        for (int i = 0; i < 100; i++)
+            tracer.local(trace_search_equal).record(1000);
+    });
+    recorder.join();
+    for (int i = 0; i < 50; i++)
+        tracer.local(trace_search_equal).record(2000);
+    CHECK(tracer.merged(trace_search_equal).count() == 150);
+    CHECK(tracer.merged(trace_search_equal).max() == 2000);
+    CHECK(tracer.merged(trace_insert_index).count() == 0);
+    for (size_t i = 0; i < Tracer::slow_log_capacity + 10; i++) {
+        slow_op record{};
+        record.op = trace_search_between;
+        record.latency = i;
+        tracer.log_slow(record);
+    }
+    std::vector<slow_op> slow_ops = tracer.slow_ops();
+    CHECK(slow_ops.size() == Tracer::slow_log_capacity);
+    CHECK(!slow_ops.empty() && slow_ops.front().latency == 10);
+#ifdef INDEX_TRACE
+    IndexManager manager;
+    manager.create_index("traced", IndexManager::type_int);
+    manager.insert_index("traced", 1, 1);
+    manager.search_equal("traced", 1);
+    CHECK(tracer.merged(trace_insert_index).count() == 1);
+    CHECK(tracer.merged(trace_search_equal).count() == 151);
+#endif
+    tracer.reset();
+    CHECK(tracer.merged(trace_search_equal).count() == 0 && tracer.slow_ops().empty());
+}
+
+// Ascending keys take the append path and fill leaves nearly full, and the
+// tree stays correct when deletes and random inserts follow.
+void test_monotonic_inserts() {
+    IndexManager manager;
+    manager.create_index("ascending", IndexManager::type_int);
+    std::map<int, offset> reference;
+    for (int i = 0; i < 20000; i++) {
+        manager.insert_index("ascending", i, i);
+        reference[i] = i;
+    }
+    CHECK(manager.stats("ascending").leaf_fill > 0.8);
+    CHECK_THROWS(DuplicateKey, manager.insert_index("ascending", 19999, 0));
+    std::mt19937 gen(31);
+    for (int i = 0; i < 20000; i += 2) {
+        manager.delete_index("ascending", i);
+        reference.erase(i);
+    }
+    for (int i = 0; i < 5000; i++) {
+        int key = static_cast<int>(gen() % 40000);
+        if (reference.count(key))
+            continue;
+        manager.insert_index("ascending", key, 20000 + i);
+        reference[key] = 20000 + i;
+    }
+    CHECK(manager.search_between("ascending", 0, 40000) == reference_between(reference, 0, 40000));
+    CHECK(manager.stats("ascending").key_num == reference.size());
+    for (auto &entry : reference)
+        CHECK(manager.search_equal("ascending", entry.first) == std::vector<offset>{entry.second});
+}
+
+// Relaxed deletes leave leaves sparse without restructuring, and compaction
+// merges them back in bounded steps.
+void test_relaxed_delete() {
+    IndexManager manager;
+    manager.create_index("relaxed", IndexManager::type_int);
+    std::map<int, offset> reference;
+    for (int i = 0; i < 20000; i++)
+        manager.insert_index("relaxed", i, i);
+    manager.set_relaxed_delete("relaxed", true);
+    unsigned int leaf_num = manager.stats("relaxed").leaf_num;
+    for (int i = 0; i < 20000; i++) {
+        if (i % 10)
+            manager.delete_index("relaxed", i);
+        else
+            reference[i] = i;
+    }
+    index_stats stats = manager.stats("relaxed");
+    CHECK(stats.merges == 0 && stats.borrows == 0);
+    CHECK(stats.leaf_num == leaf_num);
+    unsigned int merged = 0, step;
+    while ((step = manager.compact_index("relaxed", 16)) > 0) {
+        CHECK(step <= 16);
+        merged += step;
+    }
+    CHECK(merged > 0);
+    CHECK(manager.stats("relaxed").leaf_num == leaf_num - merged);
+    CHECK(manager.stats("relaxed").leaf_fill > stats.leaf_fill);
+    CHECK(manager.search_between("relaxed", 0, 20000) == reference_between(reference, 0, 20000));
+    manager.set_relaxed_delete("relaxed", false);
+    for (int i = 0; i < 20000; i += 20) {
+        manager.delete_index("relaxed", i);
+        reference.erase(i);
+    }
+    CHECK(manager.search_between("relaxed", 0, 20000) == reference_between(reference, 0, 20000));
+}
+
+// Packed leaves answer as plain ones through random changes, and take less
+// memory for dense keys.
+void test_compressed_index() {
+    IndexManager manager;
+    manager.create_index("packed", IndexManager::type_int);
+    manager.create_index("plain", IndexManager::type_int);
+    manager.set_compressed_index("packed", true);
+    std::mt19937 gen(33);
+    for (int i = 0; i < 30000; i++) {
+        // Mostly dense keys, some far apart to widen the packed fields.
+        int key = gen() % 8 ? static_cast<int>(gen() % 20000) : static_cast<int>(gen());
+        try {
+            manager.insert_index("plain", key, i);
+        } catch (DuplicateKey &) {
+            CHECK_THROWS(DuplicateKey, manager.insert_index("packed", key, i));
+            continue;
+        }
+        manager.insert_index("packed", key, i);
+        if (i % 3 == 0) {
+            manager.delete_index("plain", key);
+            manager.delete_index("packed", key);
+        }
+    }
+    for (int key = -100; key < 20100; key += 37)
+        CHECK(manager.search_equal("packed", key) == manager.search_equal("plain", key));
+    CHECK(manager.search_between("packed", 5000, 15000) == manager.search_between("plain", 5000, 15000));
+    CHECK(manager.search_greater("packed", 0) == manager.search_greater("plain", 0));
+    CHECK(manager.stats("packed").bytes_used < manager.stats("plain").bytes_used);
+    manager.set_compressed_index("packed", false);
+    CHECK(manager.search_greater("packed", 0) == manager.search_greater("plain", 0));
+    manager.create_index("packed_float", IndexManager::type_float);
+    CHECK_THROWS(TypeDisaccord, manager.set_compressed_index("packed_float", true));
+}
+
+// Every node profile answers the same, smaller nodes making more of them.
+void test_node_profiles() {
+    IndexManager manager;
+    const char *names[] = {"profile_cache", "profile_page", "profile_disk"};
+    node_profile profiles[] = {profile_cache, profile_page, profile_disk};
+    for (int p = 0; p < 3; p++)
+        manager.create_index(names[p], IndexManager::type_int, profiles[p]);
+    std::map<int, offset> reference;
+    std::mt19937 gen(34);
+    for (int i = 0; i < 30000; i++) {
+        int key = static_cast<int>(gen() % 50000);
+        bool erase = reference.count(key) != 0;
+        for (auto name : names) {
+            if (erase)
+                manager.delete_index(name, key);
+            else
+                manager.insert_index(name, key, i);
+        }
+        if (erase)
+            reference.erase(key);
+        else
+            reference[key] = i;
+    }
+    for (auto name : names) {
+        CHECK(manager.search_between(name, 10000, 40000) == reference_between(reference, 10000, 40000));
+        CHECK(manager.search_equal(name, reference.begin()->first) == std::vector<offset>{reference.begin()->second});
+    }
+    CHECK(manager.stats("profile_cache").height > manager.stats("profile_page").height);
+    CHECK(manager.stats("profile_page").node_num > manager.stats("profile_disk").node_num);
+}
+
+// Small nodes make a deep tree whose descents split, borrow and merge on
+// every level, down to an empty tree and back.
+void test_deep_tree() {
+    IndexManager manager;
+    manager.create_index("deep", 8, profile_cache);
+    std::map<std::string, offset> reference;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 6000; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "d%07d", (i * 7877) % 6000);
+        keys.push_back(key);
+        manager.insert_index("deep", keys.back(), i);
+        reference[keys.back()] = i;
+    }
+    CHECK(manager.stats("deep").height >= 3);
+    std::mt19937 gen(35);
+    std::shuffle(keys.begin(), keys.end(), gen);
+    for (size_t i = 0; i < keys.size(); i++) {
+        manager.delete_index("deep", keys[i]);
+        reference.erase(keys[i]);
+        if (i == 0)
+            CHECK_THROWS(KeyNotExist, manager.delete_index("deep", keys[i]));
+        if (i % 500 == 0) {
+            CHECK(manager.search_between("deep", std::string("d0000000"), std::string("d9999999")) ==
+                  reference_between(reference, std::string("d0000000"), std::string("d9999999")));
+            CHECK(manager.stats("deep").key_num == reference.size());
+        }
+    }
+    CHECK(manager.stats("deep").key_num == 0);
+    CHECK(manager.search_greater("deep", std::string("d0000000")).empty());
+    manager.insert_index("deep", keys[0], 1);
+    CHECK(manager.search_equal("deep", keys[0]) == std::vector<offset>{1});
+}
+
+// Cursors walk the leaves both ways, and descending searches return offsets
+// from the greatest key down.
+void test_descending() {
+    std::string name = "cursor";
+    BPTree<int> tree(name, profile_cache);
+    std::map<int, offset> reference;
+    std::mt19937 gen(36);
+    for (int i = 0; i < 5000; i++) {
+        int key = static_cast<int>(gen() % 20000);
+        if (reference.count(key))
+            continue;
+        tree.insert(key, i);
+        reference[key] = i;
+    }
+    auto expected = reference.lower_bound(7000);
+    auto it = tree.seek(7000);
+    for (int i = 0; i < 1000 && it.valid(); i++, it.next(), ++expected)
+        CHECK(it.key() == expected->first && it.value() == expected->second);
+    auto back = reference.rbegin();
+    int walked = 0;
+    for (it = tree.last(); it.valid(); it.prev(), ++back, walked++)
+        CHECK(back != reference.rend() && it.key() == back->first);
+    CHECK(walked == static_cast<int>(reference.size()));
+    it = tree.seek_back(7000, false);
+    CHECK(it.valid() && it.key() == std::prev(reference.lower_bound(7000))->first);
+
+    IndexManager manager;
+    manager.create_index("descending", IndexManager::type_int);
+    manager.create_partitioned_index("descending_partitioned", IndexManager::type_int, 4);
+    std::vector<offset> smaller, last;
+    for (auto entry = reference.rbegin(); entry != reference.rend(); ++entry) {
+        manager.insert_index("descending", entry->first, entry->second);
+        manager.insert_index("descending_partitioned", entry->first, entry->second);
+        if (last.size() < 100)
+            last.push_back(entry->second);
+        if (entry->first <= 7000 && smaller.size() < 300)
+            smaller.push_back(entry->second);
+    }
+    bool inclusive = reference.count(7000) != 0;
+    for (auto index_name : {"descending", "descending_partitioned"}) {
+        CHECK(manager.search_last(index_name, 100) == last);
+        CHECK(manager.search_smaller_desc(index_name, 7000, 300, true) == smaller);
+        CHECK(manager.search_smaller_desc(index_name, 7000, 300, false).front() == smaller[inclusive ? 1 : 0]);
+    }
+}
+
+// Counts, ranks and keys at ranks agree with a map, with and without counts
+// in the internal nodes.
+void test_counted_index() {
+    IndexManager manager;
+    manager.create_index("counted", IndexManager::type_int, profile_cache);
+    manager.create_index("uncounted", IndexManager::type_int, profile_cache);
+    manager.set_counted_index("counted", true);
+    std::map<int, offset> reference;
+    std::mt19937 gen(37);
+    for (int i = 0; i < 20000; i++) {
+        int key = static_cast<int>(gen() % 10000);
+        bool erase = reference.count(key) != 0;
+        for (auto index_name : {"counted", "uncounted"}) {
+            if (erase)
+                manager.delete_index(index_name, key);
+            else
+                manager.insert_index(index_name, key, i);
+        }
+        if (erase)
+            reference.erase(key);
+        else
+            reference[key] = i;
+    }
+    std::vector<int> keys;
+    for (auto &entry : reference)
+        keys.push_back(entry.first);
+    for (int i = 0; i < 200; i++) {
+        int key_begin = static_cast<int>(gen() % 10000), key_end = static_cast<int>(gen() % 10000);
+        if (key_end < key_begin)
+            std::swap(key_begin, key_end);
+        auto count = static_cast<unsigned int>(reference_between(reference, key_begin, key_end).size());
+        auto rank = static_cast<unsigned int>(std::lower_bound(keys.begin(), keys.end(), key_begin) - keys.begin());
+        unsigned int at = static_cast<unsigned int>(gen() % keys.size());
+        for (auto index_name : {"counted", "uncounted"}) {
+            CHECK(manager.count_between(index_name, key_begin, key_end) == count);
+            CHECK(manager.rank(index_name, key_begin) == rank);
+            IndexManager::dtype key;
+            offset value;
+            CHECK(manager.key_at_rank(index_name, at, key, value) && key.int_value == keys[at] &&
+                  value == reference[keys[at]]);
+        }
+    }
+    IndexManager::dtype key;
+    offset value;
+    CHECK(!manager.key_at_rank("counted", static_cast<unsigned int>(keys.size()), key, value));
+}
+
+// Pages put together give the whole range in key order, across leaves and
+// shards, and skip passes over keys.
+void test_paging() {
+    IndexManager manager;
+    manager.create_index("paged", IndexManager::type_int, profile_cache);
+    manager.create_index("paged_counted", IndexManager::type_int, profile_cache);
+    manager.set_counted_index("paged_counted", true);
+    manager.create_partitioned_index("paged_partitioned", IndexManager::type_int, 4);
+    // Offsets in reverse of key order, so key order shows.
+    std::vector<offset> in_key_order;
+    for (int key = 0; key < 5000; key++) {
+        for (auto index_name : {"paged", "paged_counted", "paged_partitioned"})
+            manager.insert_index(index_name, key * 2, 10000 - key);
+        if (key * 2 >= 1001 && key * 2 <= 8001)
+            in_key_order.push_back(10000 - key);
+    }
+    for (auto index_name : {"paged", "paged_counted", "paged_partitioned"}) {
+        IndexManager::page_token token;
+        std::vector<offset> pages;
+        size_t page_num = 0;
+        do {
+            auto page = manager.search_between(index_name, 1001, 8001, 333, 0, token);
+            CHECK(page.size() <= 333);
+            pages.insert(pages.end(), page.begin(), page.end());
+            page_num++;
+        } while (token.more && page_num < 100);
+        CHECK(pages == in_key_order);
+        CHECK(page_num == (in_key_order.size() + 332) / 333);
+
+        IndexManager::page_token skipped;
+        auto page = manager.search_between(index_name, 1001, 8001, 10, 1000, skipped);
+        CHECK(page == std::vector<offset>(in_key_order.begin() + 1000, in_key_order.begin() + 1010));
+        page = manager.search_between(index_name, 1001, 8001, 10, 5, skipped);
+        CHECK(page == std::vector<offset>(in_key_order.begin() + 1015, in_key_order.begin() + 1025));
+
+        IndexManager::page_token greater, smaller;
+        CHECK(manager.search_greater(index_name, 9990, 100, 0, greater) ==
+              (std::vector<offset>{10000 - 4995, 10000 - 4996, 10000 - 4997, 10000 - 4998, 10000 - 4999}));
+        CHECK(!greater.more);
+        CHECK(manager.search_smaller(index_name, 4, 2, 0, smaller) == (std::vector<offset>{10000, 9999}));
+        CHECK(smaller.more);
+        CHECK(manager.search_smaller(index_name, 4, 2, 0, smaller) == std::vector<offset>{9998});
+    }
+}
+
+// Included columns come back with their keys through splits and merges.
+void test_covering_index() {
+    IndexManager manager;
+    manager.create_index("covering", IndexManager::type_int, profile_cache, {4, 2});
+    CHECK(manager.included_columns("covering") == (std::vector<int>{4, 2}));
+    auto payload_of = [](int key) {
+        std::vector<char> payload(6);
+        memcpy(payload.data(), &key, sizeof(int));
+        payload[4] = static_cast<char>(key % 100);
+        payload[5] = static_cast<char>(key % 7);
+        return payload;
+    };
+    for (int key = 0; key < 3000; key++)
+        manager.insert_index("covering", key, key, payload_of(key));
+    for (int key = 0; key < 3000; key += 3)
+        manager.delete_index("covering", key);
+    std::vector<char> payload;
+    CHECK(manager.search_equal("covering", 1000, payload) == std::vector<offset>{1000});
+    CHECK(payload == payload_of(1000));
+    CHECK(manager.search_equal("covering", 999, payload) == std::vector<offset>{-1});
+    CHECK(payload.empty());
+    std::vector<char> payloads, expected;
+    std::vector<offset> offsets, expected_offsets;
+    offsets = manager.search_between("covering", 100, 2000, payloads);
+    for (int key = 100; key <= 2000; key++) {
+        if (key % 3 == 0)
+            continue;
+        expected_offsets.push_back(key);
+        auto row = payload_of(key);
+        expected.insert(expected.end(), row.begin(), row.end());
+    }
+    CHECK(offsets == expected_offsets);
+    CHECK(payloads == expected);
+    CHECK_THROWS(PayloadSizeDisaccord, manager.insert_index("covering", 5000, 5000, std::vector<char>(5)));
+    CHECK_THROWS(PayloadSizeDisaccord, manager.create_index("bad_covering", IndexManager::type_int, profile_page, {0}));
+}
+
+// @return: offsets sorted as search_between returns them.
+std::vector<offset> sorted(std::vector<offset> offsets) {
+    std::sort(offsets.begin(), offsets.end());
+    return offsets;
+}
+
+// Scans of the saved file return what the index held when saved, whatever
+// the read-ahead.
+void test_saved_scan() {
+    IndexManager manager;
+    manager.create_index("saved", IndexManager::type_float);
+    for (int i = 0; i < 20000; i++)
+        manager.insert_index("saved", float(i % 2 ? i : -i) / 8, i);
+    manager.save_index("saved");
+    auto expected = manager.search_between("saved", -1000.0f, 2000.0f);
+    CHECK(expected.size() == 12001);
+    for (unsigned int read_ahead : {0u, 1u, 8u, 64u})
+        CHECK(sorted(manager.search_between_saved("saved", -1000.0f, 2000.0f, read_ahead)) == expected);
+    CHECK(sorted(manager.search_between_saved("saved", 2000.0f, -1000.0f)) == expected);
+    // Key -1000 is row 8000, the greatest key in range is row 15999.
+    auto in_key_order = manager.search_between_saved("saved", -1000.0f, 2000.0f);
+    CHECK(!in_key_order.empty() && in_key_order.front() == 8000 && in_key_order.back() == 15999);
+    manager.insert_index("saved", 0.5f, 20000);
+    CHECK(sorted(manager.search_between_saved("saved", -1000.0f, 2000.0f)) == expected);
+    manager.drop_index("saved");
+}
+
+// Defragmentation runs in bounded steps to the end of a pass, reporting its
+// progress, and leaves dense leaves with the same keys.
+void test_defragment() {
+    IndexManager manager;
+    manager.create_index("fragmented", IndexManager::type_int, profile_cache);
+    std::map<int, offset> reference;
+    std::mt19937 gen(41);
+    for (int i = 0; i < 20000; i++) {
+        int key = static_cast<int>(gen() % 40000);
+        if (reference.count(key))
+            continue;
+        manager.insert_index("fragmented", key, i);
+        reference[key] = i;
+    }
+    manager.set_relaxed_delete("fragmented", true);
+    for (auto it = reference.begin(); it != reference.end();) {
+        if (gen() % 2) {
+            manager.delete_index("fragmented", it->first);
+            it = reference.erase(it);
+        } else
+            ++it;
+    }
+    index_stats before = manager.stats("fragmented");
+    defrag_progress progress;
+    unsigned int steps = 0;
+    uint64_t pass_keys = 0;
+    do {
+        progress = manager.defragment_index("fragmented", 20);
+        CHECK(progress.rewritten <= 20);
+        CHECK(progress.pass_keys >= pass_keys && progress.pass_keys <= progress.key_num);
+        pass_keys = progress.pass_keys;
+        steps++;
+    } while (!progress.finished && steps < 10000);
+    CHECK(progress.finished && steps > 1);
+    CHECK(progress.pass_keys == reference.size() && progress.key_num == reference.size());
+    index_stats after = manager.stats("fragmented");
+    CHECK(after.leaf_num < before.leaf_num);
+    CHECK(after.leaf_fill > 0.8);
+    CHECK(manager.search_between("fragmented", 0, 40000) == reference_between(reference, 0, 40000));
+    manager.insert_index("fragmented", 40001, 40001);
+    CHECK(manager.search_equal("fragmented", 40001) == std::vector<offset>{40001});
+}
+
+// Indexes listed in a catalog open lazily with their settings, and idle ones
+// close and open again on access.
+void test_catalog() {
+    const std::string catalog_file = "index_test.catalog";
+    std::remove(catalog_file.c_str());
+    std::vector<offset> int_range, float_range, char_range;
+    {
+        IndexManager manager;
+        manager.open_catalog(catalog_file);
+        manager.create_index("catalog_int", IndexManager::type_int, profile_cache);
+        manager.create_index("catalog_float", IndexManager::type_float);
+        manager.create_index("catalog_char", 4, profile_page, {2});
+        manager.set_counted_index("catalog_int", true);
+        manager.set_compressed_index("catalog_int", true);
+        for (int i = 0; i < 3000; i++) {
+            char key[8];
+            snprintf(key, sizeof(key), "%04d", i);
+            manager.insert_index("catalog_int", i * 3, i);
+            manager.insert_index("catalog_float", float(i) / 3, i);
+            manager.insert_index("catalog_char", std::string(key), i, {key[2], key[3]});
+        }
+        int_range = manager.search_between("catalog_int", 300, 3000);
+        float_range = manager.search_between("catalog_float", 10.0f, 20.0f);
+        char_range = manager.search_between("catalog_char", std::string("0100"), std::string("0200"));
+        manager.save_catalog();
+    }
+    {
+        IndexManager manager;
+        manager.open_catalog(catalog_file);
+        CHECK(!manager.index_open("catalog_int") && !manager.index_open("catalog_char"));
+        CHECK_THROWS(DuplicateIndex, manager.create_index("catalog_int", IndexManager::type_int));
+        CHECK(manager.search_between("catalog_int", 300, 3000) == int_range);
+        CHECK(manager.index_open("catalog_int") && !manager.index_open("catalog_float"));
+        CHECK(manager.count_between("catalog_int", 300, 3000) == int_range.size());
+        CHECK(manager.search_between("catalog_float", 10.0f, 20.0f) == float_range);
+        CHECK(manager.included_columns("catalog_char") == std::vector<int>{2});
+        std::vector<char> payload;
+        manager.search_equal("catalog_char", std::string("0123"), payload);
+        CHECK(payload == (std::vector<char>{'2', '3'}));
+        manager.insert_index("catalog_int", -3, 5000);
+        CHECK(manager.close_idle(std::chrono::milliseconds(0)) == 3);
+        CHECK(!manager.index_open("catalog_int"));
+        CHECK(manager.search_equal("catalog_int", -3) == std::vector<offset>{5000});
+        CHECK(manager.search_between("catalog_char", std::string("0100"), std::string("0200")) == char_range);
+        manager.drop_index("catalog_float");
+        manager.save_catalog();
+    }
+    {
+        IndexManager manager;
+        manager.open_catalog(catalog_file);
+        CHECK_THROWS(IndexNotExist, manager.search_equal("catalog_float", 1.0f));
+        CHECK(manager.search_equal("catalog_int", -3) == std::vector<offset>{5000});
+        manager.drop_index("catalog_int");
+        manager.drop_index("catalog_char");
+    }
+    {
+        std::ofstream file(catalog_file, std::ios::trunc);
+        file << "not a catalog\n";
+    }
+    IndexManager manager;
+    CHECK_THROWS(IndexFileError, manager.open_catalog(catalog_file));
+    std::remove(catalog_file.c_str());
+}
+
+// The memory budget closes the least recently used indexes, never the one
+// accessed nor partitioned ones, and closed indexes open again intact.
+void test_memory_budget() {
+    IndexManager manager;
+    std::vector<std::string> names = {"budget_0", "budget_1", "budget_2", "budget_3"};
+    for (auto &index_name : names) {
+        manager.create_index(index_name, IndexManager::type_int);
+        for (int i = 0; i < 20000; i++)
+            manager.insert_index(index_name, i, i);
+    }
+    manager.create_partitioned_index("budget_partitioned", IndexManager::type_int, 2);
+    for (int i = 0; i < 20000; i++)
+        manager.insert_index("budget_partitioned", i, i);
+    for (auto &index_name : names)
+        manager.search_equal(index_name, 1);
+    size_t one = manager.memory_used(names[0]);
+    CHECK(one > 0);
+    size_t partitioned = manager.memory_used("budget_partitioned");
+    manager.set_memory_budget(partitioned + 2 * one + one / 2);
+    CHECK(!manager.index_open(names[0]) && !manager.index_open(names[1]));
+    CHECK(manager.index_open(names[2]) && manager.index_open(names[3]));
+    CHECK(manager.index_open("budget_partitioned"));
+    CHECK(manager.memory_used() <= partitioned + 2 * one + one / 2);
+    CHECK(manager.memory_used(names[0]) == 0);
+    CHECK(manager.search_between(names[0], 100, 199).size() == 100);
+    CHECK(manager.index_open(names[0]) && !manager.index_open(names[2]));
+    manager.set_memory_budget(1);
+    CHECK(manager.index_open("budget_partitioned"));
+    CHECK(manager.search_equal(names[3], 19999) == std::vector<offset>{19999});
+    manager.set_memory_budget(0);
+    for (auto &index_name : names)
+        manager.drop_index(index_name);
+}
+
+// Float and string keys keep their order once encoded, including negative
+// floats, zeros, infinities and strings sharing long prefixes.
+void test_key_order() {
+    const float infinity = std::numeric_limits<float>::infinity();
+    std::vector<float> floats = {-infinity, -1e30f, -1.5f, -1e-40f, 0.0f, 1e-40f, 1e-10f, 1.0f, 3e38f, infinity};
+    for (size_t i = 0; i + 1 < floats.size(); i++)
+        CHECK(ordered_float(floats[i]) < ordered_float(floats[i + 1]));
+    for (auto value : floats)
+        CHECK(float_of_ordered(ordered_float(value)) == value);
+    CHECK(ordered_float(-0.0f) == ordered_float(0.0f));
+    CHECK(ordered_float(std::numeric_limits<float>::quiet_NaN()) > ordered_float(infinity));
+    CHECK(ordered_prefix("abc") < ordered_prefix("abd") && ordered_prefix("ab") < ordered_prefix("abc"));
+    CHECK(ordered_prefix("a\x7f") < ordered_prefix("a\x80"));
+
+    IndexManager manager;
+    manager.create_index("float_order", IndexManager::type_float);
+    manager.create_index("char_order", 12);
+    std::map<float, offset> float_reference;
+    std::map<std::string, offset> char_reference;
+    std::mt19937 gen(44);
+    for (int i = 0; i < 10000; i++) {
+        int mantissa = static_cast<int>(gen() % 2001) - 1000, exponent = static_cast<int>(gen() % 40) - 20;
+        float key = std::ldexp(static_cast<float>(mantissa), exponent);
+        if (!float_reference.count(key)) {
+            manager.insert_index("float_order", key, i);
+            float_reference[key] = i;
+        }
+        // Long shared prefixes, and bytes above 0x7f.
+        std::string name = "prefix__";
+        for (int j = 0; j < 4; j++)
+            name += static_cast<char>(gen() % 3 ? 'a' + gen() % 4 : 0x80 + gen() % 4);
+        if (!char_reference.count(name)) {
+            manager.insert_index("char_order", name, i);
+            char_reference[name] = i;
+        }
+    }
+    CHECK(manager.search_between("float_order", -10.0f, 10.0f) == reference_between(float_reference, -10.0f, 10.0f));
+    CHECK(manager.search_smaller("float_order", -0.001f) ==
+          reference_between(float_reference, -infinity, -0.001f));
+    CHECK(manager.search_greater("float_order", 0.001f) == reference_between(float_reference, 0.001f, infinity));
+    if (float_reference.count(0.0f))
+        CHECK(manager.search_equal("float_order", -0.0f) == std::vector<offset>{float_reference[0.0f]});
+    std::string begin = "prefix__b", end = "prefix__\x81";
+    begin.resize(12, 'a');
+    end.resize(12, 'a');
+    CHECK(manager.search_between("char_order", begin, end) == reference_between(char_reference, begin, end));
+    CHECK(manager.search_greater("char_order", end) ==
+          reference_between(char_reference, end, std::string(12, '\xff')));
+}
+
+// Range deletes remove exactly the keys in range, from plain, counted, packed
+// and partitioned indexes, which keep taking inserts afterwards.
+void test_delete_range() {
+    IndexManager manager;
+    std::vector<std::string> names = {"range_plain", "range_counted", "range_packed", "range_partitioned"};
+    manager.create_index(names[0], IndexManager::type_int, profile_cache);
+    manager.create_index(names[1], IndexManager::type_int, profile_cache);
+    manager.set_counted_index(names[1], true);
+    manager.create_index(names[2], IndexManager::type_int);
+    manager.set_compressed_index(names[2], true);
+    manager.create_partitioned_index(names[3], IndexManager::type_int, 4);
+    std::map<int, offset> reference;
+    std::mt19937 gen(45);
+    for (int round = 0; round < 40; round++) {
+        for (int i = 0; i < 500; i++) {
+            int key = static_cast<int>(gen() % 50000);
+            if (reference.count(key))
+                continue;
+            for (auto &index_name : names)
+                manager.insert_index(index_name, key, round * 500 + i);
+            reference[key] = round * 500 + i;
+        }
+        int key_begin = static_cast<int>(gen() % 50000);
+        int key_end = key_begin + static_cast<int>(gen() % (round % 4 ? 500 : 20000));
+        auto expected = static_cast<unsigned int>(reference_between(reference, key_begin, key_end).size());
+        reference.erase(reference.lower_bound(key_begin), reference.upper_bound(key_end));
+        for (auto &index_name : names)
+            CHECK(manager.delete_range(index_name, key_begin, key_end) == expected);
+    }
+    for (auto &index_name : names) {
+        CHECK(manager.search_between(index_name, 0, 50000) == reference_between(reference, 0, 50000));
+        CHECK(manager.delete_range(index_name, 60000, 70000) == 0);
+    }
+    CHECK(manager.count_between(names[1], 0, 50000) == reference.size());
+    CHECK(manager.stats(names[1]).key_num == reference.size());
+
+    // A range of fewer keys than the tree has nodes leaves the internal
+    // nodes away from it alone. Building the levels again would pack them
+    // and drop about a third of them.
+    manager.create_index("range_shape", IndexManager::type_int, profile_cache);
+    std::vector<int> keys(100000);
+    for (int i = 0; i < 100000; i++)
+        keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), gen);
+    for (auto key : keys)
+        manager.insert_index("range_shape", key, key);
+    index_stats before = manager.stats("range_shape");
+    CHECK(manager.delete_range("range_shape", 50000, 50999) == 1000);
+    index_stats after = manager.stats("range_shape");
+    CHECK(after.level_nodes.size() == before.level_nodes.size());
+    for (size_t level = 0; level + 1 < before.level_nodes.size() && level < after.level_nodes.size(); level++)
+        CHECK(after.level_nodes[level] + 2 >= before.level_nodes[level]);
+    CHECK(manager.delete_range("range_shape", 60000, 69999) == 10000);
+    CHECK(manager.count_between("range_shape", 0, 100000) == 89000);
+}
+
+// @return: predicate selecting keys of one index.
+IndexManager::predicate leaf_predicate(IndexManager::predicate::op_type op, const std::string &index_name,
+                                       const IndexManager::dtype &key_begin,
+                                       const IndexManager::dtype &key_end = IndexManager::dtype()) {
+    IndexManager::predicate where;
+    where.op = op;
+    where.index_name = index_name;
+    where.key_begin = key_begin;
+    where.key_end = key_end;
+    return where;
+}
+
+// @return: predicate combining children with op.
+IndexManager::predicate inner_predicate(IndexManager::predicate::op_type op,
+                                        const std::vector<IndexManager::predicate> &children) {
+    IndexManager::predicate where;
+    where.op = op;
+    where.children = children;
+    return where;
+}
+
+// Predicates over several indexes select the rows a scan of the rows would,
+// and a missing key selects none.
+void test_search_where() {
+    typedef IndexManager::predicate predicate;
+    IndexManager manager;
+    manager.create_index("where_a", IndexManager::type_int);
+    manager.create_index("where_b", IndexManager::type_float);
+    manager.set_counted_index("where_b", true);
+    const int row_num = 10000;
+    // Row i has a = i * 7 % row_num and b = i / 2.
+    for (int i = 0; i < row_num; i++) {
+        manager.insert_index("where_a", i * 7 % row_num, i);
+        manager.insert_index("where_b", float(i) / 2, i);
+    }
+    auto rows_where = [&](bool (*selected)(int a, float b)) {
+        std::vector<offset> rows;
+        for (int i = 0; i < row_num; i++) {
+            if (selected(i * 7 % row_num, float(i) / 2))
+                rows.push_back(i);
+        }
+        return rows;
+    };
+    auto a_between = leaf_predicate(predicate::op_between, "where_a", 1000, 5000);
+    auto b_smaller = leaf_predicate(predicate::op_smaller, "where_b", IndexManager::dtype(), 1000.0f);
+    auto b_greater = leaf_predicate(predicate::op_greater, "where_b", 4000.0f);
+    auto a_equal = leaf_predicate(predicate::op_equal, "where_a", 7 * 123);
+    auto a_missing = leaf_predicate(predicate::op_equal, "where_a", row_num + 5);
+    CHECK(manager.search_where(inner_predicate(predicate::op_and, {a_between, b_smaller})) ==
+          rows_where([](int a, float b) { return a >= 1000 && a <= 5000 && b <= 1000; }));
+    CHECK(manager.search_where(inner_predicate(predicate::op_or, {a_between, b_greater})) ==
+          rows_where([](int a, float b) { return (a >= 1000 && a <= 5000) || b >= 4000; }));
+    CHECK(manager.search_where(inner_predicate(predicate::op_and, {
+            inner_predicate(predicate::op_or, {b_smaller, b_greater}), a_between})) ==
+          rows_where([](int a, float b) { return (b <= 1000 || b >= 4000) && a >= 1000 && a <= 5000; }));
+    CHECK(manager.search_where(a_equal) == std::vector<offset>{123});
+    CHECK(manager.search_where(a_missing).empty());
+    CHECK(manager.search_where(inner_predicate(predicate::op_or, {a_missing, a_equal})) == std::vector<offset>{123});
+    CHECK(manager.search_where(inner_predicate(predicate::op_and, {a_missing, a_between})).empty());
+    CHECK_THROWS(IndexNotExist, manager.search_where(leaf_predicate(predicate::op_equal, "where_missing", 1)));
+}
+
+// Bitmap results hold the offsets of the vector searches, and combine as sets.
+void test_bitmap() {
+    IndexManager manager;
+    std::vector<std::string> names = {"bitmap_plain", "bitmap_packed", "bitmap_partitioned"};
+    manager.create_index(names[0], IndexManager::type_int);
+    manager.create_index(names[1], IndexManager::type_int);
+    manager.set_compressed_index(names[1], true);
+    manager.create_partitioned_index(names[2], IndexManager::type_int, 4);
+    std::mt19937 gen(47);
+    for (int key = 0; key < 50000; key++) {
+        // Dense runs of offsets and sparse ones, across many 2^16 blocks.
+        offset value = key < 30000 ? key : 30000 + static_cast<offset>(gen() % 5000000);
+        for (auto &index_name : names)
+            manager.insert_index(index_name, key, value);
+    }
+    for (auto &index_name : names) {
+        offset_bitmap low = manager.search_between_bitmap(index_name, 10000, 40000);
+        offset_bitmap high = manager.search_between_bitmap(index_name, 25000, 50000);
+        std::vector<offset> low_offsets = manager.search_between(index_name, 10000, 40000);
+        std::vector<offset> high_offsets = manager.search_between(index_name, 25000, 50000);
+        CHECK(low.to_vector() == low_offsets);
+        CHECK(low.cardinality() == low_offsets.size());
+        CHECK(low.contains(low_offsets.back()) && !low.contains(5));
+        std::vector<offset> both, either;
+        std::set_intersection(low_offsets.begin(), low_offsets.end(), high_offsets.begin(), high_offsets.end(),
+                              std::back_inserter(both));
+        std::set_union(low_offsets.begin(), low_offsets.end(), high_offsets.begin(), high_offsets.end(),
+                       std::back_inserter(either));
+        offset_bitmap intersection = low, union_of = low;
+        intersection &= high;
+        union_of |= high;
+        CHECK(intersection.to_vector() == both);
+        CHECK(union_of.to_vector() == either);
+        CHECK(manager.search_between_bitmap(index_name, 60000, 70000).empty());
+    }
+}
+
+// Parallel scans return the offsets of the range in key order, for plain and
+// partitioned indexes, small ranges and whole ones.
+void test_parallel_scan() {
+    IndexManager manager;
+    manager.create_index("parallel", IndexManager::type_int, profile_cache);
+    manager.create_partitioned_index("parallel_partitioned", IndexManager::type_int, 4);
+    std::map<int, offset> reference;
+    std::mt19937 gen(48);
+    for (int i = 0; i < 30000; i++) {
+        int key = static_cast<int>(gen() % 100000) - 50000;
+        if (reference.count(key))
+            continue;
+        offset value = static_cast<offset>(gen() % 1000000);
+        manager.insert_index("parallel", key, value);
+        manager.insert_index("parallel_partitioned", key, value);
+        reference[key] = value;
+    }
+    int bounds[][2] = {{-50000, 50000}, {-1000, 1000}, {123, 123}, {60000, 70000}, {-20000, 45000}};
+    for (auto &bound : bounds) {
+        std::vector<offset> in_key_order;
+        for (auto it = reference.lower_bound(bound[0]); it != reference.end() && it->first <= bound[1]; ++it)
+            in_key_order.push_back(it->second);
+        CHECK(manager.search_between_parallel("parallel", bound[0], bound[1]) == in_key_order);
+        CHECK(manager.search_between_parallel("parallel_partitioned", bound[0], bound[1]) == in_key_order);
+    }
+}
+
+// A frozen index answers as before in less memory, refuses writes, stays
+// frozen through the catalog, and takes writes again once thawed.
+void test_freeze() {
+    const std::string catalog_file = "freeze_test.catalog";
+    std::remove(catalog_file.c_str());
+    std::map<int, offset> reference;
+    std::vector<offset> range, greater;
+    {
+        IndexManager manager;
+        manager.open_catalog(catalog_file);
+        manager.create_index("frozen", IndexManager::type_int);
+        std::mt19937 gen(49);
+        for (int i = 0; i < 20000; i++) {
+            int key = static_cast<int>(gen() % 100000) - 50000;
+            if (reference.count(key))
+                continue;
+            manager.insert_index("frozen", key, i);
+            reference[key] = i;
+        }
+        range = manager.search_between("frozen", -10000, 10000);
+        greater = manager.search_greater("frozen", 30000);
+        size_t bytes = manager.memory_used("frozen");
+        manager.freeze_index("frozen");
+        CHECK(manager.index_frozen("frozen"));
+        CHECK(manager.memory_used("frozen") < bytes);
+        CHECK(manager.search_between("frozen", -10000, 10000) == range);
+        CHECK(manager.search_greater("frozen", 30000) == greater);
+        CHECK(manager.search_equal("frozen", reference.begin()->first) ==
+              std::vector<offset>{reference.begin()->second});
+        CHECK(manager.count_between("frozen", -10000, 10000) == range.size());
+        auto rank = static_cast<unsigned int>(std::distance(reference.begin(), reference.lower_bound(0)));
+        CHECK(manager.rank("frozen", 0) == rank);
+        CHECK_THROWS(IndexFrozen, manager.insert_index("frozen", 60000, 1));
+        CHECK_THROWS(IndexFrozen, manager.delete_index("frozen", reference.begin()->first));
+        CHECK_THROWS(IndexFrozen, manager.delete_range("frozen", 0, 100));
+        manager.save_catalog();
+    }
+    {
+        IndexManager manager;
+        manager.open_catalog(catalog_file);
+        CHECK(manager.index_frozen("frozen"));
+        CHECK(manager.search_between("frozen", -10000, 10000) == range);
+        CHECK_THROWS(IndexFrozen, manager.insert_index("frozen", 60000, 1));
+        manager.thaw_index("frozen");
+        CHECK(!manager.index_frozen("frozen"));
+        manager.insert_index("frozen", 60000, 100000);
+        CHECK(manager.search_greater("frozen", 30000).back() == 100000);
+        manager.drop_index("frozen");
+        manager.save_catalog();
+    }
+    std::remove(catalog_file.c_str());
+}
+
+// A buffered index answers as a plain one through random writes, searches
+// that merge the buffer and ones that flush it.
+void test_write_buffer() {
+    IndexManager manager;
+    manager.create_index("buffered", IndexManager::type_int);
+    manager.create_index("unbuffered", IndexManager::type_int);
+    manager.set_buffered_index("buffered", true, 300);
+    std::mt19937 gen(50);
+    for (int i = 0; i < 30000; i++) {
+        int key = static_cast<int>(gen() % 10000), kind = static_cast<int>(gen() % 100);
+        if (kind < 55) {
+            bool duplicate = false;
+            try {
+                manager.insert_index("unbuffered", key, i);
+            } catch (DuplicateKey &) {
+                duplicate = true;
+            }
+            if (duplicate)
+                CHECK_THROWS(DuplicateKey, manager.insert_index("buffered", key, i));
+            else
+                manager.insert_index("buffered", key, i);
+        } else if (kind < 90) {
+            bool missing = false;
+            try {
+                manager.delete_index("unbuffered", key);
+            } catch (KeyNotExist &) {
+                missing = true;
+            }
+            if (missing)
+                CHECK_THROWS(KeyNotExist, manager.delete_index("buffered", key));
+            else
+                manager.delete_index("buffered", key);
+        } else if (kind < 96) {
+            int key_end = key + static_cast<int>(gen() % 500);
+            CHECK(manager.search_equal("buffered", key) == manager.search_equal("unbuffered", key));
+            CHECK(manager.search_between("buffered", key, key_end) ==
+                  manager.search_between("unbuffered", key, key_end));
+            CHECK(manager.search_smaller("buffered", key) == manager.search_smaller("unbuffered", key));
+        } else if (kind < 98) {
+            CHECK(manager.count_between("buffered", key, key + 100) ==
+                  manager.count_between("unbuffered", key, key + 100));
+        } else {
+            CHECK(manager.delete_range("buffered", key, key + 50) == manager.delete_range("unbuffered", key, key + 50));
+        }
+    }
+    CHECK(manager.search_greater("buffered", 0) == manager.search_greater("unbuffered", 0));
+    CHECK(manager.stats("buffered").key_num == manager.stats("unbuffered").key_num);
+    manager.insert_index("buffered", 20000, 30000);
+    manager.insert_index("unbuffered", 20000, 30000);
+    manager.freeze_index("buffered");
+    CHECK(manager.search_greater("buffered", 0) == manager.search_greater("unbuffered", 0));
+    manager.thaw_index("buffered");
+    manager.delete_index("buffered", 20000);
+    manager.delete_index("unbuffered", 20000);
+    manager.flush_index("buffered");
+    manager.set_buffered_index("buffered", false);
+    CHECK(manager.search_greater("buffered", 0) == manager.search_greater("unbuffered", 0));
+    manager.create_partitioned_index("buffered_partitioned", IndexManager::type_int, 2);
+    CHECK_THROWS(TypeDisaccord, manager.set_buffered_index("buffered_partitioned", true));
+    manager.drop_index("buffered");
+}
 
 int main() {
     IndexManager indexManager;
@@ -37,7 +1134,34 @@ int main() {
         } catch (std::exception &e) { ;
         }
     }
-    return 0;
+    test_batch_create_index();
+    test_partitioned_index();
+    test_histogram();
+    test_stats();
+    test_tracer();
+    test_monotonic_inserts();
+    test_relaxed_delete();
+    test_compressed_index();
+    test_node_profiles();
+    test_deep_tree();
+    test_descending();
+    test_counted_index();
+    test_paging();
+    test_covering_index();
+    test_saved_scan();
+    test_defragment();
+    test_catalog();
+    test_memory_budget();
+    test_key_order();
+    test_delete_range();
+    test_search_where();
+    test_bitmap();
+    test_parallel_scan();
+    test_freeze();
+    test_write_buffer();
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures != 0;
 }
 
 #endif
\ No newline at end of file